@@ -18,10 +18,11 @@ namespace ham {
 // NOTE some input is passed on the command line (global configuration), while some is passed in a csv file (stuff that depends on each (pair of) sequence(s)).
 class Args {
 public:
-  Args(int argc, const char * argv[]);
+  Args(int argc, const char * argv[], bool exit_on_parse_error=true);  // set <exit_on_parse_error> to false to get an exception (rather than exit()) for bad arguments
   // void Check();  // make sure everything's the same length (i.e. the input file had all the expected columns)
 
   string hmmdir() { return hmmdir_arg_.getValue(); }
+  string hmm_bundle() { return hmm_bundle_arg_.getValue(); }
   string datadir() { return datadir_arg_.getValue(); }
   string infile() { return infile_arg_.getValue(); }
   string outfile() { return outfile_arg_.getValue(); }
@@ -33,9 +34,14 @@ public:
   float hamming_fraction_bound_hi() { return hamming_fraction_bound_hi_arg_.getValue(); }
   float logprob_ratio_threshold() { return logprob_ratio_threshold_arg_.getValue(); }
   float max_logprob_drop() { return max_logprob_drop_arg_.getValue(); }
+  float mute_freq_bucket_width() { return mute_freq_bucket_width_arg_.getValue(); }
+  float max_emission_cache_mb() { return max_emission_cache_mb_arg_.getValue(); }
+  float gene_prune_margin() { return gene_prune_margin_arg_.getValue(); }
+  float forward_tolerance() { return forward_tolerance_arg_.getValue(); }
   string algorithm() { return algorithm_arg_.getValue(); }
   string ambig_base() { return ambig_base_arg_.getValue(); }
   string seed_unique_id() { return seed_unique_id_arg_.getValue(); }
+  string socket() { return socket_arg_.getValue(); }
   int debug() { return debug_arg_.getValue(); }
   int naive_hamming_cluster() { return naive_hamming_cluster_arg_.getValue(); }
   int biggest_naive_seq_cluster_to_calculate() { return biggest_naive_seq_cluster_to_calculate_arg_.getValue(); }
@@ -45,24 +51,29 @@ public:
   unsigned min_largest_cluster_size() { return min_largest_cluster_size_arg_.getValue(); }
   unsigned max_cluster_size() { return max_cluster_size_arg_.getValue(); }
   unsigned random_seed() { return random_seed_arg_.getValue(); }
+  unsigned n_gene_threads() { return n_gene_threads_arg_.getValue(); }
+  unsigned n_threads() { return n_threads_arg_.getValue(); }
   bool no_chunk_cache() { return no_chunk_cache_arg_.getValue(); }
+  bool scaled_forward() { return scaled_forward_arg_.getValue(); }
+  bool climb_kspace() { return climb_kspace_arg_.getValue(); }
   bool partition() { return partition_arg_.getValue(); }
   bool dont_rescale_emissions() { return dont_rescale_emissions_arg_.getValue(); }
   bool cache_naive_seqs() { return cache_naive_seqs_arg_.getValue(); }
   bool cache_naive_hfracs() { return cache_naive_hfracs_arg_.getValue(); }
   bool only_cache_new_vals() { return only_cache_new_vals_arg_.getValue(); }
   bool write_logprob_for_each_partition() { return write_logprob_for_each_partition_arg_.getValue(); }
+  bool worker() { return worker_arg_.getValue(); }
  
   // command line arguments
   vector<string> algo_strings_;
   vector<int> debug_ints_;
   ValuesConstraint<string> algo_vals_;
   ValuesConstraint<int> debug_vals_;
-  ValueArg<string> hmmdir_arg_, datadir_arg_, infile_arg_, outfile_arg_, annotationfile_arg_, input_cachefname_arg_, output_cachefname_arg_, locus_arg_, algorithm_arg_, ambig_base_arg_, seed_unique_id_arg_;
-  ValueArg<float> hamming_fraction_bound_lo_arg_, hamming_fraction_bound_hi_arg_, logprob_ratio_threshold_arg_, max_logprob_drop_arg_;
+  ValueArg<string> hmmdir_arg_, hmm_bundle_arg_, datadir_arg_, infile_arg_, outfile_arg_, annotationfile_arg_, input_cachefname_arg_, output_cachefname_arg_, locus_arg_, algorithm_arg_, ambig_base_arg_, seed_unique_id_arg_, socket_arg_;
+  ValueArg<float> hamming_fraction_bound_lo_arg_, hamming_fraction_bound_hi_arg_, logprob_ratio_threshold_arg_, max_logprob_drop_arg_, mute_freq_bucket_width_arg_, max_emission_cache_mb_arg_, gene_prune_margin_arg_, forward_tolerance_arg_;
   ValueArg<int> debug_arg_, naive_hamming_cluster_arg_, biggest_naive_seq_cluster_to_calculate_arg_, biggest_logprob_cluster_to_calculate_arg_, n_partitions_to_write_arg_;
-  ValueArg<unsigned> n_final_clusters_arg_, min_largest_cluster_size_arg_, max_cluster_size_arg_, random_seed_arg_;
-  SwitchArg no_chunk_cache_arg_, partition_arg_, dont_rescale_emissions_arg_, cache_naive_seqs_arg_, cache_naive_hfracs_arg_, only_cache_new_vals_arg_, write_logprob_for_each_partition_arg_;
+  ValueArg<unsigned> n_final_clusters_arg_, min_largest_cluster_size_arg_, max_cluster_size_arg_, random_seed_arg_, n_gene_threads_arg_, n_threads_arg_;
+  SwitchArg no_chunk_cache_arg_, scaled_forward_arg_, climb_kspace_arg_, partition_arg_, dont_rescale_emissions_arg_, cache_naive_seqs_arg_, cache_naive_hfracs_arg_, only_cache_new_vals_arg_, write_logprob_for_each_partition_arg_, worker_arg_;
 
   // arguments read from csv input file
   map<string, vector<string> > strings_;
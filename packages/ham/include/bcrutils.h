@@ -10,8 +10,11 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <mutex>
+#include <memory>
 
 #include "model.h"
+#include "modelbundle.h"
 #include "text.h"
 
 using namespace std;
@@ -132,27 +135,40 @@ public:
 // ----------------------------------------------------------------------------------------
 class HMMHolder {
 public:
-  HMMHolder(string hmm_dir, GermLines &gl, Track *track): hmm_dir_(hmm_dir), gl_(gl), track_(track) {}
+  // if <bundle_fname> is set, we read hmms from there (see ModelBundle) rather than from the yaml files in <hmm_dir> (except for any that aren't in the bundle)
+  HMMHolder(string hmm_dir, GermLines &gl, Track *track, string bundle_fname = "", double mute_freq_bucket_width = 0., double max_emission_cache_mb = 200.) :
+    hmm_dir_(hmm_dir), gl_(gl), track_(track), bundle_(bundle_fname == "" ? nullptr : new ModelBundle(bundle_fname)),
+    mute_freq_bucket_width_(mute_freq_bucket_width), max_emission_cache_bytes_(1e6 * max_emission_cache_mb), emission_cache_bytes_(0.) {}
   ~HMMHolder();
-  Model *Get(string gene);
+  Model *Get(string gene);  // NOTE safe to call from several threads, but it takes a lock (and reads the hmm if it isn't already in memory), so it's better to Get() everybody you'll need beforehand, and to keep the pointers rather than calling it over and over
+  // <gene>'s emissions rescaled to <overall_mute_freq> (see Model::RescaledEmissions()), which we first round to the center of its bucket (if <mute_freq_bucket_width_> is set).
+  // We keep them around, so other queries with the same (bucketed) mute freq can use them. Also safe to call from several threads.
+  shared_ptr<EmissionTable> RescaledEmissions(string gene, double overall_mute_freq);
   Track *track() { return track_; }
-  // Rescale, within each hmm, the emission probabilities to reflect <overall_mute_freq> instead of the mute freq which was recorded in the hmm file.
-  // If <overall_mute_freq> is -INFINITY, we re-rescale them to what they were originally
-  void RescaleOverallMuteFreqs(map<string, set<string> > &only_genes, double overall_mute_freq);  // WOE BETIDE THEE WHO FORGETETH TO RE-RESET THESE
-  void UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes);
   void CacheAll();  // read all available hmms into memory
   string NameString(map<string, set<string> > *only_genes=nullptr, int max_to_print=-1);  // if more than <max_to_print> for any region, only print the number of genes for each region
 private:
+  bool Available(string gene);  // do we have either a bundle entry or a yaml file for <gene>?
+  unique_ptr<Model> Read(string gene);  // read <gene> from the bundle or yaml file
   string hmm_dir_;
   GermLines &gl_;
   map<string, Model*> hmms_; // map of gene name to hmm pointer
   Track *track_;  // each of the models has a track... but they should all be the same, so just toss one here for easy access
+  ModelBundle *bundle_;
+
+  mutex hmms_mutex_;  // guards <hmms_> (the models themselves never change once they're read, so they don't need one)
+
+  double mute_freq_bucket_width_;  // if zero, we only reuse rescaled emissions for exactly the same mute freq
+  double max_emission_cache_bytes_;  // if <rescaled_emissions_> gets bigger than this, we clear it
+  double emission_cache_bytes_;
+  map<pair<string, double>, shared_ptr<EmissionTable> > rescaled_emissions_;  // keyed by gene and (bucketed) mute freq
+  mutex emissions_mutex_;  // guards the previous two
 };
 
 // ----------------------------------------------------------------------------------------
 class Result {
 public:
-  Result(KBounds kbounds, string locus) : total_score_(-INFINITY), no_path_(false), locus_(locus), better_kbounds_(kbounds), boundary_error_(false), could_not_expand_(false), finalized_(false) {}
+  Result(KBounds kbounds, string locus) : total_score_(-INFINITY), total_score_error_(-INFINITY), no_path_(false), locus_(locus), better_kbounds_(kbounds), boundary_error_(false), could_not_expand_(false), finalized_(false) {}
   void PushBackRecoEvent(RecoEvent event) { events_.push_back(event); }
   void Finalize(GermLines &gl, map<string, double> &unsorted_per_gene_support, KSet best_kset, KBounds kbounds);
   RecoEvent &best_event() { assert(finalized_); return best_event_; }
@@ -160,11 +176,13 @@ public:
   bool could_not_expand() { return could_not_expand_; }
   KBounds better_kbounds() { return better_kbounds_; }
   double total_score() { return total_score_; }
+  double total_score_error() { return total_score_error_; }
   double total_score_;
+  double total_score_error_;  // log of an upper bound on how much bigger the real total prob is than exp(total_score_) (-INFINITY unless we pruned forward, see --forward-tolerance)
   bool no_path_;
+  void check_boundaries(KSet best, KBounds kbounds);  // and if you find errors, put expanded bounds in better_[kmin,kmax]_ (also used by DPHandler to decide whether a k space climb needs to look everywhere)
 
 private:
-  void check_boundaries(KSet best, KBounds kbounds);  // and if you find errors, put expanded bounds in better_[kmin,kmax]_
 
   string locus_;
   KBounds better_kbounds_;
@@ -176,14 +194,14 @@ private:
   RecoEvent best_event_;  // most likely event, among those in events_ (this event has its per_gene_support_ set). Set by Finalize().
 };
 
-void StreamHeader(ofstream &ofs, string algorithm);
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence> &seqs, string errors);
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence*> &pseqs, string errors);
+void StreamHeader(ostream &os, string algorithm);
+void StreamErrorput(ostream &os, string algorithm, vector<Sequence> &seqs, string errors);
+void StreamErrorput(ostream &os, string algorithm, vector<Sequence*> &pseqs, string errors);
 string PerGeneSupportString(vector<SupportPair> &support);
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence> &seqs, string errors);
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence*> &pseqs, string errors);
-void StreamForwardOutput(ofstream &ofs, vector<Sequence> &seqs, double total_score, string errors);
-void StreamForwardOutput(ofstream &ofs, vector<Sequence*> &pseqs, double total_score, string errors);
+void StreamViterbiOutput(ostream &os, RecoEvent &event, vector<Sequence> &seqs, string errors);
+void StreamViterbiOutput(ostream &os, RecoEvent &event, vector<Sequence*> &pseqs, string errors);
+void StreamForwardOutput(ostream &os, vector<Sequence> &seqs, double total_score, string errors);
+void StreamForwardOutput(ostream &os, vector<Sequence*> &pseqs, double total_score, string errors);
 
 string SeqStr(vector<Sequence*> &pseqs, string delimiter = " ");
 string SeqStr(vector<Sequence> &seqs, string delimiter = " ");
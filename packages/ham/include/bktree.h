@@ -0,0 +1,48 @@
+#ifndef HAM_BKTREE_H
+#define HAM_BKTREE_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "sequences.h"
+#include "clusterindex.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Burkhard-Keller tree of clusters' (packed) naive sequences, to find all the clusters within some hamming distance of a sequence without comparing it to every one of them.
+// Each node's children are keyed by their distance to the node, so the triangle inequality lets us skip any child whose key is more than <max_distance> from the query's distance to the node.
+// NOTE uses PackedSeq::FullHammingDistance(), since the distance that skips ambiguous positions isn't a metric
+// Removed clusters are only flagged, and we rebuild the tree once they're more than half of it.
+class BKTree {
+public:
+  BKTree() : n_removed_(0), max_n_ambiguous_(0) {}
+  void Insert(ClusterId id, const PackedSeq &seq);
+  void Remove(ClusterId id);  // NOTE does nothing if <id> isn't in the tree
+  vector<ClusterId> Within(const PackedSeq &seq, unsigned max_distance);  // all the clusters within <max_distance> of <seq>
+  size_t size() { return node_indices_.size(); }
+  unsigned max_n_ambiguous() { return max_n_ambiguous_; }  // most ambiguous positions in any sequence that we've inserted (including removed ones)
+
+private:
+  class Node {
+  public:
+    Node(ClusterId id, const PackedSeq &seq) : id_(id), seq_(seq), removed_(false) {}
+    ClusterId id_;
+    PackedSeq seq_;
+    bool removed_;
+    map<unsigned, size_t> children_;  // index in <nodes_> of the child at each distance
+  };
+
+  void Rebuild();
+
+  vector<Node> nodes_;  // nodes_[0] is the root
+  unordered_map<ClusterId, size_t> node_indices_;  // index in <nodes_> of each cluster that's still in the tree
+  size_t n_removed_;
+  unsigned max_n_ambiguous_;
+};
+
+}
+#endif
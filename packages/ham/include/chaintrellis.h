@@ -0,0 +1,83 @@
+#ifndef HAM_CHAINTRELLIS_H
+#define HAM_CHAINTRELLIS_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "model.h"
+#include "mathutils.h"
+#include "tracebackpath.h"
+
+using namespace std;
+namespace ham {
+
+class Trellis;
+
+// ----------------------------------------------------------------------------------------
+// Closed-form viterbi and forward for models with Model::chain_topology() (left inserts, a linear chain, right inserts).
+// Since a path through the chain is just a diagonal in the (chain position, sequence position) grid, we don't need to consider every edge at every
+// position: instead, we walk along each diagonal keeping a running sum of the emissions, and combine (max or log-sum-exp) the scores of the
+// places where we can enter the chain with the places where we can leave it. The insert blocks are small, so we do them with ordinary dp.
+// NOTE fills in the ending values for every length, same as the generic algorithms, so chunk caching works the same way
+class ChainTrellis {
+public:
+  ChainTrellis() : hmm_(nullptr), trell_(nullptr), seq_length_(0), min_entry_(0), max_entry_(0), min_exit_(0), max_exit_(0) {}
+  // <log_probs> and <indices> get the best log prob (including the end transition) and final state for each length
+  // if <prune_thresholds> is set, we drop any partial path whose log prob at a position is below the threshold for that position (see Trellis::SetPruneThresholds())
+  void Viterbi(Model *hmm, Trellis *trell, size_t seq_length, vector<double> &log_probs, vector<int> &indices, vector<double> *prune_thresholds = nullptr);
+  void Forward(Model *hmm, Trellis *trell, size_t seq_length, vector<double> &log_probs, vector<double> *prune_thresholds = nullptr, size_t *n_pruned = nullptr);  // same pruning as for Viterbi(), and we count the partial sums that we drop in <n_pruned>
+  void Traceback(size_t length, int final_state, TracebackPath &path);  // push back the best path of length <length> (as for Trellis::Traceback(), the states go on in reverse order)
+  double ApproxBytesUsed();
+
+private:
+  // running log of a sum of terms weight * exp(logval), kept as max logval plus a linear sum relative to it, so each term only costs one exp
+  class LogSum {
+  public:
+    LogSum() : max_(-INFINITY), sum_(0.) {}
+    inline void Add(double logval, double weight = 1.) {
+      if(logval == -INFINITY)
+	return;
+      if(logval <= max_) {
+	sum_ += weight * exp(logval - max_);
+      } else {
+	sum_ = sum_ * exp(max_ - logval) + weight;
+	max_ = logval;
+      }
+    }
+    inline bool empty() { return max_ == -INFINITY; }
+    inline double log_value() { return max_ + log(sum_); }
+    inline bool below(double logval) { return max_ < logval && max_ + log(sum_) < logval; }  // i.e. log_value() < <logval>, but usually without the log
+  private:
+    double max_, sum_;
+  };
+
+  inline void Maximize(double &best, double val, int &pointer, int ival) {
+    if(val > best) {
+      best = val;
+      pointer = ival;
+    }
+  }
+  void Init(Model *hmm, Trellis *trell, size_t seq_length);
+  double Weights(double *vals, size_t n_vals, double *more_vals = nullptr, size_t n_more_vals = 0);
+
+  Model *hmm_;
+  Trellis *trell_;
+  size_t seq_length_;
+  int min_entry_, max_entry_, min_exit_, max_exit_;  // first and last chain positions that are entry/exit points
+  vector<int> exit_chain_positions_;  // chain position of each exit point
+
+  // dp values and viterbi pointers, each indexed [position * (number of columns) + column]
+  vector<double> left_scores_;  // paths that are in left insert state <il> at each position
+  vector<int> left_pointers_;  // previous left insert (-1 for init)
+  vector<double> entry_scores_;  // paths that enter the chain at each entry point at each position (i.e. *not* including that position's emission) NOTE for forward these are linear, relative to <entry_offsets_>
+  vector<int> entry_pointers_;  // previous left insert (-1 for init)
+  vector<double> entry_offsets_;  // log offset for each position's <entry_scores_> (forward only)
+  vector<double> exit_scores_;  // paths that are at each chain exit point at each position
+  vector<int> exit_pointers_;  // chain position at which we entered the chain
+  vector<double> right_scores_;  // paths that are in right insert state <ir> at each position
+  vector<int> right_pointers_;  // previous right insert, or (-1 - ix) if we came from chain exit point <ix>
+  vector<double> weights_;  // scratch space for Weights()
+};
+
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef HAM_CLUSTERINDEX_H
+#define HAM_CLUSTERINDEX_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cassert>
+#include <limits>
+#include <stdint.h>
+
+#include "text.h"
+
+using namespace std;
+namespace ham {
+
+typedef unsigned ClusterId;
+const ClusterId NO_CLUSTER(numeric_limits<ClusterId>::max());
+
+// ----------------------------------------------------------------------------------------
+// Interns clusters as integer ids, so we don't have to pass around (and split, and join, and use as map keys) colon-joined uid strings, which get very long for big clusters.
+// A cluster is identified by the multiset of its members (the seed uid can appear more than once), regardless of their order, so the same cluster arrived at
+// by two different routes gets the same id. We look them up with a hash that's the sum of the members' hashes, so a merged cluster's hash is just the sum of its parents'.
+// A merged cluster's name and member list aren't built until somebody asks for them, and they're the same as they would've been with strings: the parents' names, sorted and joined with a colon.
+class ClusterIndex {
+public:
+  ClusterId Intern(string name);  // id for the cluster whose colon-separated uids are <name>
+  ClusterId Join(ClusterId id_a, ClusterId id_b);  // id for the cluster with the members of both <id_a> and <id_b>
+  const string &name(ClusterId id);  // NOTE references stay valid when we add more clusters
+  const vector<unsigned> &members(ClusterId id);  // indices (see uid()) of the cluster's members, in the same order as in its name
+  size_t size(ClusterId id) { return clusters_.at(id).size_; }
+  bool Contains(ClusterId id, unsigned iuid);
+  unsigned UidIndex(string uid);  // index of <uid> (adding it if we haven't seen it)
+  const string &uid(unsigned iuid) { return uids_.at(iuid); }
+  size_t n_clusters() { return clusters_.size(); }
+
+private:
+  class ClusterInfo {
+  public:
+    ClusterInfo(uint64_t hash, size_t size, ClusterId parent_a, ClusterId parent_b) : hash_(hash), size_(size), parent_a_(parent_a), parent_b_(parent_b) {}
+    uint64_t hash_;
+    size_t size_;
+    ClusterId parent_a_, parent_b_;  // NO_CLUSTER unless we made it with Join()
+    string name_;  // empty until somebody asks for it
+    vector<unsigned> members_;  // same
+  };
+
+  ClusterId Find(uint64_t hash, size_t size, vector<unsigned> members);  // look for a cluster with <members> (in any order), returning NO_CLUSTER if there isn't one
+  ClusterId Add(ClusterInfo cinfo);
+
+  vector<string> uids_;
+  vector<uint64_t> uid_hashes_;
+  unordered_map<string, unsigned> uid_indices_;
+  deque<ClusterInfo> clusters_;  // deque, so name() and members() references stay valid
+  unordered_multimap<uint64_t, ClusterId> ids_by_hash_;
+  map<pair<ClusterId, ClusterId>, ClusterId> joins_;  // so we only have to look up each pair's hash once
+};
+
+}
+#endif
@@ -9,11 +9,12 @@
 #include <stdexcept>
 
 #include "text.h"
+#include "clusterindex.h"
 
 using namespace std;
 namespace ham {
 
-typedef set<string> Partition;
+typedef set<ClusterId> Partition;
 
 // ----------------------------------------------------------------------------------------
 class ClusterPath {  // sequence of gradually coalescing partitions, with associated info
@@ -6,8 +6,13 @@
 #include <sstream>
 #include <math.h>
 #include <set>
+#include <algorithm>
 #include <iomanip>
 #include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <functional>
 
 #include "trellis.h"
 #include "mathutils.h"
@@ -33,10 +38,19 @@ public:
   void PrintCachedTrellisSize();
 
 private:
-  void RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes);
-  KSet FindPartialCacheMatch(string region, string gene, KSet kset);
-  void InitCache(string gene);
-  void FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin);
+  void RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, double> *total_score_errors, map<KSet, map<string, string> > *best_genes);
+  void ClimbKSpace(KBounds kbounds, function<void(KSet)> run_kset, map<KSet, double> &best_scores);  // run the ksets (with <run_kset>) along a path uphill from the middle of <kbounds>
+  void GetSweepBounds(string region, KSet kset, size_t seq_length, size_t *start, size_t *length);
+  size_t SweepLength(string region, KSet kset, size_t seq_length);  // length at which to look up <kset>'s score in the sweep trellis
+  size_t SweepId(Sequences &seqs, size_t start, size_t length);  // id (in <sweep_ids_>) of the query strings on [<start>, <start> + <length>)
+  set<string> FillSweepTrellises(string region, set<string> &genes, Sequences &seqs, size_t sweep_start, size_t sweep_length, size_t sweep_id);
+  void LookupLengthBounds(string region, size_t sweep_start, size_t sweep_length, size_t seq_length, size_t *min_length, size_t *max_length);  // range of lengths at which we'll look up scores in a sweep trellis
+  void RunPrunedTrellises(string region, set<string> &genes, vector<string> &new_genes, vector<Trellis*> &new_trellises, size_t sweep_start, size_t sweep_length, size_t seq_length, size_t sweep_id);
+  void RunTrellises(vector<Trellis*> &trellises, vector<vector<double> > *min_log_probs = nullptr);  // run the algorithm on each of <trellises>, in parallel if we have more than one thread
+  EmissionTable *Emissions(string gene);  // <gene>'s emissions for the current Run() call
+  Model *GetHMM(string gene);  // <gene>'s hmm, which we only look up in <hmms_> (which takes a lock) the first time
+  void RunAlgorithm(Trellis *trell, vector<double> *min_log_probs = nullptr);
+  void FillPath(string gene, KSet kset, Sequences &query_seqs, Trellis *sweep_trellis);
   RecoEvent FillRecoEvent(Sequences &seqs, KSet kset, map<string, string> &best_genes, double score);
   vector<string> GetQueryStrs(Sequences &seqs, KSet kset, string region);
 
@@ -56,10 +70,17 @@ private:
   // NOTE BEWARE DRAGONS AND ALL THAT SHIT!
   // if you add something new here you *must* clear it in Clear(), because we reuse the dphandler for different sequences UPDATE kind of don't do that any more
   // NOTE also that the vector<string> key can take up a ton of memory for multi-hmms with large k UPDATE dammit, no, I don't think that's where the memory was going
-  map<string, map<vector<string>, Trellis> > scratch_cachefo_;  // collection of the trellises that  we've calculated from scratch, so we can reuse them. eg: scratch_cachefo_["IGHV1-18*01"]["ACGGGTCG"] for single hmms, or scratch_cachefo_["IGHV1-18*01"][("ACGGGTCG","ATGGTTAG")] for pair hmms
-  map<string, map<KSet, TracebackPath> > paths_;
-  map<string, map<KSet, double> > scores_;
+  // Instead of running a trellis for every kset, we run one "sweep" trellis for each gene on the longest subsequence we'll need, and then look up the
+  // score for each kset at the appropriate length: for v that's one trellis on [0, k_v max), for d one for each k_v on [k_v, k_v + k_d max), and for
+  // j one on [k_v min + k_d min, end) using the reversed model, so its lengths are suffixes (see GetSweepBounds()).
+  map<string, map<size_t, Trellis> > scratch_cachefo_;  // sweep trellises, keyed by the id of their query strings (see SweepId()). eg: scratch_cachefo_["IGHV1-18*01"][sweep_ids_["ACGGGTCG"]] for single hmms, or scratch_cachefo_["IGHV1-18*01"][sweep_ids_[("ACGGGTCG","ATGGTTAG")]] for pair hmms
+  map<vector<string>, size_t> sweep_ids_;  // id for each set of sweep query strings, so we compare strings once per sweep, rather than for every gene in every kset
+  map<pair<size_t, size_t>, size_t> sweep_ids_by_bounds_;  // same ids, keyed by (start, length) in the current Run() call's sequences, so we usually don't need the strings at all (cleared in each Run(), since the sequences change)
+  map<string, map<KSet, TracebackPath> > paths_;  // NOTE only filled for the genes we need (the best ones for each kset, plus everybody for debug printing)
   map<string, double> per_gene_support_;  // log prob of the best (full) annotation for each gene
+  KBounds kbounds_;  // for the current Run() call
+  map<string, Model*> models_;  // hmms that we've already gotten from <hmms_> (see GetHMM())
+  map<string, shared_ptr<EmissionTable> > emissions_;  // emissions for each gene rescaled to the current Run() call's mute freq (empty if we're not rescaling). NOTE the tables belong to HMMHolder's cache, but we need to keep them alive in case it gets cleared
 };
 }
 #endif
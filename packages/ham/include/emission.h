@@ -17,9 +17,7 @@ namespace ham {
 class Emission {
 public:
   Emission();
-  void Parse(YAML::Node config, Track *track);
-  void ReplaceLogProbs(vector<double> new_log_probs) { scores_.ReplaceLogProbs(new_log_probs); }
-  void UnReplaceLogProbs() { scores_.UnReplaceLogProbs(); }
+  void Init(vector<double> probs, Track *track);  // <probs> in the order of <track>'s symbols
   ~Emission();
 
   double score(Sequence *seq, size_t pos) { return scores_.LogProb(seq, pos); }
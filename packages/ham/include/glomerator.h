@@ -8,11 +8,16 @@
 #include <ctime>
 #include <algorithm>
 #include <functional>
+#include <tuple>
 #include <pthread.h>
+#include <thread>
+#include <atomic>
+#include <exception>
 
 #include "args.h"
 #include "dphandler.h"
 #include "clusterpath.h"
+#include "bktree.h"
 #include "text.h"
 
 using namespace std;
@@ -23,9 +28,9 @@ typedef pair<vector<string>, vector<string> > ClusterPair;
 // ----------------------------------------------------------------------------------------
 class Query {
 public:
-  Query() {}
-  Query(string name, vector<Sequence*> seqs, bool seed_missing, vector<string> only_genes, KBounds kbounds, float mute_freq, size_t cdr3_length, string p1="", string p2="") :
-    name_(name),
+  Query() : id_(NO_CLUSTER) {}
+  Query(ClusterId id, vector<Sequence*> seqs, bool seed_missing, vector<string> only_genes, KBounds kbounds, float mute_freq, size_t cdr3_length, ClusterId p1=NO_CLUSTER, ClusterId p2=NO_CLUSTER) :
+    id_(id),
     seqs_(seqs),
     seed_missing_(seed_missing),
     only_genes_(only_genes),
@@ -35,27 +40,82 @@ public:
   {
     // if(cdr3_length > 300)
     //   throw runtime_error("cdr3 length too big " + to_string(cdr3_length_) + " for " + name + "\n");
-    if(p1 != "" and p2 != "")
-      parents_ = pair<string, string>(p1, p2);
+    if(p1 != NO_CLUSTER and p2 != NO_CLUSTER)
+      parents_ = pair<ClusterId, ClusterId>(p1, p2);
     for(auto *pseq : seqs)
       if(pseq == nullptr)
-	throw runtime_error("null sequence pointer passed to Query constructor for " + name);
+	throw runtime_error("null sequence pointer passed to Query constructor for cluster " + to_string(id));
   }
 
-  string name_;
+  ClusterId id_;
   vector<Sequence*> seqs_;
   bool seed_missing_;
   vector<string> only_genes_;
   KBounds kbounds_;
   float mute_freq_;
   size_t cdr3_length_;
-  pair<string, string> parents_;  // queries that were joined to make this
+  pair<ClusterId, ClusterId> parents_ = pair<ClusterId, ClusterId>(NO_CLUSTER, NO_CLUSTER);  // queries that were joined to make this
+};
+
+// ----------------------------------------------------------------------------------------
+// a pair of clusters that we might merge, sorted by <val_> (smaller is better), with ties going to whichever pair a loop over the partition would come to first
+class CandidateMerge {
+public:
+  CandidateMerge(double val, ClusterId first, ClusterId second) : val_(val), first_(first), second_(second) {}
+  bool operator<(const CandidateMerge &rhs) const { return tie(val_, first_, second_) < tie(rhs.val_, rhs.first_, rhs.second_); }  // (any old order, for when we just need a set)
+  double val_;  // hfrac, or minus the lratio (zero if we haven't calculated it yet)
+  ClusterId first_, second_;
+};
+
+// ----------------------------------------------------------------------------------------
+// orders CandidateMerges by <val_>, and then by the clusters' names (rather than their ids, which depend on the order in which we happened to come across them)
+class CandidateOrder {
+public:
+  CandidateOrder(ClusterIndex *cluster_index) : cluster_index_(cluster_index) {}
+  bool operator()(const CandidateMerge &lhs, const CandidateMerge &rhs) const {
+    if(lhs.val_ != rhs.val_)
+      return lhs.val_ < rhs.val_;
+    if(lhs.first_ != rhs.first_)
+      return cluster_index_->name(lhs.first_) < cluster_index_->name(rhs.first_);
+    if(lhs.second_ != rhs.second_)
+      return cluster_index_->name(lhs.second_) < cluster_index_->name(rhs.second_);
+    return false;
+  }
+  ClusterIndex *cluster_index_;
+};
+
+// ----------------------------------------------------------------------------------------
+// cached values that outlive a Glomerator, so that a long-lived bcrham (--worker) doesn't have to re-read (or recalculate) them for every job.
+// Each Glomerator starts with everything in here (treating it as if it had been in the input cache file), and hands back everything it has when it's done.
+class GlomCache {
+public:
+  void Clear() { cluster_index_ = ClusterIndex(); log_probs_.clear(); naive_hfracs_.clear(); naive_seqs_.clear(); errors_.clear(); failed_queries_.clear(); settings_ = ""; }
+  ClusterIndex cluster_index_;  // the maps below are keyed by ids from this
+  map<ClusterId, double> log_probs_;
+  map<ClusterId, double> naive_hfracs_;
+  map<ClusterId, string> naive_seqs_;
+  map<ClusterId, string> errors_;
+  set<ClusterId> failed_queries_;
+  string settings_;  // the options that everything in here was calculated with (see Glomerator::WarmCacheSettings()), so we know when a job can't use it
+};
+
+// ----------------------------------------------------------------------------------------
+// Lends a GlomCache's contents to a Glomerator: Start() swaps them with the Glomerator's (using <swap_fcn>), and we swap them back when we're destroyed.
+// Since we're a member of the Glomerator, that happens even if its constructor throws, so the GlomCache never loses anything.
+class GlomCacheLoan {
+public:
+  GlomCacheLoan() : cache_(nullptr) {}
+  ~GlomCacheLoan() { if(cache_) swap_fcn_(*cache_); }
+  void Start(GlomCache *cache, function<void(GlomCache&)> swap_fcn) { cache_ = cache; swap_fcn_ = swap_fcn; swap_fcn_(*cache_); }
+private:
+  GlomCache *cache_;
+  function<void(GlomCache&)> swap_fcn_;
 };
 
 // ----------------------------------------------------------------------------------------
 class Glomerator {
 public:
-  Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track);
+  Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track, GlomCache *warm_cache=nullptr);
   ~Glomerator();
   void Cluster();
   double LogProbOfPartition(Partition &clusters, bool debug=false);
@@ -76,7 +136,8 @@ public:
   void WriteAnnotations(ClusterPath &cp);
 private:
   void ReadCacheFile();
-  void WriteCacheLine(ofstream &ofs, string query);
+  string WarmCacheSettings();
+  void WriteCacheLine(ofstream &ofs, ClusterId query);
   void WriteCacheFile();
 
   void PrintPartition(Partition &clusters, string extrastr);
@@ -85,33 +146,37 @@ private:
   string GetStatusStr(time_t current_time);
   void WriteStatus();  // write some progress info to file
 
-  string ParentalString(pair<string, string> *parents);
-  int CountMembers(string namestr);
+  string ParentalString(pair<ClusterId, ClusterId> *parents);
+  int CountMembers(ClusterId queries) { return (int)cluster_index_.size(queries); }
   unsigned LargestClusterSize(Partition &partition);
   string ClusterSizeString(Partition *partition);
-  string JoinNames(string name1, string name2, string delimiter=":");
+  vector<ClusterId> SortByName(const set<ClusterId> &clusters);  // NOTE we use this wherever the order ends up in the output, so it's the same as when the clusters were keyed by their names
   string JoinNameStrings(vector<Sequence*> &strlist, string delimiter=":");
   string JoinSeqStrings(vector<Sequence*> &strlist, string delimiter=":");
-  string PrintStr(string queries);
-  bool SeedMissing(string queries);
-
-  double CalculateHfrac(string &seq_a, string &seq_b);
-  double NaiveHfrac(string key_a, string key_b);
-
-  string ChooseSubsetOfNames(string queries, int n_max);
-  string GetNaiveSeqNameToCalculate(string actual_queries);  // convert between the actual queries/key we're interested in and the one we're going to calculate
-  string GetLogProbNameToCalculate(string queries, int n_max);
-  pair<string, string> GetLogProbPairOfNamesToCalculate(string actual_queries, pair<string, string> actual_parents);  // convert between the actual queries/key we're interested in and the one we're going to calculate
-  bool FirstParentMuchBigger(string queries, string queries_other, int nmax);
-  string FindNaiveSeqNameReplace(pair<string, string> *parents);
-  string &GetNaiveSeq(string key, pair<string, string> *parents=nullptr);
+  string PrintStr(ClusterId queries);
+  bool HasSeed(ClusterId queries);
+  bool SeedMissing(ClusterId queries);
+
+  double CalculateHfrac(ClusterId key_a, ClusterId key_b);
+  PackedSeq &GetPackedNaiveSeq(ClusterId queries);
+  double NaiveHfrac(ClusterId key_a, ClusterId key_b);
+
+  ClusterId ChooseSubsetOfNames(ClusterId queries, int n_max);
+  ClusterId GetNaiveSeqNameToCalculate(ClusterId actual_queries);  // convert between the actual queries/key we're interested in and the one we're going to calculate
+  ClusterId GetLogProbNameToCalculate(ClusterId queries, int n_max);
+  pair<ClusterId, ClusterId> GetLogProbPairOfNamesToCalculate(ClusterId actual_queries, pair<ClusterId, ClusterId> actual_parents);  // convert between the actual queries/key we're interested in and the one we're going to calculate
+  bool FirstParentMuchBigger(ClusterId queries, ClusterId queries_other, int nmax);
+  ClusterId FindNaiveSeqNameReplace(pair<ClusterId, ClusterId> *parents);
+  string &GetNaiveSeq(ClusterId key, pair<ClusterId, ClusterId> *parents=nullptr);
   // double NormFactor(string name);
-  double GetLogProb(string queries);
-  double GetLogProbRatio(string key_a, string key_b);
-  string CalculateNaiveSeq(string key, RecoEvent *event=nullptr);
-  double CalculateLogProb(string queries);
+  double GetLogProb(ClusterId queries);
+  double GetLogProbRatio(ClusterId key_a, ClusterId key_b);
+  vector<ClusterId> GetLogProbNamesForRatio(ClusterId key_a, ClusterId key_b);  // the three log probs (after translation) that we need for the lratio of <key_a> and <key_b>
+  void CalculateLogProbsInParallel(vector<pair<ClusterId, ClusterId> > &candidates);
+  string CalculateNaiveSeq(ClusterId key, RecoEvent *event=nullptr);
+  double CalculateLogProb(ClusterId queries);
 
-  bool check_cache(string queries) {
+  bool check_cache(ClusterId queries) {
     if(cachefo_.find(queries) != cachefo_.end())
       return true;
     else if(tmp_cachefo_.find(queries) != tmp_cachefo_.end())
@@ -120,50 +185,62 @@ private:
       throw false;
   }
 
-  Query &cachefo(string queries);
+  Query &cachefo(ClusterId queries);
 
   bool SameLength(vector<Sequence*> &seqs, bool debug=false);
-  void AddFailedQuery(string queries, string error_str);
+  void AddFailedQuery(ClusterId queries, string error_str);
   void UpdateLogProbTranslationsForAsymetrics(Query &qmerge);
-  vector<Sequence*> GetSeqs(string query);
-  void MoveSubsetsFromTmpCache(string query);
-  void CopyToPermanentCache(string translated_query, string superquery);
-  Query &GetMergedQuery(string name_a, string name_b);
+  vector<Sequence*> GetSeqs(ClusterId query);
+  void MoveSubsetsFromTmpCache(ClusterId query);
+  void CopyToPermanentCache(ClusterId translated_query, ClusterId superquery);
+  Query &GetMergedQuery(ClusterId name_a, ClusterId name_b);
 
   bool LikelihoodRatioTooSmall(double lratio, int candidate_cluster_size);
   Partition GetSeededClusters(Partition &partition);
-  pair<double, Query> FindHfracMerge(ClusterPath *path);
-  pair<double, Query> FindLRatioMerge(ClusterPath *path);
+  void AddCandidate(ClusterId key_a, ClusterId key_b);
+  void InsertCandidate(set<CandidateMerge, CandidateOrder> &candidates, CandidateMerge cmerge);
+  void RemoveCandidate(set<CandidateMerge, CandidateOrder> &candidates, CandidateMerge cmerge);
+  void RemoveCandidates(ClusterId queries);
+  void UpdateCandidates(ClusterPath *path);
+  void InitializeNaiveSeqTree(set<ClusterId> &bucket);
+  void AddNaiveSeqNeighborCandidates(ClusterId queries);
+  pair<double, Query> FindHfracMerge();
+  pair<double, Query> FindLRatioMerge();
   pair<double, Query> *ChooseRandomMerge(vector<pair<double, Query> > &potential_merges);
 
   Track *track_;
   Args *args_;
   GermLines &gl_;
   HMMHolder &hmms_;
+  GlomCache *warm_cache_;  // if set, we start from (and, when we're done, put everything back in) this
   ofstream ofs_;
 
+  ClusterIndex cluster_index_;  // all the maps and sets below are keyed by ids from this (except the single seq ones, which use its uid indices)
   Partition initial_partition_;
 
-  map<string, string> naive_seq_name_translations_;
-  map<string, pair<string, string> > logprob_name_translations_;
-  map<string, string> logprob_asymetric_translations_;
-  map<string, string> name_subsets_;
+  map<ClusterId, ClusterId> naive_seq_name_translations_;
+  map<ClusterId, pair<ClusterId, ClusterId> > logprob_name_translations_;
+  map<ClusterId, ClusterId> logprob_asymetric_translations_;
+  map<ClusterId, ClusterId> name_subsets_;
 
-  map<string, Sequence> single_seqs_;  // only place that we keep the actual sequences (rather than pointers/references)
-  map<string, Query> single_seq_cachefo_;  // keep some (approximate) single-sequence info to help us build missing cache entries
-  map<string, Query> cachefo_;  // cache info for clusters we've actually merged
-  map<string, Query> tmp_cachefo_;  // cache info for clusters we're only considering merging
+  map<unsigned, Sequence> single_seqs_;  // only place that we keep the actual sequences (rather than pointers/references)
+  map<unsigned, Query> single_seq_cachefo_;  // keep some (approximate) single-sequence info to help us build missing cache entries
+  map<ClusterId, Query> cachefo_;  // cache info for clusters we've actually merged
+  map<ClusterId, Query> tmp_cachefo_;  // cache info for clusters we're only considering merging
 
   // These all include cached info from previous runs
-  map<string, double> log_probs_;  
-  map<string, double> naive_hfracs_;  // NOTE since this uses the joint key, it assumes there's only *one* way to get to a given cluster (this is similar to, but not quite the same as, the situation for log probs and naive seqs)
-  map<string, double> lratios_;
-  map<string, string> naive_seqs_;
-  map<string, string> errors_;
+  map<ClusterId, double> log_probs_;
+  map<ClusterId, double> naive_hfracs_;  // NOTE since this uses the joint key, it assumes there's only *one* way to get to a given cluster (this is similar to, but not quite the same as, the situation for log probs and naive seqs)
+  map<ClusterId, double> lratios_;
+  map<ClusterId, string> naive_seqs_;
+  map<ClusterId, double> fused_log_probs_;  // log probs that we got for free while calculating naive seqs, which we move to <log_probs_> if and when somebody asks for them (see CalculateNaiveSeq())
+  map<ClusterId, PackedSeq> packed_naive_seqs_;  // packed versions of <naive_seqs_>, for calculating hfracs (only for the ones we've needed so far)
+  map<ClusterId, string> errors_;
 
-  set<string> failed_queries_;
+  set<ClusterId> failed_queries_;
 
-  set<string> initial_log_probs_, initial_naive_hfracs_, initial_naive_seqs_;  // keep track of the ones we read from the initial cache file so we can write only the new ones to the output cache file
+  set<ClusterId> initial_log_probs_, initial_naive_hfracs_, initial_naive_seqs_;  // keep track of the ones we read from the initial cache file so we can write only the new ones to the output cache file
+  GlomCacheLoan warm_cache_loan_;  // NOTE has to come after everything that it swaps with <warm_cache_>, so it's destroyed (and swaps them back) before they are
 
   int n_fwd_calculated_, n_vtb_calculated_, n_hfrac_calculated_, n_hfrac_merges_, n_lratio_merges_;
 
@@ -171,6 +248,16 @@ private:
 
   bool force_merge_;  // this gets set to true if args_->n_final_clusters() is set, and we've got to keep going past the most likely partition in order to get down to the requested number of clusters
 
+  // candidate merges, which we update incrementally after each merge (rather than looping over all pairs in the partition each time)
+  bool candidates_initialized_;
+  ClusterId newest_cluster_;  // cluster from the last merge, whose candidates we haven't yet added (NO_CLUSTER if there isn't one)
+  set<CandidateMerge, CandidateOrder> hfrac_candidates_;  // pairs with naive hfrac below --hamming-fraction-bound-lo
+  set<CandidateMerge, CandidateOrder> unevaluated_candidates_;  // pairs that pass the cheap filters, but for which we haven't yet calculated the lratio
+  set<CandidateMerge, CandidateOrder> lratio_candidates_;
+  map<ClusterId, set<CandidateMerge> > candidates_by_cluster_;  // all the candidates involving each cluster, so we can remove them when it gets merged
+  map<size_t, set<ClusterId> > clusters_by_cdr3_length_;  // current partition's clusters, bucketed by cdr3 length (only clusters in the same bucket can be merged)
+  map<size_t, BKTree> naive_seq_trees_;  // naive seqs of the current partition's clusters, by cdr3 length (only used if --hamming-fraction-bound-hi is set)
+
   Partition *current_partition_;  // (a.t.m. only used for writing to status file)
   time_t last_status_write_time_;  // last time that we wrote our progress to a file
   FILE *progress_file_;
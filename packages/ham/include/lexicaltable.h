@@ -15,8 +15,6 @@ class LexicalTable {
 public:
   LexicalTable();
   void Init(Track *track);
-  void ReplaceLogProbs(vector<double> new_log_probs);  // replace values in <log_probs_> with thsoe in <new_log_probs>
-  void UnReplaceLogProbs();  // revert to the original log probs
   ~LexicalTable();
 
   void SetLogProbs(vector<double> logprobs) { log_probs_ = logprobs; }
@@ -29,7 +27,6 @@ public:
 private:
   Track *track_;
   vector<double> log_probs_;
-  vector<double> original_log_probs_;  // i.e. before we rescaled the mute freq
 };
 
 }
@@ -222,6 +222,8 @@ void addVector(vector<T>& lhs, vector<T>& rhs) {
 
 // ----------------------------------------------------------------------------------------
 double AddWithMinusInfinities(double first, double second);
+void ExpInPlace(double *vals, size_t n);
+double LogSumExp(const double *vals, size_t n);
 
 }
 
@@ -8,16 +8,51 @@
 using namespace std;
 namespace ham {
 
+// ----------------------------------------------------------------------------------------
+// flat table of the emission log probs (and probs) for each state and symbol column (see Model::symbol_column()), which is what the trellis reads.
+// The model has one with the emissions from its file, and Model::RescaledEmissions() makes others for different mute freqs, so the model itself never changes once it's read.
+class EmissionTable {
+public:
+  EmissionTable() : n_symbols_(0) {}
+  EmissionTable(size_t n_states, size_t n_symbols) : n_symbols_(n_symbols), log_probs_(n_states * n_symbols, -INFINITY) {}
+  inline double logprob(size_t ist, size_t icol) { return log_probs_[ist*n_symbols_ + icol]; }
+  inline double prob(size_t ist, size_t icol) { return probs_[ist*n_symbols_ + icol]; }
+  double ApproxBytesUsed() { return sizeof(double) * (log_probs_.size() + probs_.size()); }
+
+  size_t n_symbols_;
+  vector<double> log_probs_;  // n_states x n_symbols_
+  vector<double> probs_;  // same, but not in log space (for Trellis::ScaledForward())
+};
+
+// ----------------------------------------------------------------------------------------
+// everything in an hmm file, i.e. what we need to make the Model (either from yaml, or from a ModelBundle)
+class ModelSpec {
+public:
+  ModelSpec() : gene_prob_(0.), overall_mute_freq_(0.) {}
+  string name_;
+  double gene_prob_, overall_mute_freq_;  // zero if they aren't specified
+  string ambiguous_char_;
+  string track_name_;
+  vector<string> symbols_;
+  vector<StateSpec> states_;  // in the order they're in the file (including init)
+};
+
+// ----------------------------------------------------------------------------------------
 class Model {
 public:
   Model();
   ~Model();
-  void Parse(string);
+  void Parse(string infname);  // read yaml file <infname>
+  static ModelSpec ReadSpec(string infname);  // read yaml file <infname> without making the model
+  void Init(ModelSpec &spec);
   void AddState(State*);
-  void RescaleOverallMuteFreq(double overall_mute_freq);  // Rescale emissions to reflect <overall_mute_freq>, unless <overall_mute_freq> is -INFINITY, in which case we *re*-rescale them to what they were originally
-  void UnRescaleOverallMuteFreq();  // Undo the above
+  EmissionTable RescaledEmissions(double overall_mute_freq);  // emissions rescaled to reflect <overall_mute_freq> instead of the mute freq which was recorded in the hmm file
   void Finalize();
   void AddMaybeFasterFromStateStuff();
+  void Compile();  // fill the flat arrays below from the State/Transition objects
+  void CompileEmissions(EmissionTable &emissions, double factor = -INFINITY);  // fill <emissions> from the states, with mutation probs rescaled by <factor> (unless it's -INFINITY)
+  void DetectChainTopology();
+  void InitReversed(Model *forward);  // make this the reversed version of <forward> (see reversed())
 
   string &name() { return name_; }
   Track *track() { return track_; }
@@ -28,18 +63,64 @@ public:
   State *init_state() { return initial_; }
   double overall_prob() { return overall_prob_; }
   double original_overall_mute_freq() { return original_overall_mute_freq_; }
+  // Version of this model with all the transitions reversed and with init and end swapped, so a trellis on it reads its sequence back to front,
+  // and its values for length <l> correspond to the <l>-base suffix. Shares our states (so the same emission tables work for both).
+  // NOTE the reversed model's reversed() is the original one
+  Model *reversed() { return reversed_; }
+  bool is_reversed() { return is_reversed_; }
+
+  // compiled (flat array) versions of the transition and emission info, for use in the trellis inner loops
+  inline size_t n_symbols() { return n_symbols_; }  // alphabet size plus one (the last column is for the ambiguous character)
+  inline size_t symbol_column(uint8_t ch) { return ch == track_->ambiguous_index() ? n_symbols_ - 1 : ch; }  // column in an EmissionTable corresponding to digitized symbol <ch>
+  inline size_t from_begin(size_t ist) { return from_offsets_[ist]; }  // predecessors of state <ist> are from_index(j) for j in [from_begin(ist), from_end(ist))
+  inline size_t from_end(size_t ist) { return from_offsets_[ist + 1]; }
+  inline uint16_t from_index(size_t j) { return from_indices_[j]; }
+  inline size_t max_from_states() { return max_from_states_; }  // largest number of from-states for any state
+  inline size_t to_begin(size_t ist) { return to_offsets_[ist]; }  // same as the from-state arrays, but for the states to which <ist> can transition
+  inline size_t to_end(size_t ist) { return to_offsets_[ist + 1]; }
+  inline uint16_t to_index(size_t j) { return to_indices_[j]; }
+  inline vector<uint16_t> *initial_to_state_indices() { return &initial_to_indices_; }  // sorted
+  inline double from_logprob(size_t j) { return from_logprobs_[j]; }  // log prob of the transition from from_index(j) into the state to which <j> belongs
+  inline EmissionTable *emissions() { return &emissions_; }  // emissions from the hmm file
+  inline double end_logprob(size_t ist) { return end_logprobs_[ist]; }  // -INFINITY if no transition to end
+  inline double init_logprob(size_t ist) { return init_logprobs_[ist]; }  // -INFINITY if no transition from init
+  // and the same things, but not in log space (for Trellis::ScaledForward())
+  inline double from_prob(size_t j) { return from_probs_[j]; }
+  inline double end_prob(size_t ist) { return end_probs_[ist]; }
+  inline double init_prob(size_t ist) { return init_probs_[ist]; }
+
+  // If the model consists of a block of (self-transitioning) left insert states, a linear chain of states, and a block of right insert states
+  // -- which is what partis's hmmwriter makes, with erosions as transitions into and out of the middle of the chain -- then DetectChainTopology()
+  // fills in the following, and the trellis uses ChainTrellis instead of the generic algorithms.
+  inline bool chain_topology() { return chain_topology_; }
+  inline vector<uint16_t> *left_inserts() { return &left_inserts_; }  // state indices
+  inline vector<uint16_t> *chain() { return &chain_; }  // state indices, in chain order
+  inline vector<uint16_t> *right_inserts() { return &right_inserts_; }
+  inline int chain_entry_index(size_t ic) { return chain_entry_indices_[ic]; }  // index in the list of chain entry points of chain position <ic> (-1 if you can't enter the chain there)
+  inline int chain_exit_index(size_t ic) { return chain_exit_indices_[ic]; }  // same, for exits
+  inline size_t n_chain_entries() { return n_chain_entries_; }
+  inline size_t n_chain_exits() { return n_chain_exits_; }
+  inline double chain_cumulative_logprob(size_t ic) { return chain_cumulative_logprobs_[ic]; }  // sum of the log probs of the chain transitions from chain position 0 to <ic>
+  inline double left_to_left_logprob(size_t il_from, size_t il_to) { return left_to_left_[il_from*left_inserts_.size() + il_to]; }
+  inline double left_to_chain_logprob(size_t il, size_t ic) { return left_to_chain_[il*chain_.size() + ic]; }
+  inline double chain_to_right_logprob(size_t ic, size_t ir) { return chain_to_right_[ic*right_inserts_.size() + ir]; }
+  inline double right_to_right_logprob(size_t ir_from, size_t ir_to) { return right_to_right_[ir_from*right_inserts_.size() + ir_to]; }
+  inline double left_to_left_prob(size_t il_from, size_t il_to) { return left_to_left_probs_[il_from*left_inserts_.size() + il_to]; }  // linear-space versions of the previous four
+  inline double left_to_chain_prob(size_t il, size_t ic) { return left_to_chain_probs_[il*chain_.size() + ic]; }
+  inline double chain_to_right_prob(size_t ic, size_t ir) { return chain_to_right_probs_[ic*right_inserts_.size() + ir]; }
+  inline double right_to_right_prob(size_t ir_from, size_t ir_to) { return right_to_right_probs_[ir_from*right_inserts_.size() + ir_to]; }
 
 private:
   void FinalizeState(State *st);
   void CheckTopology();
   void AddToStateIndices(State* st, vector<uint16_t>& visited); // that's 'to-state', as in, 'here we push back the to-state indices onto <visited>'
+  double TransitionLogprob(size_t ist_from, size_t ist_to);  // -INFINITY if there isn't one (only for setting things up -- it's slow)
 
   string name_;
   double overall_prob_;  // overall probability of this hmm/gene (not the same 'overall' as <overall_mute_freq_>)
   double original_overall_mute_freq_;  // mean mutation frequency, over v, d and j (not insertions), for the sequences in the data set
                                        // from which this hmm was derived. Reiterating: mean over all genes and all regions, *not* just this gene.
-                                       // Note, this is the *original* one, i.e. we don't reset it when we reset the mute freqs
-  double rescale_ratio_;  // ratio by which we have rescaled the emission probabilities (-INFINITY if we haven't rescaled them, i.e. if they correspond to <original_overall_mute_freq_>)
+                                       // Note, this is the *original* one, i.e. RescaledEmissions() doesn't change it
   string ambiguous_char_;
   Track *track_;
   vector<State*> states_; //!  All the states contained in the model
@@ -47,6 +128,29 @@ private:
   State *initial_;
   State *ending_;
   bool finalized_;
+  bool is_reversed_;  // if set, we don't own <states_> or <track_>
+  Model *reversed_;
+
+  size_t n_symbols_;
+  size_t max_from_states_;
+  vector<size_t> from_offsets_;  // CSR layout of the from-states: length n_states + 1
+  vector<uint16_t> from_indices_;
+  vector<double> from_logprobs_;
+  vector<size_t> to_offsets_;
+  vector<uint16_t> to_indices_;
+  vector<uint16_t> initial_to_indices_;
+  EmissionTable emissions_;
+  vector<double> end_logprobs_;
+  vector<double> init_logprobs_;
+  vector<double> from_probs_, end_probs_, init_probs_;
+
+  bool chain_topology_;
+  vector<uint16_t> left_inserts_, chain_, right_inserts_;
+  vector<int> chain_entry_indices_, chain_exit_indices_;
+  size_t n_chain_entries_, n_chain_exits_;
+  vector<double> chain_cumulative_logprobs_;
+  vector<double> left_to_left_, left_to_chain_, chain_to_right_, right_to_right_;  // dense transition log prob tables
+  vector<double> left_to_left_probs_, left_to_chain_probs_, chain_to_right_probs_, right_to_right_probs_;
 };
 
 }
@@ -0,0 +1,47 @@
+#ifndef HAM_MODELBUNDLE_H
+#define HAM_MODELBUNDLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "model.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// A whole directory of hmm files compiled into one binary file (made with the hmmbundle program), so we don't have to parse any yaml.
+// We mmap it read-only, so all the processes that are reading the same bundle share its pages, and we only decode each model's ModelSpec
+// when somebody asks for it. Layout (everything in native byte order):
+//   header: magic, byte order check, version, number of models
+//   index: for each model, its key (the hmm file's name without .yaml), and the offset and size of its record
+//   records: the ModelSpec for each model
+class ModelBundle {
+public:
+  ModelBundle(string fname);  // mmap <fname>
+  ~ModelBundle();
+  static void Write(string fname, map<string, ModelSpec> &specs);  // write a bundle with a model for each entry in <specs> (keyed as described above)
+
+  bool Has(string key) { return index_.count(key) > 0; }
+  ModelSpec GetSpec(string key);
+  vector<string> keys();
+  string fname() { return fname_; }
+
+private:
+  void ReadIndex();  // check the header, and fill <index_>
+  string fname_;
+  char *data_;
+  size_t size_;
+  map<string, pair<size_t, size_t> > index_;  // offset and size of each model's record
+};
+
+}
+#endif
@@ -42,7 +42,7 @@ private:
 // ----------------------------------------------------------------------------------------
 class Sequences {
 public:
-  Sequences() : sequence_length_(0) {}
+  Sequences() : sequence_length_(0), n_profile_symbols_(0) {}
   // Sequences(const Sequences &rhs);
   Sequences(Sequences &rhs, size_t pos, size_t len);  // copy <seqs> from <pos> to <pos> + <len>
   // Sequences(vector<Sequence> &seqs);
@@ -55,6 +55,8 @@ public:
   size_t n_seqs() const { return seqs_.size(); }
   size_t GetSequenceLength() { return sequence_length_;}
   Sequences Union(Sequences &otherseqs);  // return union set of self and <otherseqs>
+  size_t n_profile_symbols() { return n_profile_symbols_; }  // alphabet size plus one (the last column is the ambiguous character)
+  inline unsigned profile_count(size_t pos, size_t isym) { return profile_[pos*n_profile_symbols_ + isym]; }  // number of sequences with symbol <isym> at position <pos>
   // Sequences GetSubSequences(size_t pos, size_t len);
 
   void Print();
@@ -77,6 +79,27 @@ public:
 private:
   vector<Sequence> seqs_;
   size_t sequence_length_; // length of the sequences (required to be the same for all)
+  size_t n_profile_symbols_;
+  vector<unsigned> profile_;  // count of each symbol at each position, summed over sequences (indexed as [pos*n_profile_symbols_ + isym])
+};
+
+// ----------------------------------------------------------------------------------------
+// A sequence from a four-symbol alphabet packed into two bits per position (32 positions per 64-bit word), with a separate mask for ambiguous positions,
+// so we can get the hamming distance between two of them with a few xors and popcounts per word, rather than comparing one position at a time.
+// NOTE in the mask we only set the low bit of each position's pair of bits, which is also what HammingDistance() needs to get one bit per position
+class PackedSeq {
+public:
+  PackedSeq() : size_(0), n_ambiguous_(0) {}
+  PackedSeq(Track *trk, const string &undigitized);
+  size_t size() const { return size_; }
+  unsigned n_ambiguous() const { return n_ambiguous_; }
+  void HammingDistance(const PackedSeq &rhs, unsigned &distance, unsigned &len_excluding_ambigs) const;  // NOTE positions that are ambiguous in either sequence are skipped
+  unsigned FullHammingDistance(const PackedSeq &rhs) const;  // treats the ambiguous character as just another symbol, so (unlike HammingDistance()) it's a metric. It's at most HammingDistance() plus the two n_ambiguous()s
+private:
+  size_t size_;
+  unsigned n_ambiguous_;
+  vector<uint64_t> bits_;
+  vector<uint64_t> ambig_mask_;  // also set for the unused positions at the end of the last word
 };
 
 }
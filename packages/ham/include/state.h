@@ -17,12 +17,24 @@ using namespace std;
 namespace ham {
 class Transition;
 
+// ----------------------------------------------------------------------------------------
+// everything the hmm file says about one state, i.e. what we need to make the State (either from yaml, or from a ModelBundle)
+class StateSpec {
+public:
+  StateSpec() : ambiguous_emission_prob_(0.) {}
+  string name_, germline_nuc_, ambiguous_char_;
+  double ambiguous_emission_prob_;  // zero if it isn't specified
+  vector<pair<string, double> > transitions_;  // to-state name and prob (including "end"), in the order they're in the file
+  vector<double> emission_probs_;  // in the order of the track's symbols (empty for init)
+};
+
+// ----------------------------------------------------------------------------------------
 class State {
 public:
   State();
-  void Parse(YAML::Node node, vector<string> state_names, Track *track);
-  void RescaleOverallMuteFreq(double factor);  // Rescale emissions by the ratio <factor>
-  void UnRescaleOverallMuteFreq();  // undo the above
+  static StateSpec ReadSpec(YAML::Node node, Track *track);
+  void Init(StateSpec &spec, vector<string> &state_names, Track *track);
+  vector<double> RescaledEmissionLogprobs(double factor);  // emission log probs with the mutation probs rescaled by the ratio <factor>
   ~State();
 
   inline string name() { return name_; }
@@ -34,6 +46,8 @@ public:
   inline vector<size_t> *from_state_indices() { return &from_state_indices_; }
   inline Transition *transition(size_t iter) { return (*transitions_)[iter]; }
   inline Transition *trans_to_end() { return trans_to_end_; }
+  inline string ambiguous_char() { return ambiguous_char_; }
+  inline vector<double> emission_log_probs() { return emission_.log_probs(); }  // NOTE returns a *copy*
 
   double EmissionLogprob(uint8_t ch);
   double EmissionLogprob(Sequences *seqs, size_t pos);
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 
 #include "text.h"
 #include "model.h"
@@ -18,6 +19,7 @@ public:
   TracebackPath() : hmm_(nullptr) {}
   void push_back(int state) { path_.push_back(state); }
   void clear() { path_.clear(); }
+  void reverse() { std::reverse(path_.begin(), path_.end()); }
 
   inline size_t size() const { return path_.size(); }
   inline void abbreviate(bool abb = true) { abbreviate_ = abb; }
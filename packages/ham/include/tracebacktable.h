@@ -0,0 +1,42 @@
+#ifndef HAM_TRACEBACKTABLE_H
+#define HAM_TRACEBACKTABLE_H
+
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Viterbi traceback pointers for each (position, state), bit-packed into one contiguous buffer.
+// Instead of the index of the previous state, we store one plus its index in the current state's list of from-states (zero means no pointer),
+// so each entry only needs enough bits for the largest number of from-states (rounded up to a power of two so entries don't straddle words).
+class TracebackTable {
+public:
+  TracebackTable() : n_states_(0), bits_(0), entries_per_word_(0), mask_(0) {}
+  void Init(size_t n_positions, size_t n_states, size_t max_from_states);  // resize for the given dimensions and clear all the pointers (reuses the existing buffer)
+  inline void set(size_t position, size_t ist, size_t ifrom) {  // set pointer to the <ifrom>th from-state of <ist>
+    size_t ientry(position*n_states_ + ist);
+    uint64_t &word(words_[ientry / entries_per_word_]);
+    size_t shift((ientry % entries_per_word_) * bits_);
+    word = (word & ~(mask_ << shift)) | ((uint64_t)(ifrom + 1) << shift);
+  }
+  inline int get(size_t position, size_t ist) const {  // index in <ist>'s from-states, or -1 if there's no pointer
+    size_t ientry(position*n_states_ + ist);
+    size_t shift((ientry % entries_per_word_) * bits_);
+    return (int)((words_[ientry / entries_per_word_] >> shift) & mask_) - 1;
+  }
+  double ApproxBytesUsed() const { return sizeof(uint64_t) * words_.size(); }
+
+private:
+  size_t n_states_;
+  size_t bits_;  // bits per entry
+  size_t entries_per_word_;
+  uint64_t mask_;
+  vector<uint64_t> words_;
+};
+
+}
+#endif
@@ -8,22 +8,24 @@
 #include "sequences.h"
 #include "model.h"
 #include "tracebackpath.h"
+#include "tracebacktable.h"
+#include "chaintrellis.h"
 
 using namespace std;
 namespace ham {
 
-typedef vector<vector<int16_t> > int_2D;
-
 // ----------------------------------------------------------------------------------------
 class Trellis {
 public:
-  Trellis(Model *hmm, Sequence seq, Trellis *cached_trellis = nullptr);
-  Trellis(Model *hmm, Sequences seqs, Trellis *cached_trellis = nullptr);
+  // if <emissions> isn't set we use the cached trellis's, or else the model's own (i.e. not rescaled)
+  Trellis(Model *hmm, Sequence seq, Trellis *cached_trellis = nullptr, EmissionTable *emissions = nullptr);
+  Trellis(Model *hmm, Sequences seqs, Trellis *cached_trellis = nullptr, EmissionTable *emissions = nullptr);
   void Init();
   Trellis();
   ~Trellis();
 
   Model *model() { return hmm_; }
+  EmissionTable *emissions() { return emissions_; }
   Sequences seqs() { return seqs_; }
   double ending_viterbi_log_prob() { return ending_viterbi_log_prob_; }  // for full sequence length
   double ending_forward_log_prob() { return ending_forward_log_prob_; }  // for full sequence length
@@ -33,30 +35,57 @@ public:
   double ending_viterbi_log_prob(size_t length) { return viterbi_log_probs_pointer_->at(length - 1); } // the most probable path of length <length> NOTE do *not* use <viterbi_log_probs_>
   double ending_forward_log_prob(size_t length) { return forward_log_probs_pointer_->at(length - 1); } // NOTE do *not* use <forward_log_probs_>
   size_t viterbi_pointer(size_t length) { return viterbi_indices_pointer_->at(length - 1); } // i.e. the zeroth entry of viterbi_indices_ corresponds to stopping with sequence of length 1 NOTE do *not* use <viterbi_indices_>  
+  // if we pruned, the viterbi log prob for <length> is only right if it's at least this (otherwise all we know is that the real one is smaller than this) NOTE not set for trellises that poach from a cached trellis
+  double viterbi_min_log_prob(size_t length) { return viterbi_min_log_probs_.size() == 0 ? -INFINITY : viterbi_min_log_probs_.at(length - 1); }
+  bool viterbi_pruned() { return viterbi_min_log_probs_.size() > 0; }
+  // if we pruned forward, log of an upper bound on how much we're missing from the forward prob for <length> (-INFINITY if we didn't drop anything)
+  double forward_error_log_prob(size_t length) { return n_forward_pruned_ == 0 ? -INFINITY : log(n_forward_pruned_) + forward_min_log_probs_.at(length - 1); }
+  double BestCaseLogProb(size_t length);  // upper bound on the log prob of any path of length <length>
 
-  int_2D *traceback_table_pointer() const { return traceback_table_pointer_; }
+  TracebackTable *traceback_table_pointer() const { return traceback_table_pointer_; }
   vector<double> *viterbi_log_probs_pointer() { return viterbi_log_probs_pointer_; }
   vector<double> *forward_log_probs_pointer() { return forward_log_probs_pointer_; }
   vector<int> *viterbi_indices_pointer() { return viterbi_indices_pointer_; }
+  ChainTrellis *chain_trellis_pointer() { return chain_trellis_pointer_; }
+  void set_use_chain_trellis(bool use_chain_trellis) { use_chain_trellis_ = use_chain_trellis && hmm_->chain_topology(); }  // e.g. to turn off ChainTrellis for comparisons
 
-  void SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states);
-  void MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
-  void MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
+  void InitFrontier(vector<double> *scoring_current, vector<double> *scoring_previous, double empty_val);  // <empty_val> is the value for unreachable states (-INFINITY, or zero for ScaledForward())
+  void SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, double empty_val);
+  inline void AddToNextStates(size_t ist) {  // mark the states to which <ist> can transition as needing to be checked at the next position
+    for(size_t ito = hmm_->to_begin(ist); ito < hmm_->to_end(ist); ++ito)
+      next_mask_[hmm_->to_index(ito) / 64] |= (uint64_t)1 << (hmm_->to_index(ito) % 64);
+  }
+  void MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, size_t position);
+  void MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, size_t position);
+  void MiddleViterbiAndForwardVals(vector<double> *vtb_previous, vector<double> *vtb_current, vector<double> *fwd_previous, vector<double> *fwd_current, size_t position);
   void CacheViterbiVals(size_t position, double dpval, size_t i_st_current);
-  void CacheForwardVals(size_t position, double dpval, size_t i_st_current);
-  void Viterbi();
-  void Forward();
+  void CacheForwardVals(size_t position, size_t n_end_vals);
+  void Viterbi(vector<double> *min_log_probs = nullptr);  // if <min_log_probs> is set, we only care about paths of each length whose log prob is at least (*min_log_probs)[length - 1], so drop any partial paths that can't get there (only for ChainTrellis)
+  void Forward(vector<double> *min_log_probs = nullptr);  // if <min_log_probs> is set, drop partial sums that can't add more than exp((*min_log_probs)[length - 1]) to any length (only for ChainTrellis)
+  void ScaledForward();  // forward in probability space with per-column scaling (same output as Forward())
+  void ViterbiAndForward();  // both at once, in one pass over the sequence (same output as Viterbi() and Forward())
   void Traceback(TracebackPath &path);
 
   string SizeString();
   double ApproxBytesUsed();
 
   void Dump();
+  double EmissionLogprob(size_t i_st, size_t position);  // log prob of emitting all the sequences at <position> from state <i_st>
 private:
+  void SetProfileColumns();
+  void SetBestCaseLogProbs();
+  bool SetPruneThresholds(vector<double> &min_log_probs);
+  void GenericTraceback(TracebackPath &path);
+
   Model *hmm_;
+  EmissionTable *emissions_;  // NOTE not ours
   Sequences seqs_;
-  int_2D *traceback_table_pointer_;  // if we have a cached trellis, this points to the cached trellis's table
-  int_2D traceback_table_;  // if we have a cached trellis, this isn't initialized
+  TracebackTable *traceback_table_pointer_;  // if we have a cached trellis, this points to the cached trellis's table
+  TracebackTable traceback_table_;  // if we have a cached trellis, this isn't initialized
+
+  bool use_chain_trellis_;  // use closed-form ChainTrellis instead of the generic algorithms (if the model has the right topology)
+  ChainTrellis chain_trellis_;
+  ChainTrellis *chain_trellis_pointer_;  // set if our viterbi values came from a ChainTrellis (which is the cached trellis's, if we have a cached trellis)
 
   Trellis *cached_trellis_;  // pointer to another trellis that already has its dp table(s) filled in, the idea being this trellis only needs a subset of that table, so we don't need to calculate anything new for this one
 
@@ -72,8 +101,33 @@ private:
   vector<double> forward_log_probs_;  // total log prob of all paths up to and including each position NOTE includes log prob of transition to end
   vector<int> viterbi_indices_;  // pointer to the state at which the best log prob occurred
 
+  // nonzero entries of <seqs_>'s symbol count profile: position <pos> uses entries [profile_offsets_[pos], profile_offsets_[pos+1])
+  vector<size_t> profile_offsets_;
+  vector<uint8_t> profile_columns_;  // emission table column
+  vector<double> profile_counts_;  // number of sequences with that symbol (as a double, since we only ever multiply by it)
+
+  // viterbi pruning stuff (see SetPruneThresholds())
+  vector<double> best_case_log_probs_;  // for each length (starting from zero), the sum of the best emission log prob at each position
+  vector<double> viterbi_min_log_probs_;  // copy of the <min_log_probs> we were pruned with (empty if we didn't prune)
+  vector<double> forward_min_log_probs_;  // same, for forward
+  size_t n_forward_pruned_;  // number of partial sums we dropped (each of which adds less than exp(forward_min_log_probs_[length - 1]) for each length)
+  vector<double> prune_thresholds_;  // minimum log prob for partial paths at each position
+
+  // scratch space for the forward column update (see MiddleForwardVals())
+  vector<double> edge_vals_;
+  vector<uint16_t> live_states_;
+  vector<size_t> live_edge_begins_;
+  vector<double> live_offsets_;  // max edge value plus emission for each live state
+  vector<double> end_vals_;
+
+  // sparse frontier: sorted lists of the states we need to check at the current and previous positions (which are also the only entries in
+  // the corresponding scoring columns that we ever set), and a bit mask of the ones we'll need at the next position
+  vector<uint16_t> current_states_, previous_states_;
+  vector<uint64_t> next_mask_;
+
   vector<double> *swap_ptr_;
   vector<double> scoring_current_, scoring_previous_;
+  vector<double> forward_scoring_current_, forward_scoring_previous_;  // forward columns for ViterbiAndForward() (which uses the other two for viterbi)
 };
 
 }
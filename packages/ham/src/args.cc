@@ -3,26 +3,32 @@
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Args::Args(int argc, const char * argv[]):
+Args::Args(int argc, const char * argv[], bool exit_on_parse_error):
   algo_strings_ {"viterbi", "forward"},
   debug_ints_ {0, 1, 2},
   algo_vals_(algo_strings_),
   debug_vals_(debug_ints_),
   hmmdir_arg_("", "hmmdir", "directory in which to look for hmm model files", true, "", "string"),
+  hmm_bundle_arg_("", "hmm-bundle", "if set, read hmms from this bundle file (made from --hmmdir with hmmbundle) instead of from the yaml files", false, "", "string"),
   datadir_arg_("", "datadir", "directory in which to look for non-sample-specific data (eg human germline seqs)", true, "", "string"),
-  infile_arg_("", "infile", "input (whitespace-separated) file", true, "", "string"),
-  outfile_arg_("", "outfile", "output csv file", true, "", "string"),
+  infile_arg_("", "infile", "input (whitespace-separated) file (required unless --worker)", false, "", "string"),
+  outfile_arg_("", "outfile", "output csv file (required unless --worker)", false, "", "string"),
   annotationfile_arg_("", "annotationfile", "if specified, write annotations for each cluster to here", false, "", "string"),
   input_cachefname_arg_("", "input-cachefname", "input cached log prob/naive seq csv file", false, "", "string"),
   output_cachefname_arg_("", "output-cachefname", "output cached log prob/naive seq csv file", false, "", "string"),
   locus_arg_("", "locus", "ig{h,k,l} or tr{a,b,g,d}", true, "", "string"),
-  algorithm_arg_("", "algorithm", "algorithm to run", true, "", &algo_vals_),
+  algorithm_arg_("", "algorithm", "algorithm to run (required unless --worker)", false, "", &algo_vals_),
   ambig_base_arg_("", "ambig-base", "ambiguous base", false, "", "string"),
   seed_unique_id_arg_("", "seed-unique-id", "seed unique id", false, "", "string"),
+  socket_arg_("", "socket", "with --worker, take jobs from connections to a unix domain socket at this path (rather than from stdin)", false, "", "string"),
   hamming_fraction_bound_lo_arg_("", "hamming-fraction-bound-lo", "if hamming fraction for a pair is smaller than this, merge them without calculating lratio", false, 0.0, "float"),
   hamming_fraction_bound_hi_arg_("", "hamming-fraction-bound-hi", "if hamming fraction for a pair is larger than this, skip without calculating lratio", false, 1.0, "float"),
   logprob_ratio_threshold_arg_("", "logprob-ratio-threshold", "", false, -INFINITY, "float"),
   max_logprob_drop_arg_("", "max-logprob-drop", "stop glomerating when the total logprob has dropped by this much", false, -1.0, "float"),
+  mute_freq_bucket_width_arg_("", "mute-freq-bucket-width", "round each query's mute freq to the center of a bucket of this width before rescaling the emissions, so queries with similar mute freqs can share rescaled emission tables (if zero, only queries with exactly the same mute freq share them)", false, 0.0, "float"),
+  max_emission_cache_mb_arg_("", "max-emission-cache-mb", "if the cached rescaled emission tables take up more than this, clear them", false, 200., "float"),
+  gene_prune_margin_arg_("", "gene-prune-margin", "with --algorithm viterbi, don't finish calculating genes that can't get within this much (in log prob) of the best gene (if negative, calculate every gene). The best annotation is unchanged, but per-gene support only includes genes within this much of it", false, -1.0, "float"),
+  forward_tolerance_arg_("", "forward-tolerance", "with --algorithm forward (including the log probs for --partition), skip partial sums that can't change each region's total by more than roughly this fraction (if zero, calculate everything). The bound on each query's resulting error is only printed with --debug 1 (it doesn't go in any output file). Can't be used with --scaled-forward", false, 0.0, "float"),
   debug_arg_("", "debug", "debug level", false, 0, &debug_vals_),
   naive_hamming_cluster_arg_("", "naive-hamming-cluster", "cluster sequences using naive hamming distance", false, 0, "int"),
   biggest_naive_seq_cluster_to_calculate_arg_("", "biggest-naive-seq-cluster-to-calculate", "", false, 99999, "int"),
@@ -32,13 +38,18 @@ Args::Args(int argc, const char * argv[]):
   min_largest_cluster_size_arg_("", "min-largest-cluster-size", "instead of stopping at the most likely partition, stop when your largest cluster is this big", false, 0, "unsigned"),
   max_cluster_size_arg_("", "max-cluster-size", "if any cluster gets bigger than this, stop clustering", false, 0, "unsigned"),
   random_seed_arg_("", "random-seed", "", false, time(NULL), "unsigned"),
+  n_gene_threads_arg_("", "n-gene-threads", "number of threads with which to run the different genes' trellises within each query", false, 1, "unsigned"),
+  n_threads_arg_("", "n-threads", "number of threads with which to run the different queries (for annotation), or the log prob calculations for each step's candidate merges (with --partition)", false, 1, "unsigned"),
   no_chunk_cache_arg_("", "no-chunk-cache", "don't perform chunk caching?", false),
+  scaled_forward_arg_("", "scaled-forward", "run the forward algorithm in probability space with per-column scaling, rather than in log space (faster, but drops paths more than about e^-708 below the best)", false),
+  climb_kspace_arg_("", "climb-kspace", "with --algorithm viterbi, hill-climb over (k_v, k_d) from the middle of the k bounds (where sw's best kset is), rather than running every kset. If the best one we find is on the boundary we run them all anyway. Per-gene support only includes the ksets that we ran", false),
   partition_arg_("", "partition", "", false),
   dont_rescale_emissions_arg_("", "dont-rescale-emissions", "", false),
   cache_naive_seqs_arg_("", "cache-naive-seqs", "cache all naive sequences", false),
   cache_naive_hfracs_arg_("", "cache-naive-hfracs", "cache naive hamming fraction between sequence sets (in addition to log probs and naive seqs)", false),
   only_cache_new_vals_arg_("", "only-cache-new-vals", "only write sequence sets with newly-calculated values to cache file", false),
   write_logprob_for_each_partition_arg_("", "write-logprob-for-each-partition", "By default, we don't know the total logprob of each partition (since many merges are by naive hfrac). This argument tells us that this is the last time through (with one process) and we want to know the total probability of each partition.", false),
+  worker_arg_("", "worker", "instead of running once, read the hmms and germlines, then run a stream of jobs from stdin (or --socket), each of which is a line with the rest of a bcrham command line (see run_worker() in bcrham.cc)", false),
   str_headers_ {},
   int_headers_ {"k_v_min", "k_v_max", "k_d_min", "k_d_max", "cdr3_length"},
   float_headers_ {"mut_freq"},
@@ -48,7 +59,9 @@ Args::Args(int argc, const char * argv[]):
 {
   try {
     CmdLine cmd("bcrham -- the fantabulous HMM compiler goes to B-Cellville", ' ', "");
+    cmd.setExceptionHandling(exit_on_parse_error);
     cmd.add(hmmdir_arg_);
+    cmd.add(hmm_bundle_arg_);
     cmd.add(datadir_arg_);
     cmd.add(infile_arg_);
     cmd.add(outfile_arg_);
@@ -60,6 +73,10 @@ Args::Args(int argc, const char * argv[]):
     cmd.add(hamming_fraction_bound_hi_arg_);
     cmd.add(logprob_ratio_threshold_arg_);
     cmd.add(max_logprob_drop_arg_);
+    cmd.add(mute_freq_bucket_width_arg_);
+    cmd.add(max_emission_cache_mb_arg_);
+    cmd.add(gene_prune_margin_arg_);
+    cmd.add(forward_tolerance_arg_);
     cmd.add(algorithm_arg_);
     cmd.add(ambig_base_arg_);
     cmd.add(seed_unique_id_arg_);
@@ -72,13 +89,19 @@ Args::Args(int argc, const char * argv[]):
     cmd.add(min_largest_cluster_size_arg_);
     cmd.add(max_cluster_size_arg_);
     cmd.add(random_seed_arg_);
+    cmd.add(n_gene_threads_arg_);
+    cmd.add(n_threads_arg_);
     cmd.add(no_chunk_cache_arg_);
+    cmd.add(scaled_forward_arg_);
+    cmd.add(climb_kspace_arg_);
     cmd.add(cache_naive_seqs_arg_);
     cmd.add(cache_naive_hfracs_arg_);
     cmd.add(only_cache_new_vals_arg_);
     cmd.add(write_logprob_for_each_partition_arg_);
     cmd.add(partition_arg_);
     cmd.add(dont_rescale_emissions_arg_);
+    cmd.add(worker_arg_);
+    cmd.add(socket_arg_);
 
     cmd.parse(argc, argv);
 
@@ -98,6 +121,15 @@ Args::Args(int argc, const char * argv[]):
   if(find(loci.begin(), loci.end(), locus()) == loci.end())
     throw runtime_error("--locus argument '" + locus() + "' not among ig{h,k,l} or tr{a,b,g,d}");
 
+  if(socket() != "" && !worker())
+    throw runtime_error("--socket only makes sense with --worker");
+  if(forward_tolerance() > 0. && scaled_forward())  // the scaled forward doesn't know how to prune
+    throw runtime_error("--forward-tolerance can't be used with --scaled-forward");
+  if(worker())  // each job reads its own input file
+    return;
+  if(infile() == "" || outfile() == "" || algorithm() == "")
+    throw runtime_error("--infile, --outfile, and --algorithm are required (unless running with --worker)");
+
   ifstream ifs(infile());
   if(!ifs.is_open())
     throw runtime_error("args.cc: bcrham input file '" + infile() + "' d.n.e.\n");
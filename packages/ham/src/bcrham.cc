@@ -8,6 +8,16 @@
 #include <ctime>
 #include <fstream>
 #include <cfenv>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "dphandler.h"
 #include "bcrutils.h"
@@ -22,7 +32,14 @@ using namespace std;
 
 // ----------------------------------------------------------------------------------------
 vector<vector<Sequence> > GetSeqs(Args &args, Track *trk);
+void run_job(HMMHolder &hmms, GermLines &gl, Track *trk, Args &args, GlomCache *warm_cache);
+void run_worker(HMMHolder &hmms, GermLines &gl, Track *trk, Args &args, int argc, const char * argv[]);
+bool serve_jobs(HMMHolder &hmms, GermLines &gl, Track *trk, vector<string> &base_argv, GlomCache &warm_cache, int in_fd, int out_fd);
+string run_request(HMMHolder &hmms, GermLines &gl, Track *trk, vector<string> &base_argv, GlomCache &warm_cache, string request, bool &quit);
+bool read_line(int fd, string &buffer, string &line);
+bool write_all(int fd, string str);
 void run_algorithm(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args &args);
+void run_query(HMMHolder &hmms, GermLines &gl, vector<Sequence> qry_seqs, Args &args, size_t iqry, ostream &os);
 
 // ----------------------------------------------------------------------------------------
 int main(int argc, const char * argv[]) {
@@ -34,21 +51,207 @@ int main(int argc, const char * argv[]) {
   vector<string> characters {"A", "C", "G", "T"};
   Track track("NUKES", characters, args.ambig_base());
   GermLines gl(args.datadir(), args.locus());
-  HMMHolder hmms(args.hmmdir(), gl, &track);
-  vector<vector<Sequence> > qry_seq_list(GetSeqs(args, &track));
+  HMMHolder hmms(args.hmmdir(), gl, &track, args.hmm_bundle(), args.mute_freq_bucket_width(), args.max_emission_cache_mb());
+
+  if(args.worker())
+    run_worker(hmms, gl, &track, args, argc, argv);
+  else
+    run_job(hmms, gl, &track, args, nullptr);
+
+  printf("        time: bcrham %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
+  return 0;
+}
+
+// ----------------------------------------------------------------------------------------
+// run whatever <args> asks for (i.e. everything except reading the hmms and germlines)
+void run_job(HMMHolder &hmms, GermLines &gl, Track *trk, Args &args, GlomCache *warm_cache) {
+  vector<vector<Sequence> > qry_seq_list(GetSeqs(args, trk));
 
   if(args.cache_naive_seqs()) {
-    Glomerator glom(hmms, gl, qry_seq_list, &args, &track);
+    Glomerator glom(hmms, gl, qry_seq_list, &args, trk, warm_cache);
     glom.CacheNaiveSeqs();
   } else if(args.partition()) {  // NOTE this is kind of hackey -- there's some code duplication between Glomerator and the loop below... but only a little, and they're doing fairly different things, so screw it for the time being
-    Glomerator glom(hmms, gl, qry_seq_list, &args, &track);
+    Glomerator glom(hmms, gl, qry_seq_list, &args, trk, warm_cache);
     glom.Cluster();
   } else {
     run_algorithm(hmms, gl, qry_seq_list, args);
   }
+}
 
-  printf("        time: bcrham %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
-  return 0;
+// ----------------------------------------------------------------------------------------
+// Long-lived mode (--worker): we've already read the hmms and germlines, so now run a stream of jobs that all reuse them (along with the rescaled
+// emission tables, and the log probs and naive seqs from earlier partition jobs, which we keep in a GlomCache).
+// Jobs come either from stdin, or (with --socket) from connections to a unix domain socket (one connection at a time). Each request is one line:
+//   run <args>     run bcrham with <args> tacked onto the worker's own command line (so <args> can't repeat anything that's already there, or include any of the options that are only read when the worker starts, e.g. --hmm-bundle)
+//   clear-cache    forget the log probs and naive seqs from earlier jobs (which we also do whenever a job's options would change them, see Glomerator::WarmCacheSettings())
+//   quit           stop the worker
+// and the reply is either "ok <n>\n" followed by the <n> bytes of the job's --outfile (zero for the non-job requests), or "error <message>\n".
+// NOTE the job still writes all its usual files (outfile, cache file...), and with stdin we send all the usual stdout chatter to stderr, so stdout only has replies
+void run_worker(HMMHolder &hmms, GermLines &gl, Track *trk, Args &args, int argc, const char * argv[]) {
+  vector<string> base_argv;  // the worker's command line, minus the worker-specific args
+  for(int iarg = 0; iarg < argc; ++iarg) {
+    string arg(argv[iarg]);
+    if(arg == "--worker" || arg.find("--socket=") == 0)
+      continue;
+    if(arg == "--socket") {
+      ++iarg;
+      continue;
+    }
+    base_argv.push_back(arg);
+  }
+
+  GlomCache warm_cache;
+  if(args.socket() == "") {
+    cout.flush();
+    fflush(stdout);
+    int reply_fd(dup(STDOUT_FILENO));
+    if(reply_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+      throw runtime_error("ERROR couldn't redirect stdout for --worker: " + string(strerror(errno)));
+    serve_jobs(hmms, gl, trk, base_argv, warm_cache, STDIN_FILENO, reply_fd);
+    close(reply_fd);
+    return;
+  }
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(args.socket().size() >= sizeof(addr.sun_path))
+    throw runtime_error("ERROR --socket path " + args.socket() + " is too long");
+  strncpy(addr.sun_path, args.socket().c_str(), sizeof(addr.sun_path) - 1);
+  int listen_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+  if(listen_fd < 0)
+    throw runtime_error("ERROR couldn't create socket: " + string(strerror(errno)));
+  unlink(args.socket().c_str());  // in case a previous worker didn't clean up after itself
+  if(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0)
+    throw runtime_error("ERROR couldn't listen on --socket " + args.socket() + ": " + string(strerror(errno)));
+  signal(SIGPIPE, SIG_IGN);  // if a client hangs up before reading its reply, we want an error from write(), not to die
+  cout << "    worker listening on " << args.socket() << endl;
+
+  bool quit(false);
+  while(!quit) {
+    int conn_fd(accept(listen_fd, nullptr, nullptr));
+    if(conn_fd < 0) {
+      if(errno == EINTR)
+	continue;
+      throw runtime_error("ERROR accept() failed on --socket " + args.socket() + ": " + string(strerror(errno)));
+    }
+    quit = serve_jobs(hmms, gl, trk, base_argv, warm_cache, conn_fd, conn_fd);
+    close(conn_fd);
+  }
+  close(listen_fd);
+  unlink(args.socket().c_str());
+}
+
+// ----------------------------------------------------------------------------------------
+// run requests from <in_fd> (replying to <out_fd>) until it's closed, or we're told to quit (in which case return true)
+bool serve_jobs(HMMHolder &hmms, GermLines &gl, Track *trk, vector<string> &base_argv, GlomCache &warm_cache, int in_fd, int out_fd) {
+  string buffer, request;
+  bool quit(false);
+  while(!quit && read_line(in_fd, buffer, request)) {
+    if(request.find_first_not_of(" \t\r") == string::npos)  // skip blank lines
+      continue;
+    string reply(run_request(hmms, gl, trk, base_argv, warm_cache, request, quit));
+    if(!write_all(out_fd, reply))  // client went away
+      break;
+  }
+  return quit;
+}
+
+// ----------------------------------------------------------------------------------------
+// run a single request (see run_worker()), and return the reply
+string run_request(HMMHolder &hmms, GermLines &gl, Track *trk, vector<string> &base_argv, GlomCache &warm_cache, string request, bool &quit) {
+  istringstream iss(request);
+  string command, arg;
+  iss >> command;
+  if(command == "quit") {
+    quit = true;
+    return "ok 0\n";
+  } else if(command == "clear-cache") {
+    warm_cache.Clear();
+    return "ok 0\n";
+  } else if(command != "run") {
+    return "error unknown request '" + command + "' (should be run, clear-cache, or quit)\n";
+  }
+
+  vector<string> job_argv(base_argv);
+  while(iss >> arg)
+    job_argv.push_back(arg);
+  vector<const char*> job_argv_ptrs;
+  for(auto &str : job_argv)
+    job_argv_ptrs.push_back(str.c_str());
+
+  // options that only matter when the worker starts (since every job shares its hmms, germlines, and rescaled emissions), so we'd otherwise silently ignore them
+  vector<string> worker_options {"--hmmdir", "--hmm-bundle", "--datadir", "--locus", "--ambig-base", "--mute-freq-bucket-width", "--max-emission-cache-mb", "--socket"};
+
+  string error_str;
+  try {
+    clock_t run_start(clock());
+    for(size_t iarg = base_argv.size(); iarg < job_argv.size(); ++iarg) {
+      string option(job_argv[iarg].substr(0, job_argv[iarg].find('=')));
+      if(find(worker_options.begin(), worker_options.end(), option) != worker_options.end())
+	throw runtime_error("can't pass " + option + " in a job (it has to go on the worker's command line)");
+    }
+    Args job_args(job_argv_ptrs.size(), job_argv_ptrs.data(), false);
+    if(job_args.worker())
+      throw runtime_error("can't pass --worker in a job");
+    srand(job_args.random_seed());
+    run_job(hmms, gl, trk, job_args, &warm_cache);
+    printf("        time: bcrham job %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
+    fflush(stdout);
+
+    ifstream ifs(job_args.outfile());
+    if(!ifs.is_open())
+      throw runtime_error("couldn't read back --outfile " + job_args.outfile());
+    ostringstream output;
+    output << ifs.rdbuf();
+    return "ok " + to_string(output.str().size()) + "\n" + output.str();
+  } catch(exception &e) {
+    error_str = e.what();
+  } catch(...) {  // e.g. tclap's ExitException, from --help
+    error_str = "job didn't finish";
+  }
+  replace(error_str.begin(), error_str.end(), '\n', ' ');
+  cout << "    worker job failed: " << error_str << endl;
+  return "error " + error_str + "\n";
+}
+
+// ----------------------------------------------------------------------------------------
+// read the next newline-terminated line from <fd> into <line> (without the newline), keeping anything we read past it in <buffer>. Returns false at end of file.
+bool read_line(int fd, string &buffer, string &line) {
+  size_t inewline(buffer.find('\n'));
+  while(inewline == string::npos) {
+    char chunk[4096];
+    ssize_t n_read(read(fd, chunk, sizeof(chunk)));
+    if(n_read < 0 && errno == EINTR)
+      continue;
+    if(n_read <= 0) {  // eof (or error), so use whatever's left as the last line
+      if(buffer.size() == 0)
+	return false;
+      line = buffer;
+      buffer.clear();
+      return true;
+    }
+    buffer.append(chunk, n_read);
+    inewline = buffer.find('\n');
+  }
+  line = buffer.substr(0, inewline);
+  buffer.erase(0, inewline + 1);
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+// write all of <str> to <fd>, returning false if we couldn't
+bool write_all(int fd, string str) {
+  size_t n_written(0);
+  while(n_written < str.size()) {
+    ssize_t n(write(fd, str.data() + n_written, str.size() - n_written));
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    n_written += n;
+  }
+  return true;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -79,40 +282,84 @@ void run_algorithm(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qr
     throw runtime_error("ERROR --outfile (" + args.outfile() + ") d.n.e.\n");
   StreamHeader(ofs, args.algorithm());
 
-  int n_vtb_calculated(0), n_fwd_calculated(0);
-
-  for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
-    if(args.debug() > 1) cout << "  ---------" << endl;
-    KSet kmin(args.integers_["k_v_min"][iqry], args.integers_["k_d_min"][iqry]);
-    KSet kmax(args.integers_["k_v_max"][iqry], args.integers_["k_d_max"][iqry]);
-    KBounds kbounds(kmin, kmax);
-    vector<Sequence> qry_seqs(qry_seq_list[iqry]);
-
-    DPHandler dph(args.algorithm(), &args, gl, hmms);
-    Result result = dph.Run(qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
-    // if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
-    //   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
-
-    if(args.debug() > 1) cout << "       ----" << endl;
-
-    if(result.no_path_)
-      StreamErrorput(ofs, args.algorithm(), qry_seqs, "no_path");
-    else if(args.algorithm() == "viterbi")
-      StreamViterbiOutput(ofs, result.best_event(), qry_seqs, "");
-    else if(args.algorithm() == "forward")
-      StreamForwardOutput(ofs, qry_seqs, result.total_score(), "");
-    else
-      assert(0);
-
-    if(args.algorithm() == "viterbi")
-      ++n_vtb_calculated;
-    else if(args.algorithm() == "forward")
-      ++n_fwd_calculated;
+  size_t n_threads(min((size_t)args.n_threads(), qry_seq_list.size()));
+  if(n_threads <= 1) {
+    for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++)
+      run_query(hmms, gl, qry_seq_list[iqry], args, iqry, ofs);
+  } else {
+    // read all the hmms we'll need before starting, so the threads never have to go to disk
+    vector<vector<string> > &only_gene_lists(args.str_lists_["only_genes"]);
+    for(auto &only_gene_list : only_gene_lists) {
+      for(auto &gene : only_gene_list)
+	hmms.Get(gene);
+    }
+
+    // each thread grabs the next unstarted query, and when it's done puts the output into a reorder buffer, from which we write (in input order) whatever's no longer waiting on an earlier query
+    // NOTE exceptions are caught in each thread and rethrown here once they've all finished, so (as with one thread) they go to whoever called us (e.g. a --worker job comes back as an error instead of killing the worker)
+    atomic<size_t> inext(0);
+    mutex output_mutex;
+    map<size_t, string> finished_output;  // output for queries that finished before some earlier query
+    size_t inext_to_write(0);
+    vector<exception_ptr> exceptions(n_threads);
+    vector<thread> threads;
+    for(size_t ithread = 0; ithread < n_threads; ++ithread) {
+      threads.push_back(thread([&, ithread]() {
+	try {
+	  for(size_t iqry = inext++; iqry < qry_seq_list.size(); iqry = inext++) {
+	    ostringstream oss;
+	    run_query(hmms, gl, qry_seq_list[iqry], args, iqry, oss);
+	    lock_guard<mutex> lock(output_mutex);
+	    finished_output[iqry] = oss.str();
+	    for(auto it = finished_output.begin(); it != finished_output.end() && it->first == inext_to_write; it = finished_output.erase(it)) {
+	      ofs << it->second;
+	      ++inext_to_write;
+	    }
+	  }
+	} catch(...) {
+	  exceptions[ithread] = current_exception();
+	}
+      }));
+    }
+    for(auto &thr : threads)
+      thr.join();
+    for(auto &exc : exceptions) {
+      if(exc)
+	rethrow_exception(exc);
+    }
+    assert(finished_output.size() == 0 && inext_to_write == qry_seq_list.size());
   }
+
+  int n_vtb_calculated(args.algorithm() == "viterbi" ? qry_seq_list.size() : 0);
+  int n_fwd_calculated(args.algorithm() == "forward" ? qry_seq_list.size() : 0);
   printf("        calcd:   vtb %-4d  fwd %-4d\n", n_vtb_calculated, n_fwd_calculated);
   ofs.close();
 }
 
+// ----------------------------------------------------------------------------------------
+// run the algorithm on query <iqry>, and write the result to <os>
+// NOTE may be called from several threads at once, so it only reads from <args> (and uses a fresh DPHandler)
+void run_query(HMMHolder &hmms, GermLines &gl, vector<Sequence> qry_seqs, Args &args, size_t iqry, ostream &os) {
+  if(args.debug() > 1) cout << "  ---------" << endl;
+  KSet kmin(args.integers_.at("k_v_min")[iqry], args.integers_.at("k_d_min")[iqry]);
+  KSet kmax(args.integers_.at("k_v_max")[iqry], args.integers_.at("k_d_max")[iqry]);
+  KBounds kbounds(kmin, kmax);
+
+  DPHandler dph(args.algorithm(), &args, gl, hmms);
+  Result result = dph.Run(qry_seqs, kbounds, args.str_lists_.at("only_genes")[iqry], args.floats_.at("mut_freq")[iqry]);
+  // if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
+  //   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
+
+  if(args.debug() > 1) cout << "       ----" << endl;
+
+  if(result.no_path_)
+    StreamErrorput(os, args.algorithm(), qry_seqs, "no_path");
+  else if(args.algorithm() == "viterbi")
+    StreamViterbiOutput(os, result.best_event(), qry_seqs, "");
+  else if(args.algorithm() == "forward")
+    StreamForwardOutput(os, qry_seqs, result.total_score(), "");
+  else
+    assert(0);
+}
 
 // Glomerator *stupid_global_glom;  // I *(#*$$!*ING HATE GLOBALS
 
@@ -305,51 +305,80 @@ void Result::check_boundaries(KSet best, KBounds kbounds) {
 void HMMHolder::CacheAll() {
   for(auto & region : gl_.regions_) {
     for(auto & gene : gl_.names_[region]) {
-      string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
-      if(ifstream(infname)) {
-        cout << "    read " << infname << endl;
-        hmms_[gene] = new Model;
-        hmms_[gene]->Parse(infname);
-      }
+      if(Available(gene))
+        Get(gene);
     }
   }
 }
 
 // ----------------------------------------------------------------------------------------
 Model *HMMHolder::Get(string gene) {
-  if(hmms_.find(gene) == hmms_.end()) {   // if we don't already have it, read it from disk
-    hmms_[gene] = new Model;
-    string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
-    // if (true) cout << "    read " << infname << endl;
-    hmms_[gene]->Parse(infname);
+  {
+    lock_guard<mutex> lock(hmms_mutex_);
+    auto it(hmms_.find(gene));
+    if(it != hmms_.end())
+      return it->second;
   }
-  return hmms_[gene];
+
+  // if we don't already have it, read it from disk
+  // NOTE we don't hold the lock while we read, so if two threads want the same new hmm they both read it (but only one goes in <hmms_>)
+  unique_ptr<Model> hmm(Read(gene));
+  lock_guard<mutex> lock(hmms_mutex_);
+  auto inserted(hmms_.insert(pair<string, Model*>(gene, hmm.get())));
+  if(inserted.second)
+    hmm.release();  // <hmms_> owns it now
+  return inserted.first->second;
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::RescaleOverallMuteFreqs(map<string, set<string> > &only_genes, double overall_mute_freq) {
-  // WOE BETIDE THEE WHO FORGETETH TO RE-RESET THESE
-  // Seriously! If you don't re-rescale 'em when you're done with the sequences to which <overall_mute_freq> correspond, the mute freqs in the hmms will be *wrong*
+bool HMMHolder::Available(string gene) {
+  if(bundle_ && bundle_->Has(gl_.SanitizeName(gene)))
+    return true;
+  return (bool)ifstream(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
+}
 
-  // then actually do the rescaling for each necessary gene
-  for(auto &region : gl_.regions_) {
-    for(auto &gene : only_genes[region]) {
-      Get(gene)->RescaleOverallMuteFreq(overall_mute_freq);
-    }
+// ----------------------------------------------------------------------------------------
+unique_ptr<Model> HMMHolder::Read(string gene) {
+  unique_ptr<Model> hmm(new Model);  // so it gets deleted if Parse() or Init() throws
+  if(bundle_ && bundle_->Has(gl_.SanitizeName(gene))) {
+    ModelSpec spec(bundle_->GetSpec(gl_.SanitizeName(gene)));
+    hmm->Init(spec);
+  } else {
+    string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
+    // if (true) cout << "    read " << infname << endl;
+    hmm->Parse(infname);
   }
+  return hmm;
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes) {
-  for(auto &region : gl_.regions_) {
-    for(auto &gene : only_genes[region]) {
-      Get(gene)->UnRescaleOverallMuteFreq();
-    }
+shared_ptr<EmissionTable> HMMHolder::RescaledEmissions(string gene, double overall_mute_freq) {
+  if(mute_freq_bucket_width_ > 0.)
+    overall_mute_freq = (floor(overall_mute_freq / mute_freq_bucket_width_) + 0.5) * mute_freq_bucket_width_;
+  pair<string, double> key(gene, overall_mute_freq);
+  {
+    lock_guard<mutex> lock(emissions_mutex_);
+    auto it(rescaled_emissions_.find(key));
+    if(it != rescaled_emissions_.end())
+      return it->second;
+  }
+
+  // NOTE we don't hold the lock while we rescale, so if two threads want the same new table they both make it (but they make the same thing, and only one goes in the cache)
+  shared_ptr<EmissionTable> emissions(make_shared<EmissionTable>(Get(gene)->RescaledEmissions(overall_mute_freq)));
+  lock_guard<mutex> lock(emissions_mutex_);
+  if(emission_cache_bytes_ + emissions->ApproxBytesUsed() > max_emission_cache_bytes_) {  // NOTE anybody who's still using one of these has their own shared_ptr to it, so it's fine to clear them
+    rescaled_emissions_.clear();
+    emission_cache_bytes_ = 0.;
   }
+  auto inserted(rescaled_emissions_.insert(pair<pair<string, double>, shared_ptr<EmissionTable> >(key, emissions)));
+  if(inserted.second)
+    emission_cache_bytes_ += emissions->ApproxBytesUsed();
+  return inserted.first->second;
 }
 
 // ----------------------------------------------------------------------------------------
 HMMHolder::~HMMHolder() {
+  delete bundle_;
   for(auto & entry : hmms_)
     delete entry.second;
 }
@@ -357,6 +386,7 @@ HMMHolder::~HMMHolder() {
 // ----------------------------------------------------------------------------------------
 string HMMHolder::NameString(map<string, set<string> > *only_genes, int max_to_print) {
   // NOTE this doesn't check that we actually have xeverybody in <only_genes>
+  lock_guard<mutex> lock(hmms_mutex_);
   TermColors tc;
   map<string, string> region_strs;
   map<string, int> n_genes;
@@ -392,26 +422,26 @@ string HMMHolder::NameString(map<string, set<string> > *only_genes, int max_to_p
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamHeader(ofstream &ofs, string algorithm) {
+void StreamHeader(ostream &os, string algorithm) {
   // NOTE make sure to change this in StreamErrorput() and StreamViterbiOutput() (or StreamForwardOutput()) below!
   if(algorithm == "viterbi")
-    ofs << "unique_ids,v_gene,d_gene,j_gene,fv_insertion,vd_insertion,dj_insertion,jf_insertion,v_5p_del,v_3p_del,d_5p_del,d_3p_del,j_5p_del,j_3p_del,logprob,seqs,v_per_gene_support,d_per_gene_support,j_per_gene_support,errors" << endl;
+    os << "unique_ids,v_gene,d_gene,j_gene,fv_insertion,vd_insertion,dj_insertion,jf_insertion,v_5p_del,v_3p_del,d_5p_del,d_3p_del,j_5p_del,j_3p_del,logprob,seqs,v_per_gene_support,d_per_gene_support,j_per_gene_support,errors" << endl;
   else if(algorithm == "forward")
-    ofs << "unique_ids,logprob,errors" << endl;
+    os << "unique_ids,logprob,errors" << endl;
   else
     throw runtime_error("bad algorithm " + algorithm);
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence*> &pseqs, string errors) {
+void StreamErrorput(ostream &os, string algorithm, vector<Sequence*> &pseqs, string errors) {
   vector<Sequence> seqs(GetSeqVector(pseqs));
-  StreamErrorput(ofs, algorithm, seqs, errors);
+  StreamErrorput(os, algorithm, seqs, errors);
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence> &seqs, string errors) {
+void StreamErrorput(ostream &os, string algorithm, vector<Sequence> &seqs, string errors) {
   if(algorithm == "viterbi") {
-    ofs  // be very, very careful to change this *and* the csv header above at the same time
+    os  // be very, very careful to change this *and* the csv header above at the same time
       << SeqNameStr(seqs, ":")
       << ","
       << ","
@@ -434,7 +464,7 @@ void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence> &seqs, str
       << "," << errors
       << endl;
   } else {
-    ofs
+    os
       << SeqNameStr(seqs, ":")
       << ","
       << "," << errors
@@ -455,15 +485,15 @@ string PerGeneSupportString(vector<SupportPair> &support) {
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence*> &pseqs, string errors) {
+void StreamViterbiOutput(ostream &os, RecoEvent &event, vector<Sequence*> &pseqs, string errors) {
   vector<Sequence> seqs(GetSeqVector(pseqs));
-  StreamViterbiOutput(ofs, event, seqs, errors);
+  StreamViterbiOutput(os, event, seqs, errors);
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence> &seqs, string errors) {
+void StreamViterbiOutput(ostream &os, RecoEvent &event, vector<Sequence> &seqs, string errors) {
   string second_seq_name, second_seq;
-  ofs  // be very, very careful to change this *and* the csv header above at the same time
+  os  // be very, very careful to change this *and* the csv header above at the same time
     << SeqNameStr(seqs, ":")
     << "," << event.genes_["v"]
     << "," << event.genes_["d"]
@@ -488,14 +518,14 @@ void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence> &seqs
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamForwardOutput(ofstream &ofs, vector<Sequence*> &pseqs, double total_score, string errors) {
+void StreamForwardOutput(ostream &os, vector<Sequence*> &pseqs, double total_score, string errors) {
   vector<Sequence> seqs(GetSeqVector(pseqs));
-  StreamForwardOutput(ofs, seqs, total_score, errors);
+  StreamForwardOutput(os, seqs, total_score, errors);
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamForwardOutput(ofstream &ofs, vector<Sequence> &seqs, double total_score, string errors) {
-  ofs  // be very, very careful to change this *and* the csv header above at the same time
+void StreamForwardOutput(ostream &os, vector<Sequence> &seqs, double total_score, string errors) {
+  os  // be very, very careful to change this *and* the csv header above at the same time
     << SeqNameStr(seqs, ":")
     << "," << total_score
     << "," << errors
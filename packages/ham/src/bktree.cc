@@ -0,0 +1,73 @@
+#include "bktree.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+void BKTree::Insert(ClusterId id, const PackedSeq &seq) {
+  if(node_indices_.count(id))
+    throw runtime_error("cluster " + to_string(id) + " is already in BKTree");
+  if(seq.n_ambiguous() > max_n_ambiguous_)
+    max_n_ambiguous_ = seq.n_ambiguous();
+
+  nodes_.push_back(Node(id, seq));
+  size_t inew(nodes_.size() - 1);
+  node_indices_[id] = inew;
+  if(inew == 0)
+    return;
+
+  size_t inode(0);
+  while(true) {
+    unsigned distance(nodes_[inode].seq_.FullHammingDistance(seq));
+    auto it = nodes_[inode].children_.find(distance);
+    if(it == nodes_[inode].children_.end()) {
+      nodes_[inode].children_[distance] = inew;
+      return;
+    }
+    inode = it->second;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void BKTree::Remove(ClusterId id) {
+  auto it = node_indices_.find(id);
+  if(it == node_indices_.end())
+    return;
+  nodes_[it->second].removed_ = true;
+  node_indices_.erase(it);
+  ++n_removed_;
+  if(n_removed_ > node_indices_.size())
+    Rebuild();
+}
+
+// ----------------------------------------------------------------------------------------
+vector<ClusterId> BKTree::Within(const PackedSeq &seq, unsigned max_distance) {
+  vector<ClusterId> ids;
+  if(nodes_.size() == 0)
+    return ids;
+  vector<size_t> to_visit{0};
+  while(to_visit.size() > 0) {
+    Node &node(nodes_[to_visit.back()]);
+    to_visit.pop_back();
+    unsigned distance(node.seq_.FullHammingDistance(seq));
+    if(distance <= max_distance && !node.removed_)
+      ids.push_back(node.id_);
+    unsigned min_child(distance > max_distance ? distance - max_distance : 0);
+    for(auto it = node.children_.lower_bound(min_child); it != node.children_.end() && it->first <= distance + max_distance; ++it)
+      to_visit.push_back(it->second);
+  }
+  return ids;
+}
+
+// ----------------------------------------------------------------------------------------
+void BKTree::Rebuild() {
+  vector<Node> old_nodes;
+  old_nodes.swap(nodes_);
+  node_indices_.clear();
+  n_removed_ = 0;
+  for(auto &node : old_nodes) {
+    if(!node.removed_)
+      Insert(node.id_, node.seq_);
+  }
+}
+
+}
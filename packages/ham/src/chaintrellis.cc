@@ -0,0 +1,337 @@
+#include "chaintrellis.h"
+#include "trellis.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+double ChainTrellis::ApproxBytesUsed() {
+  double bytes(0.);
+  bytes += sizeof(double) * (left_scores_.size() + entry_scores_.size() + exit_scores_.size() + right_scores_.size());
+  bytes += sizeof(int) * (left_pointers_.size() + entry_pointers_.size() + exit_pointers_.size() + right_pointers_.size());
+  return bytes;
+}
+
+// ----------------------------------------------------------------------------------------
+void ChainTrellis::Init(Model *hmm, Trellis *trell, size_t seq_length) {
+  hmm_ = hmm;
+  trell_ = trell;
+  seq_length_ = seq_length;
+  exit_chain_positions_.assign(hmm_->n_chain_exits(), -1);
+  min_entry_ = hmm_->chain()->size();
+  max_entry_ = -1;
+  min_exit_ = hmm_->chain()->size();
+  max_exit_ = -1;
+  for(size_t ic = 0; ic < hmm_->chain()->size(); ++ic) {
+    if(hmm_->chain_entry_index(ic) != -1) {
+      min_entry_ = min(min_entry_, (int)ic);
+      max_entry_ = max(max_entry_, (int)ic);
+    }
+    if(hmm_->chain_exit_index(ic) != -1) {
+      exit_chain_positions_[hmm_->chain_exit_index(ic)] = ic;
+      min_exit_ = min(min_exit_, (int)ic);
+      max_exit_ = max(max_exit_, (int)ic);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void ChainTrellis::Viterbi(Model *hmm, Trellis *trell, size_t seq_length, vector<double> &log_probs, vector<int> &indices, vector<double> *prune_thresholds) {
+  Init(hmm, trell, seq_length);
+  vector<uint16_t> &left(*hmm_->left_inserts()), &chain(*hmm_->chain()), &right(*hmm_->right_inserts());
+  size_t nl(left.size()), nr(right.size()), ne(hmm_->n_chain_entries()), nx(hmm_->n_chain_exits());
+  size_t npos(seq_length_);
+
+  log_probs.assign(npos, -INFINITY);
+  indices.assign(npos, -1);
+  left_scores_.assign(npos * nl, -INFINITY);
+  left_pointers_.assign(npos * nl, -1);
+  entry_scores_.assign(npos * ne, -INFINITY);
+  entry_pointers_.assign(npos * ne, -1);
+  exit_scores_.assign(npos * nx, -INFINITY);
+  exit_pointers_.assign(npos * nx, -1);
+  right_scores_.assign(npos * nr, -INFINITY);
+  right_pointers_.assign(npos * nr, -1);
+
+  // left inserts, and the scores for entering the chain at each entry point
+  for(size_t position = 0; position < npos; ++position) {
+    for(size_t il = 0; il < nl; ++il) {
+      double emission_val(trell_->EmissionLogprob(left[il], position));
+      if(emission_val == -INFINITY)
+	continue;
+      double best(-INFINITY);
+      if(position == 0) {
+	best = hmm_->init_logprob(left[il]);
+      } else {
+	for(size_t il_prev = 0; il_prev < nl; ++il_prev)
+	  Maximize(best, left_scores_[(position - 1)*nl + il_prev] + hmm_->left_to_left_logprob(il_prev, il), left_pointers_[position*nl + il], il_prev);
+      }
+      if(best == -INFINITY || (prune_thresholds && best + emission_val < (*prune_thresholds)[position]))
+	continue;
+      left_scores_[position*nl + il] = best + emission_val;
+    }
+    for(int ic = min_entry_; ic <= max_entry_; ++ic) {
+      int ie(hmm_->chain_entry_index(ic));
+      if(ie == -1)
+	continue;
+      if(position == 0) {
+	entry_scores_[ie] = hmm_->init_logprob(chain[ic]);
+      } else {
+	for(size_t il = 0; il < nl; ++il)
+	  Maximize(entry_scores_[position*ne + ie], left_scores_[(position - 1)*nl + il] + hmm_->left_to_chain_logprob(il, ic), entry_pointers_[position*ne + ie], il);
+      }
+    }
+  }
+
+  // chain: walk along each diagonal (constant chain position minus sequence position) that has both an entry and an exit point, keeping track of the
+  // best (entry score - emissions before the entry - transitions before the entry), to which we add the emissions and transitions so far at each exit
+  for(int diag = min_exit_ - ((int)npos - 1); diag <= max_entry_; ++diag) {
+    int pos_begin(max(0, min_entry_ - diag)), pos_end(min((int)npos - 1, max_exit_ - diag));  // inclusive
+    double best(-INFINITY), emission_sum(0.);
+    int best_entry(-1);
+    for(int position = pos_begin; position <= pos_end; ++position) {
+      size_t ic(position + diag);
+      int ie(hmm_->chain_entry_index(ic));
+      if(ie != -1)
+	Maximize(best, entry_scores_[position*ne + ie] - emission_sum - hmm_->chain_cumulative_logprob(ic), best_entry, ic);
+      if(best == -INFINITY)
+	continue;
+      double emission_val(trell_->EmissionLogprob(chain[ic], position));
+      if(emission_val == -INFINITY) {  // kills any path through here, so start over (with the entries after this position)
+	best = -INFINITY;
+	emission_sum = 0.;
+	continue;
+      }
+      emission_sum += emission_val;
+      if(prune_thresholds && best + emission_sum + hmm_->chain_cumulative_logprob(ic) < (*prune_thresholds)[position]) {  // the best path along this diagonal can't get anywhere we care about, so same thing
+	best = -INFINITY;
+	emission_sum = 0.;
+	continue;
+      }
+      int ix(hmm_->chain_exit_index(ic));
+      if(ix != -1) {
+	exit_scores_[position*nx + ix] = best + emission_sum + hmm_->chain_cumulative_logprob(ic);
+	exit_pointers_[position*nx + ix] = best_entry;
+      }
+    }
+  }
+
+  // right inserts, and the ending values for each length
+  for(size_t position = 0; position < npos; ++position) {
+    for(size_t ix = 0; ix < nx; ++ix) {
+      size_t ist(chain[exit_chain_positions_[ix]]);
+      Maximize(log_probs[position], exit_scores_[position*nx + ix] + hmm_->end_logprob(ist), indices[position], ist);
+    }
+    if(position == 0)
+      continue;
+    for(size_t ir = 0; ir < nr; ++ir) {
+      double emission_val(trell_->EmissionLogprob(right[ir], position));
+      if(emission_val == -INFINITY)
+	continue;
+      double best(-INFINITY);
+      int &pointer(right_pointers_[position*nr + ir]);
+      for(size_t ix = 0; ix < nx; ++ix)
+	Maximize(best, exit_scores_[(position - 1)*nx + ix] + hmm_->chain_to_right_logprob(exit_chain_positions_[ix], ir), pointer, -1 - (int)ix);
+      for(size_t ir_prev = 0; ir_prev < nr; ++ir_prev)
+	Maximize(best, right_scores_[(position - 1)*nr + ir_prev] + hmm_->right_to_right_logprob(ir_prev, ir), pointer, ir_prev);
+      if(best == -INFINITY || (prune_thresholds && best + emission_val < (*prune_thresholds)[position]))
+	continue;
+      right_scores_[position*nr + ir] = best + emission_val;
+      Maximize(log_probs[position], right_scores_[position*nr + ir] + hmm_->end_logprob(right[ir]), indices[position], right[ir]);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Same structure as Viterbi(), but summing. To avoid an exp and a log for every term, each sum is done in linear space relative to the max
+// (see LogSum), and the sums over the previous position's insert states share one set of exps for all their to-states.
+// NOTE doesn't touch the viterbi pointers, so we can still do the traceback if we run forward after viterbi
+void ChainTrellis::Forward(Model *hmm, Trellis *trell, size_t seq_length, vector<double> &log_probs, vector<double> *prune_thresholds, size_t *n_pruned) {
+  Init(hmm, trell, seq_length);
+  vector<uint16_t> &left(*hmm_->left_inserts()), &chain(*hmm_->chain()), &right(*hmm_->right_inserts());
+  size_t nl(left.size()), nr(right.size()), ne(hmm_->n_chain_entries()), nx(hmm_->n_chain_exits());
+  size_t npos(seq_length_);
+
+  log_probs.assign(npos, -INFINITY);
+  left_scores_.assign(npos * nl, -INFINITY);
+  entry_scores_.assign(npos * ne, 0.);  // NOTE in linear space, relative to <entry_offsets_>
+  entry_offsets_.assign(npos, 0.);
+  exit_scores_.assign(npos * nx, -INFINITY);
+  right_scores_.assign(npos * nr, -INFINITY);
+  weights_.resize(max(nl, nx + nr));
+  size_t n_dropped(0);
+
+  // left inserts, and the scores for entering the chain at each entry point
+  for(size_t position = 0; position < npos; ++position) {
+    if(position == 0) {
+      for(size_t il = 0; il < nl; ++il) {
+	left_scores_[il] = hmm_->init_logprob(left[il]) + trell_->EmissionLogprob(left[il], position);
+	if(prune_thresholds && left_scores_[il] != -INFINITY && left_scores_[il] < (*prune_thresholds)[position]) {
+	  left_scores_[il] = -INFINITY;
+	  ++n_dropped;
+	}
+      }
+      for(int ic = min_entry_; ic <= max_entry_; ++ic) {
+	if(hmm_->chain_entry_index(ic) != -1)
+	  entry_scores_[hmm_->chain_entry_index(ic)] = hmm_->init_prob(chain[ic]);
+      }
+      continue;
+    }
+    double offset(Weights(&left_scores_[(position - 1)*nl], nl));
+    if(offset == -INFINITY)  // nothing in the left inserts at the previous position, so the rest of the left inserts and entries are zero
+      continue;
+    entry_offsets_[position] = offset;
+    for(size_t il = 0; il < nl; ++il) {
+      double emission_val(trell_->EmissionLogprob(left[il], position));
+      if(emission_val == -INFINITY)
+	continue;
+      double total(0.);
+      for(size_t il_prev = 0; il_prev < nl; ++il_prev)
+	total += weights_[il_prev] * hmm_->left_to_left_prob(il_prev, il);
+      left_scores_[position*nl + il] = offset + log(total) + emission_val;  // NOTE -INFINITY if <total> is zero
+      if(prune_thresholds && left_scores_[position*nl + il] != -INFINITY && left_scores_[position*nl + il] < (*prune_thresholds)[position]) {
+	left_scores_[position*nl + il] = -INFINITY;
+	++n_dropped;
+      }
+    }
+    for(int ic = min_entry_; ic <= max_entry_; ++ic) {
+      int ie(hmm_->chain_entry_index(ic));
+      if(ie == -1)
+	continue;
+      double total(0.);
+      for(size_t il = 0; il < nl; ++il)
+	total += weights_[il] * hmm_->left_to_chain_prob(il, ic);
+      entry_scores_[position*ne + ie] = total;
+    }
+  }
+
+  // chain: same as viterbi, but with a running sum of the entries instead of the best one
+  for(int diag = min_exit_ - ((int)npos - 1); diag <= max_entry_; ++diag) {
+    int pos_begin(max(0, min_entry_ - diag)), pos_end(min((int)npos - 1, max_exit_ - diag));  // inclusive
+    LogSum running;
+    double emission_sum(0.);
+    for(int position = pos_begin; position <= pos_end; ++position) {
+      size_t ic(position + diag);
+      int ie(hmm_->chain_entry_index(ic));
+      if(ie != -1 && entry_scores_[position*ne + ie] > 0.)
+	running.Add(entry_offsets_[position] - emission_sum - hmm_->chain_cumulative_logprob(ic), entry_scores_[position*ne + ie]);
+      if(running.empty())
+	continue;
+      double emission_val(trell_->EmissionLogprob(chain[ic], position));
+      if(emission_val == -INFINITY) {
+	running = LogSum();
+	emission_sum = 0.;
+	continue;
+      }
+      emission_sum += emission_val;
+      if(prune_thresholds && running.below((*prune_thresholds)[position] - emission_sum - hmm_->chain_cumulative_logprob(ic))) {
+	running = LogSum();
+	emission_sum = 0.;
+	++n_dropped;
+	continue;
+      }
+      int ix(hmm_->chain_exit_index(ic));
+      if(ix != -1)
+	exit_scores_[position*nx + ix] = running.log_value() + emission_sum + hmm_->chain_cumulative_logprob(ic);
+    }
+  }
+
+  // right inserts, and the ending values for each length
+  for(size_t position = 0; position < npos; ++position) {
+    if(position > 0 && nr > 0) {
+      double offset(Weights(&exit_scores_[(position - 1)*nx], nx, &right_scores_[(position - 1)*nr], nr));
+      for(size_t ir = 0; offset != -INFINITY && ir < nr; ++ir) {
+	double emission_val(trell_->EmissionLogprob(right[ir], position));
+	if(emission_val == -INFINITY)
+	  continue;
+	double total(0.);
+	for(size_t ix = 0; ix < nx; ++ix)
+	  total += weights_[ix] * hmm_->chain_to_right_prob(exit_chain_positions_[ix], ir);
+	for(size_t ir_prev = 0; ir_prev < nr; ++ir_prev)
+	  total += weights_[nx + ir_prev] * hmm_->right_to_right_prob(ir_prev, ir);
+	right_scores_[position*nr + ir] = offset + log(total) + emission_val;
+	if(prune_thresholds && right_scores_[position*nr + ir] != -INFINITY && right_scores_[position*nr + ir] < (*prune_thresholds)[position]) {
+	  right_scores_[position*nr + ir] = -INFINITY;
+	  ++n_dropped;
+	}
+      }
+    }
+    LogSum total;
+    for(size_t ix = 0; ix < nx; ++ix)
+      total.Add(exit_scores_[position*nx + ix] + hmm_->end_logprob(chain[exit_chain_positions_[ix]]));
+    for(size_t ir = 0; ir < nr; ++ir)
+      total.Add(right_scores_[position*nr + ir] + hmm_->end_logprob(right[ir]));
+    log_probs[position] = total.log_value();
+  }
+  if(n_pruned)
+    *n_pruned = n_dropped;
+}
+
+// ----------------------------------------------------------------------------------------
+// set <weights_> to exp(<vals> - max) for the <n_vals> entries in <vals> (followed by the <n_more_vals> in <more_vals>), and return the max
+double ChainTrellis::Weights(double *vals, size_t n_vals, double *more_vals, size_t n_more_vals) {
+  double max_val(-INFINITY);
+  for(size_t iv = 0; iv < n_vals; ++iv)
+    max_val = max(max_val, vals[iv]);
+  for(size_t iv = 0; iv < n_more_vals; ++iv)
+    max_val = max(max_val, more_vals[iv]);
+  if(max_val == -INFINITY)
+    return max_val;
+  for(size_t iv = 0; iv < n_vals; ++iv)
+    weights_[iv] = vals[iv] - max_val;
+  for(size_t iv = 0; iv < n_more_vals; ++iv)
+    weights_[n_vals + iv] = more_vals[iv] - max_val;
+  ExpInPlace(weights_.data(), n_vals + n_more_vals);
+  return max_val;
+}
+
+// ----------------------------------------------------------------------------------------
+void ChainTrellis::Traceback(size_t length, int final_state, TracebackPath &path) {
+  vector<uint16_t> &left(*hmm_->left_inserts()), &chain(*hmm_->chain()), &right(*hmm_->right_inserts());
+  size_t nl(left.size()), nr(right.size()), ne(hmm_->n_chain_entries()), nx(hmm_->n_chain_exits());
+  int position(length - 1);
+
+  // find the chain exit point, going back through the right inserts if we ended in one
+  int ix(-1);
+  for(size_t ir = 0; ir < nr; ++ir) {
+    if(right[ir] != final_state)
+      continue;
+    int ircurrent(ir);
+    while(true) {
+      path.push_back(right[ircurrent]);
+      int pointer(right_pointers_[position*nr + ircurrent]);
+      --position;
+      if(pointer < 0) {
+	ix = -1 - pointer;
+	break;
+      }
+      ircurrent = pointer;
+    }
+  }
+  if(ix == -1) {
+    for(size_t ic = 0; ic < chain.size(); ++ic) {
+      if(chain[ic] == final_state)
+	ix = hmm_->chain_exit_index(ic);
+    }
+  }
+  if(ix == -1)
+    throw runtime_error("ERROR couldn't find chain exit for final state " + to_string(final_state) + " in " + hmm_->name());
+
+  // back along the chain's diagonal to the entry point
+  int ic_entry(exit_pointers_[position*nx + ix]);
+  for(int ic = exit_chain_positions_[ix]; ic >= ic_entry; --ic) {
+    path.push_back(chain[ic]);
+    --position;
+  }
+
+  // and then back through the left inserts
+  if(position < 0)
+    return;
+  int il(entry_pointers_[(position + 1)*ne + hmm_->chain_entry_index(ic_entry)]);
+  while(position >= 0) {
+    path.push_back(left[il]);
+    il = left_pointers_[position*nl + il];
+    --position;
+  }
+}
+
+}
@@ -0,0 +1,121 @@
+#include "clusterindex.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+unsigned ClusterIndex::UidIndex(string uid) {
+  auto it = uid_indices_.find(uid);
+  if(it != uid_indices_.end())
+    return it->second;
+
+  uint64_t hash(std::hash<string>{}(uid));  // then mix the bits (splitmix64 finalizer), since we're going to be adding these together
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  hash = hash ^ (hash >> 31);
+
+  uids_.push_back(uid);
+  uid_hashes_.push_back(hash);
+  uid_indices_[uid] = uids_.size() - 1;
+  return uids_.size() - 1;
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterIndex::Intern(string name) {
+  vector<unsigned> members;
+  uint64_t hash(0);
+  for(auto &uid : SplitString(name, ":")) {
+    unsigned iuid(UidIndex(uid));
+    members.push_back(iuid);
+    hash += uid_hashes_[iuid];
+  }
+
+  ClusterId id(Find(hash, members.size(), members));
+  if(id != NO_CLUSTER)
+    return id;
+
+  ClusterInfo cinfo(hash, members.size(), NO_CLUSTER, NO_CLUSTER);
+  cinfo.name_ = name;
+  cinfo.members_ = members;
+  return Add(cinfo);
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterIndex::Join(ClusterId id_a, ClusterId id_b) {
+  pair<ClusterId, ClusterId> key(min(id_a, id_b), max(id_a, id_b));
+  auto it = joins_.find(key);
+  if(it != joins_.end())
+    return it->second;
+
+  ClusterInfo cinfo(clusters_.at(id_a).hash_ + clusters_.at(id_b).hash_, clusters_.at(id_a).size_ + clusters_.at(id_b).size_, id_a, id_b);
+  ClusterId id(NO_CLUSTER);
+  if(ids_by_hash_.count(cinfo.hash_)) {  // only need the members if there's something to compare to
+    vector<unsigned> joint_members(members(id_a));
+    joint_members.insert(joint_members.end(), members(id_b).begin(), members(id_b).end());
+    id = Find(cinfo.hash_, cinfo.size_, joint_members);
+  }
+  if(id == NO_CLUSTER)
+    id = Add(cinfo);
+
+  joins_[key] = id;
+  return id;
+}
+
+// ----------------------------------------------------------------------------------------
+const string &ClusterIndex::name(ClusterId id) {
+  ClusterInfo &cinfo(clusters_.at(id));
+  if(cinfo.name_ == "") {
+    assert(cinfo.parent_a_ != NO_CLUSTER);
+    const string &name_a(name(cinfo.parent_a_)), &name_b(name(cinfo.parent_b_));
+    cinfo.name_ = name_a < name_b ? name_a + ":" + name_b : name_b + ":" + name_a;
+  }
+  return cinfo.name_;
+}
+
+// ----------------------------------------------------------------------------------------
+const vector<unsigned> &ClusterIndex::members(ClusterId id) {
+  ClusterInfo &cinfo(clusters_.at(id));
+  if(cinfo.members_.size() == 0) {
+    assert(cinfo.parent_a_ != NO_CLUSTER);
+    ClusterId first(cinfo.parent_a_), second(cinfo.parent_b_);
+    if(name(second) < name(first))  // same order as in the name
+      swap(first, second);
+    cinfo.members_ = members(first);
+    cinfo.members_.insert(cinfo.members_.end(), members(second).begin(), members(second).end());
+  }
+  return cinfo.members_;
+}
+
+// ----------------------------------------------------------------------------------------
+bool ClusterIndex::Contains(ClusterId id, unsigned iuid) {
+  const vector<unsigned> &mbrs(members(id));
+  return find(mbrs.begin(), mbrs.end(), iuid) != mbrs.end();
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterIndex::Find(uint64_t hash, size_t size, vector<unsigned> members) {
+  auto range = ids_by_hash_.equal_range(hash);
+  if(range.first == range.second)
+    return NO_CLUSTER;
+  sort(members.begin(), members.end());
+  for(auto it = range.first; it != range.second; ++it) {  // make sure it isn't a hash collision
+    if(clusters_[it->second].size_ != size)
+      continue;
+    vector<unsigned> other_members(this->members(it->second));
+    sort(other_members.begin(), other_members.end());
+    if(other_members == members)
+      return it->second;
+  }
+  return NO_CLUSTER;
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterIndex::Add(ClusterInfo cinfo) {
+  if(clusters_.size() == NO_CLUSTER)
+    throw runtime_error("too many clusters in ClusterIndex");
+  clusters_.push_back(cinfo);
+  ClusterId id(clusters_.size() - 1);
+  ids_by_hash_.insert(pair<uint64_t, ClusterId>(cinfo.hash_, id));
+  return id;
+}
+
+}
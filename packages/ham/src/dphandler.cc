@@ -17,9 +17,11 @@ DPHandler::~DPHandler() {
 // ----------------------------------------------------------------------------------------
 void DPHandler::Clear() {
   scratch_cachefo_.clear();
+  sweep_ids_.clear();
+  sweep_ids_by_bounds_.clear();
   paths_.clear();
-  scores_.clear();
   per_gene_support_.clear();
+  emissions_.clear();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -84,38 +86,61 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     Clear();  // delete all existing trellisi, paths, and logprobs NOTE in principal it kinda ought to be faster to keep everything cached between calls to Run()... but in practice there's a fair bit of overhead to keeping all that stuff hanging around, and it's much more efficient to do the caching in Glomerator (which we already do). So, in sum, it's generally faster to Clear() right here. One exception is if you, say, run viterbi on the same sequence fifty times in a row... then you want to keep the cache around. But why would you do that? In practice the only time you're running on the same sequence many times is in Glomerator, and there we're already doing caching more efficiently at a higher level.
   map<KSet, double> best_scores; // best score for each kset (summed over regions)
   map<KSet, double> total_scores; // total score for each kset (summed over regions)
+  map<KSet, double> total_score_errors; // error bound on each kset's total score (see Result::total_score_error_)
   map<KSet, map<string, string> > best_genes; // map from a kset to its corresponding triplet of best genes
-  if(!args_->dont_rescale_emissions()) {  // reset the emission probabilities in the hmms to reflect the frequences in this particular set of sequences
+  if(!args_->dont_rescale_emissions()) {  // rescale the emission probabilities to reflect the frequences in this particular set of sequences (the hmms themselves don't change)
     assert(overall_mute_freq != -INFINITY);  // make sure the caller remembered to set it
-    // NOTE it's super important to *un*set them after you're done
-    hmms_.RescaleOverallMuteFreqs(only_genes, overall_mute_freq);
+    for(auto &region : gl_.regions_) {
+      for(auto &gene : only_genes[region])
+	emissions_[gene] = hmms_.RescaledEmissions(gene, overall_mute_freq);
+    }
   }
 
   Result result(kbounds, args_->locus());
+  kbounds_ = kbounds;
+  sweep_ids_by_bounds_.clear();  // NOTE don't clear <sweep_ids_>, since if we didn't Clear() we want to reuse the trellises whose query strings are the same
 
   // loop over k_v k_d space
   double best_score(-INFINITY);
   KSet best_kset(0, 0);
   double *total_score = &result.total_score_;  // total score for all ksets
   int n_too_long(0), n_run(0), n_total(0);
-  for(size_t k_v = kbounds.vmax - 1; k_v >= kbounds.vmin; --k_v) {  // loop in reverse order to facilitate chunk caching: in principle we calculate V once the first time through, and after that can just copy over pieces of the first dp table (roughly the same for D and J)
-    for(size_t k_d = kbounds.dmax - 1; k_d >= kbounds.dmin; --k_d) {
-      ++n_total;
-      if(k_v + k_d >= seqs.GetSequenceLength()) {
-        ++n_too_long;
-        continue;
-      }
-      KSet kset(k_v, k_d);
-      RunKSet(seqs, kset, only_genes, &best_scores, &total_scores, &best_genes);
-      ++n_run;
-      *total_score = AddInLogSpace(total_scores[kset], *total_score);  // sum up the probabilities for each kset, log P_tot = log \sum_i P_k_i
-      if(args_->debug() == 2 && algorithm_ == "forward") printf("            %9.2f (%.1e)  tot: %7.2f\n", total_scores[kset], exp(total_scores[kset]), *total_score);
-      if(best_scores[kset] > best_score) {
-        best_score = best_scores[kset];
-        best_kset = kset;
-      }
-      if(algorithm_ == "viterbi" && best_scores[kset] != -INFINITY)  // add event to the vector in <result>
-        result.PushBackRecoEvent(FillRecoEvent(seqs, kset, best_genes[kset], best_scores[kset]));
+  set<KSet> ksets_tried;
+  auto run_kset = [&](KSet kset) {
+    if(ksets_tried.count(kset) > 0)
+      return;
+    ksets_tried.insert(kset);
+    ++n_total;
+    if(kset.v + kset.d >= seqs.GetSequenceLength()) {
+      ++n_too_long;
+      return;
+    }
+    RunKSet(seqs, kset, only_genes, &best_scores, &total_scores, &total_score_errors, &best_genes);
+    ++n_run;
+    *total_score = AddInLogSpace(total_scores[kset], *total_score);  // sum up the probabilities for each kset, log P_tot = log \sum_i P_k_i
+    result.total_score_error_ = AddInLogSpace(total_score_errors[kset], result.total_score_error_);
+    if(args_->debug() == 2 && algorithm_ == "forward") printf("            %9.2f (%.1e)  tot: %7.2f\n", total_scores[kset], exp(total_scores[kset]), *total_score);
+    if(best_scores[kset] > best_score) {
+      best_score = best_scores[kset];
+      best_kset = kset;
+    }
+    if(algorithm_ != "forward" && best_scores[kset] != -INFINITY)  // add event to the vector in <result>
+      result.PushBackRecoEvent(FillRecoEvent(seqs, kset, best_genes[kset], best_scores[kset]));
+  };
+
+  bool climbed(false);
+  if(algorithm_ == "viterbi" && args_->climb_kspace()) {
+    ClimbKSpace(kbounds, run_kset, best_scores);
+    Result check(kbounds, args_->locus());  // if the best kset is on the boundary, the real best one could be anywhere, so we have to look everywhere
+    check.check_boundaries(best_kset, kbounds);
+    climbed = best_score != -INFINITY && !check.boundary_error();
+    if(args_->debug())
+      printf("      climbed k space: ran %zu of %zu ksets%s\n", ksets_tried.size(), (kbounds.vmax - kbounds.vmin) * (kbounds.dmax - kbounds.dmin), climbed ? "" : ", but ended up on the boundary so running the rest");
+  }
+  if(!climbed) {
+    for(size_t k_v = kbounds.vmax - 1; k_v >= kbounds.vmin; --k_v) {  // loop in reverse order to facilitate chunk caching: in principle we calculate V once the first time through, and after that can just copy over pieces of the first dp table (roughly the same for D and J)
+      for(size_t k_d = kbounds.dmax - 1; k_d >= kbounds.dmin; --k_d)
+	run_kset(KSet(k_v, k_d));
     }
   }
   if(args_->debug() && n_too_long > 0) cout << "      skipped " << n_too_long << " (of " << n_total << ") k sets 'cause they were longer than the sequence (ran " << n_run << ")" << endl;
@@ -127,7 +152,18 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     return result;
   }
 
-  if(algorithm_ == "viterbi")
+  if(algorithm_ == "viterbi" && args_->gene_prune_margin() >= 0.) {  // genes more than the margin below the best annotation may have been pruned at the ksets where they do best, so we don't know their support
+    double best_support(-INFINITY);  // NOTE same as <best_score>, except for rounding (it's added up in a different order)
+    for(auto &kv : per_gene_support_)
+      best_support = max(best_support, kv.second);
+    for(auto it = per_gene_support_.begin(); it != per_gene_support_.end(); ) {
+      if(it->second < best_support - args_->gene_prune_margin())
+	it = per_gene_support_.erase(it);
+      else
+	++it;
+    }
+  }
+  if(algorithm_ != "forward")
     result.Finalize(gl_, per_gene_support_, best_kset, kbounds);
 
   // print debug info
@@ -135,7 +171,7 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     double prob;
     string alg_str;
     char kstr[300];
-    if(algorithm_ == "viterbi") {
+    if(algorithm_ != "forward") {
       prob = best_score;
       alg_str = "vtb";
       sprintf(kstr, "%zu [%zu-%zu)  %zu [%zu-%zu)", best_kset.v, kbounds.vmin, kbounds.vmax, best_kset.d, kbounds.dmin, kbounds.dmax);
@@ -148,6 +184,8 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     printf("           %s %12.3f   %-25s  %2zuv %2zud %2zuj  %5.2fs   %s\n", alg_str.c_str(), prob, kstr,
 	   only_genes["v"].size(), only_genes["d"].size(), only_genes["j"].size(),  // hmms_.NameString(&only_genes, 30)
 	   cpu_seconds, seqs.name_str(":").c_str());
+    if(algorithm_ == "forward" && result.total_score_error() != -INFINITY)
+      printf("               pruned forward: relative error at most %.1e\n", exp(result.total_score_error() - *total_score));
 
     if(result.boundary_error()) {   // not necessarily a big deal yet -- the bounds get automatical expanded
       // cout << "             max at boundary:"
@@ -160,9 +198,6 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     }
   }
 
-  if(!args_->dont_rescale_emissions())  // if we rescaled them above, re-rescale the overall mean mute freqs
-    hmms_.UnRescaleOverallMuteFreqs(only_genes);
-
   return result;
 }
 
@@ -213,61 +248,295 @@ void DPHandler::PrintCachedTrellisSize() {
 }
 
 // ----------------------------------------------------------------------------------------
-void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin) {
-
-  Trellis *cached_trellis(nullptr);
-  if(!args_->no_chunk_cache()) {   // figure out if we've already got a trellis with a dp table which includes the one we're about to calculate (we should, unless this is the first kset)
-    // NOTE we're no longer looking through previously chunk cached cachefo here. Which I think is ok, but possible only because we loop over ksets in decreasing order (?)
-    for(auto &kv : scratch_cachefo_[gene]) {  // kv: (query string vector, trellis)
-      vector<string> cached_query_strs(kv.first);
-      if(cached_query_strs.size() != query_strs.size())  // have to have same number of sequences (it'd be much harder for this to happen now that I'm now reusing dphandlers)
-	continue;
+// Hill-climb over (k_v, k_d) from the middle of <kbounds>, which is where sw's best kset is: move to the best of the eight neighbors at distance <step>
+// until none of them is better, then halve the step. Since the sweep trellises cover every kset, the ksets that we run only cost us their lookups
+// and tracebacks (and a d sweep for each new k_v).
+void DPHandler::ClimbKSpace(KBounds kbounds, function<void(KSet)> run_kset, map<KSet, double> &best_scores) {
+  auto score = [&](KSet kset) { return best_scores.count(kset) > 0 ? best_scores[kset] : -INFINITY; };  // NOTE ksets that are too long for the sequence don't get an entry
+  KSet current((kbounds.vmin + kbounds.vmax - 1) / 2, (kbounds.dmin + kbounds.dmax - 1) / 2);
+  run_kset(current);
+  int step(1);
+  while(2 * step < (int)max(kbounds.vmax - kbounds.vmin, kbounds.dmax - kbounds.dmin))  // start with big steps if the bounds are wide
+    step *= 2;
+  for( ; step > 0; step /= 2) {
+    while(true) {
+      KSet best_neighbor(current);
+      for(int dv = -step; dv <= step; dv += step) {
+	for(int dd = -step; dd <= step; dd += step) {
+	  int k_v((int)current.v + dv), k_d((int)current.d + dd);
+	  if(k_v < (int)kbounds.vmin || k_v >= (int)kbounds.vmax || k_d < (int)kbounds.dmin || k_d >= (int)kbounds.dmax)
+	    continue;
+	  KSet neighbor(k_v, k_d);
+	  run_kset(neighbor);
+	  if(score(neighbor) > score(best_neighbor))
+	    best_neighbor = neighbor;
+	}
+      }
+      if(best_neighbor.equals(current))
+	break;
+      current = best_neighbor;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// subsequence [<start>, <start> + <length>) on which to run the sweep trellis that covers <kset> in <region> (see notes in dphandler.h)
+void DPHandler::GetSweepBounds(string region, KSet kset, size_t seq_length, size_t *start, size_t *length) {
+  size_t k_v(kset.v), k_d(kset.d);
+  if(region == "v") {
+    *start = 0;
+    *length = args_->no_chunk_cache() ? k_v : min(kbounds_.vmax - 1, seq_length);
+  } else if(region == "d") {
+    *start = k_v;
+    *length = args_->no_chunk_cache() ? k_d : min(kbounds_.dmax - 1, seq_length - k_v);
+  } else if(region == "j") {
+    *start = args_->no_chunk_cache() ? k_v + k_d : min(kbounds_.vmin + kbounds_.dmin, k_v + k_d);
+    *length = seq_length - *start;
+  } else {
+    assert(0);
+  }
+}
 
-      // loop over all the query strings for this trellis to see if they all match
-      bool found_match(true);
-      for(size_t iseq = 0; iseq < cached_query_strs.size(); ++iseq) {  // NOTE this starts to seem like it might be bottlenecking me when I'm applying it for short d sequences
-        if(cached_query_strs[iseq].find(query_strs[iseq]) != 0) {  // if <query_strs[iseq]> (the current query) doesn't appear starting at position zero in <cached_query_strs[iseq]> (a previously cached query), we'll need to recalculate
-          found_match = false;
-          break;
-        }
+// ----------------------------------------------------------------------------------------
+size_t DPHandler::SweepLength(string region, KSet kset, size_t seq_length) {
+  if(region == "v")
+    return kset.v;
+  else if(region == "d")
+    return kset.d;
+  else if(region == "j")
+    return seq_length - kset.v - kset.d;  // the j trellis is reversed, so its lengths are suffixes
+  else
+    assert(0);
+}
+
+// ----------------------------------------------------------------------------------------
+size_t DPHandler::SweepId(Sequences &seqs, size_t start, size_t length) {
+  pair<size_t, size_t> bounds(start, length);
+  auto it = sweep_ids_by_bounds_.find(bounds);
+  if(it != sweep_ids_by_bounds_.end())
+    return it->second;
+
+  vector<string> sweep_strs;
+  for(size_t iseq = 0; iseq < seqs.n_seqs(); ++iseq)
+    sweep_strs.push_back(seqs[iseq].undigitized().substr(start, length));
+  auto sit = sweep_ids_.find(sweep_strs);
+  if(sit == sweep_ids_.end())
+    sit = sweep_ids_.insert(pair<vector<string>, size_t>(sweep_strs, sweep_ids_.size())).first;
+  sweep_ids_by_bounds_[bounds] = sit->second;
+  return sit->second;
+}
+
+// ----------------------------------------------------------------------------------------
+// make sure each gene in <genes> has a sweep trellis on [<sweep_start>, <sweep_start> + <sweep_length>) of <seqs>, filling the new ones in parallel if we have more than one thread. Returns the genes whose trellises are new.
+set<string> DPHandler::FillSweepTrellises(string region, set<string> &genes, Sequences &seqs, size_t sweep_start, size_t sweep_length, size_t sweep_id) {
+  set<string> new_genes;
+  vector<string> new_gene_list;  // same order as <new_trellises>
+  vector<Trellis*> new_trellises;
+  for(auto &gene : genes) {
+    map<size_t, Trellis> &gene_trellises(scratch_cachefo_[gene]);
+    if(gene_trellises.count(sweep_id) > 0)
+      continue;
+    Model *hmm(GetHMM(gene));  // NOTE this can read the hmm file, so it has to be outside the threads
+    if(region == "j")
+      hmm = hmm->reversed();
+    gene_trellises[sweep_id] = Trellis(hmm, Sequences(seqs, sweep_start, sweep_length), nullptr, Emissions(gene));  // NOTE std::map doesn't move its elements, so these pointers are fine until we Clear()
+    new_trellises.push_back(&gene_trellises[sweep_id]);
+    new_gene_list.push_back(gene);
+    new_genes.insert(gene);
+  }
+
+  if((algorithm_ == "viterbi" && args_->gene_prune_margin() >= 0.) || (algorithm_ == "forward" && args_->forward_tolerance() > 0.))  // NOTE Args won't let you set --forward-tolerance with --scaled-forward, and Glomerator doesn't ask for "both" with it
+    RunPrunedTrellises(region, genes, new_gene_list, new_trellises, sweep_start, sweep_length, seqs.GetSequenceLength(), sweep_id);
+  else
+    RunTrellises(new_trellises);
+  return new_genes;
+}
+
+// ----------------------------------------------------------------------------------------
+// lengths at which RunKSet() will look up scores in the sweep trellis on [<sweep_start>, <sweep_start> + <sweep_length>) (see GetSweepBounds() and SweepLength())
+// NOTE the bounds can be a bit wider than the ksets we actually run, but never narrower
+void DPHandler::LookupLengthBounds(string region, size_t sweep_start, size_t sweep_length, size_t seq_length, size_t *min_length, size_t *max_length) {
+  if(args_->no_chunk_cache()) {  // one trellis per kset, so we only look at the end
+    *min_length = sweep_length;
+    *max_length = sweep_length;
+    return;
+  }
+  int vmin(kbounds_.vmin), vmax(kbounds_.vmax - 1), dmin(kbounds_.dmin), dmax(kbounds_.dmax - 1), length(seq_length);  // NOTE the maxes are inclusive here
+  int lmin(1), lmax(sweep_length);
+  if(region == "v") {
+    lmin = vmin;
+    lmax = min(vmax, length - dmin - 1);  // have to leave room for d and j
+  } else if(region == "d") {
+    lmin = dmin;
+    lmax = min(dmax, length - (int)sweep_start - 1);
+  } else if(region == "j") {
+    lmin = max(1, length - vmax - dmax);
+    lmax = length - vmin - dmin;
+  } else {
+    assert(0);
+  }
+  *min_length = max(1, lmin);
+  *max_length = max(0, min((int)sweep_length, lmax));
+}
+
+// ----------------------------------------------------------------------------------------
+// Branch and bound over genes: run the most promising new gene(s) first, then run the rest only as far as they can still make a difference at one
+// of the lengths we'll look up, given the genes so far (see Trellis::SetPruneThresholds()):
+//   - viterbi: get within --gene-prune-margin of the best gene. So the best gene at each length (and its path) is the same as without pruning,
+//     but the other genes' scores are only right if they're at least the minimum we gave them (RunKSet() skips the ones that aren't).
+//   - forward: add more than a --forward-tolerance share of the total. Each gene's budget is split evenly over every partial sum that it could
+//     possibly drop, so the scores we get are lower bounds that are at most about that fraction too small (see Trellis::forward_error_log_prob()).
+void DPHandler::RunPrunedTrellises(string region, set<string> &genes, vector<string> &new_genes, vector<Trellis*> &new_trellises, size_t sweep_start, size_t sweep_length, size_t seq_length, size_t sweep_id) {
+  size_t min_length, max_length;
+  LookupLengthBounds(region, sweep_start, sweep_length, seq_length, &min_length, &max_length);
+  if(new_trellises.size() == 0 || min_length > max_length) {
+    RunTrellises(new_trellises);
+    return;
+  }
+
+  // sort the new genes by an optimistic bound on their score at the shortest length we'll look up (best first, so we hopefully find high minimums early)
+  vector<pair<double, size_t> > bounds;
+  for(size_t ig = 0; ig < new_trellises.size(); ++ig)
+    bounds.push_back(pair<double, size_t>(-AddWithMinusInfinities(log(GetHMM(new_genes[ig])->overall_prob()), new_trellises[ig]->BestCaseLogProb(min_length)), ig));  // negative, so the best one's first
+  sort(bounds.begin(), bounds.end());
+
+  // gene-corrected score at each length that the rest of the genes have to measure up to: the best so far (of the ones we know are right) for viterbi, or the total so far for forward
+  vector<double> ref_scores(sweep_length, -INFINITY);
+  auto update_ref_scores = [&](string gene, Trellis *trell) {
+    double gene_logprob(log(GetHMM(gene)->overall_prob()));
+    for(size_t length = min_length; length <= max_length; ++length) {
+      if(algorithm_ == "forward") {
+	ref_scores[length - 1] = AddInLogSpace(AddWithMinusInfinities(trell->ending_forward_log_prob(length), gene_logprob), ref_scores[length - 1]);  // NOTE only a lower bound if we pruned it, which is fine
+      } else {
+	double score(trell->ending_viterbi_log_prob(length));
+	if(score >= trell->viterbi_min_log_prob(length))
+	  ref_scores[length - 1] = max(ref_scores[length - 1], AddWithMinusInfinities(score, gene_logprob));
       }
+    }
+  };
+  bool have_scores(false);
+  for(auto &gene : genes) {  // genes that we've already run on this sweep
+    if(find(new_genes.begin(), new_genes.end(), gene) != new_genes.end())
+      continue;
+    update_ref_scores(gene, &scratch_cachefo_[gene][sweep_id]);
+    have_scores = true;
+  }
 
-      // if they all match, then use it
-      if(found_match) {
-	cached_trellis = &scratch_cachefo_[gene][cached_query_strs];  // will copy over the required chunk of the old trellis into a new trellis for the current query
-        break;
+  size_t n_threads(max((size_t)1, (size_t)args_->n_gene_threads())), ib(0);
+  if(!have_scores) {  // nothing to compare to yet, so run the first batch without pruning
+    vector<Trellis*> batch;
+    for( ; ib < min(n_threads, bounds.size()); ++ib)
+      batch.push_back(new_trellises[bounds[ib].second]);
+    RunTrellises(batch);
+    for(size_t jb = 0; jb < ib; ++jb)
+      update_ref_scores(new_genes[bounds[jb].second], new_trellises[bounds[jb].second]);
+  }
+
+  // then the rest in batches of one per thread, tightening the minimums after each batch
+  double log_n_pruned_genes(log(bounds.size() - ib));
+  while(ib < bounds.size()) {
+    size_t ib_start(ib);
+    vector<Trellis*> batch;
+    vector<vector<double> > min_log_probs;
+    for( ; ib < min(ib_start + n_threads, bounds.size()); ++ib) {
+      size_t ig(bounds[ib].second);
+      double gene_logprob(log(GetHMM(new_genes[ig])->overall_prob()));
+      double offset(-args_->gene_prune_margin());  // what we add to the reference score to get the minimum
+      if(algorithm_ == "forward")
+	offset = log(args_->forward_tolerance()) - log_n_pruned_genes - log(sweep_length * new_trellises[ig]->model()->n_states());  // NOTE we can't drop more than one partial sum for each state at each position
+      vector<double> mins(sweep_length, INFINITY);  // we don't care about lengths that we won't look up
+      for(size_t length = min_length; length <= max_length; ++length) {
+	double ref(ref_scores[length - 1]);
+	mins[length - 1] = ref == -INFINITY ? -INFINITY : ref + offset - gene_logprob;  // NOTE if <gene_logprob> is -inf this is +inf, which is fine since its corrected score is -inf anyway
       }
+      batch.push_back(new_trellises[ig]);
+      min_log_probs.push_back(mins);
     }
+    RunTrellises(batch, &min_log_probs);
+    for(size_t jb = ib_start; jb < ib; ++jb)
+      update_ref_scores(new_genes[bounds[jb].second], new_trellises[bounds[jb].second]);
   }
+}
 
-  Trellis tmptrell(hmms_.Get(gene), query_seqs, cached_trellis);  // NOTE chunk cached trellisi don't get kept around -- we should be able to always just go back to the original one
-  Trellis *trell(&tmptrell);  // convenience pointer
-  if(cached_trellis == nullptr) {   // if we didn't find a suitable chunk cached trellis
-    scratch_cachefo_[gene][query_strs] = Trellis(hmms_.Get(gene), query_seqs);
-    trell = &scratch_cachefo_[gene][query_strs];
-    origin = "scratch";
-  } else {
-    origin = "chunk";
+// ----------------------------------------------------------------------------------------
+// NOTE each trellis only touches its own tables (and reads its model), so the threads don't need to share anything, and since we only look up scores after
+// they've all finished, the order in which they finish doesn't matter
+void DPHandler::RunTrellises(vector<Trellis*> &trellises, vector<vector<double> > *min_log_probs) {
+  size_t n_threads(min((size_t)args_->n_gene_threads(), trellises.size()));
+  if(n_threads <= 1) {
+    for(size_t itrell = 0; itrell < trellises.size(); ++itrell)
+      RunAlgorithm(trellises[itrell], min_log_probs ? &min_log_probs->at(itrell) : nullptr);
+    return;
   }
 
-  // run the actual dp algorithms
-  double uncorrected_score;  // still need to tack on the gene choice prob to this score
+  atomic<size_t> inext(0);
+  vector<exception_ptr> exceptions(n_threads);
+  vector<thread> threads;
+  for(size_t ithread = 0; ithread < n_threads; ++ithread) {
+    threads.push_back(thread([&, ithread]() {
+      try {
+	for(size_t itrell = inext++; itrell < trellises.size(); itrell = inext++)  // each thread grabs the next unfilled trellis until there aren't any left
+	  RunAlgorithm(trellises[itrell], min_log_probs ? &min_log_probs->at(itrell) : nullptr);
+      } catch(...) {
+	exceptions[ithread] = current_exception();
+      }
+    }));
+  }
+  for(auto &thr : threads)
+    thr.join();
+  for(auto &exc : exceptions) {
+    if(exc)
+      rethrow_exception(exc);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+Model *DPHandler::GetHMM(string gene) {
+  auto it(models_.find(gene));
+  if(it == models_.end())
+    it = models_.insert(pair<string, Model*>(gene, hmms_.Get(gene))).first;
+  return it->second;
+}
+
+// ----------------------------------------------------------------------------------------
+EmissionTable *DPHandler::Emissions(string gene) {
+  auto it(emissions_.find(gene));
+  if(it == emissions_.end())  // we didn't rescale this gene
+    return GetHMM(gene)->emissions();
+  return it->second.get();
+}
+
+// ----------------------------------------------------------------------------------------
+void DPHandler::RunAlgorithm(Trellis *trell, vector<double> *min_log_probs) {
   if(algorithm_ == "viterbi") {
-    trell->Viterbi();
-    uncorrected_score = trell->ending_viterbi_log_prob();
-    paths_[gene][kset] = TracebackPath(hmms_.Get(gene));
-    if(uncorrected_score != -INFINITY)   // if there's a valid path
-      trell->Traceback(paths_[gene][kset]);
+    trell->Viterbi(min_log_probs);
   } else if(algorithm_ == "forward") {
-    trell->Forward();
-    uncorrected_score = trell->ending_forward_log_prob();
+    if(args_->scaled_forward())
+      trell->ScaledForward();
+    else
+      trell->Forward(min_log_probs);
+  } else if(algorithm_ == "both") {
+    if(args_->scaled_forward()) {  // no fused version of this one
+      trell->Viterbi();
+      trell->ScaledForward();
+    } else {
+      trell->ViterbiAndForward();
+    }
   } else {
     assert(0);
   }
+}
 
-  // correct the score for gene choice probs
-  double gene_choice_score = log(hmms_.Get(gene)->overall_prob());
-  scores_[gene][kset] = AddWithMinusInfinities(uncorrected_score, gene_choice_score);
+// ----------------------------------------------------------------------------------------
+// get the viterbi path for <gene> on <query_seqs> from its sweep trellis
+void DPHandler::FillPath(string gene, KSet kset, Sequences &query_seqs, Trellis *sweep_trellis) {
+  if(paths_[gene].count(kset) > 0)
+    return;
+  paths_[gene][kset] = TracebackPath(GetHMM(gene));
+  Trellis trell(sweep_trellis->model(), query_seqs, sweep_trellis);  // NOTE this doesn't calculate anything, it just uses the sweep trellis's tables
+  trell.Viterbi();
+  if(trell.ending_viterbi_log_prob() != -INFINITY)   // if there's a valid path
+    trell.Traceback(paths_[gene][kset]);
 }
 
 // ----------------------------------------------------------------------------------------
@@ -371,42 +640,15 @@ vector<string> DPHandler::GetQueryStrs(Sequences &seqs, KSet kset, string region
 }
 
 // ----------------------------------------------------------------------------------------
-KSet DPHandler::FindPartialCacheMatch(string region, string gene, KSet kset) {
-  // this is just to avoid having to store all the query string vectors (they get big)
-  if(scores_[gene].find(kset) != scores_[gene].end())  // the exact same kset shouldn't actually be in there (except maybe if we're rerunning with expanded boundaries?) but I think we may as well check
-    return kset;
-  if(region == "v") {
-    for(auto &kv : scores_[gene]) {  // kv: (KSet, double)
-      if(kv.first.v == kset.v)  // for v, we just need k_v to be the same
-	return kv.first;
-    }
-  } else if(region == "j") {
-    for(auto &kv : scores_[gene]) {  // kv: (KSet, double)
-      if(kv.first.v + kv.first.d == kset.v + kset.d)  // for j, we need k_v and k_d to sum to the same thing
-	return kv.first;
-    }
-  }
-
-  return KSet(0, 0);
-}
-
-// ----------------------------------------------------------------------------------------
-void DPHandler::InitCache(string gene) {
-  if(scores_.find(gene) == scores_.end()) {
-    scratch_cachefo_[gene] = map<vector<string>, Trellis>();
-    paths_[gene] = map<KSet, TracebackPath>();
-    scores_[gene] = map<KSet, double>();
-  }
-}
-
-// ----------------------------------------------------------------------------------------
-void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes) {
+void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, double> *total_score_errors, map<KSet, map<string, string> > *best_genes) {
   map<string, Sequences> subseqs(GetSubSeqs(seqs, kset));
   (*best_scores)[kset] = -INFINITY;
   (*total_scores)[kset] = -INFINITY;  // total log prob of this kset, i.e. log(P_v * P_d * P_j), where e.g. P_v = \sum_i P(v_i k_v)
+  (*total_score_errors)[kset] = -INFINITY;
   (*best_genes)[kset] = map<string, string>();
   map<string, double> regional_best_scores; // the best score for each region
   map<string, double> regional_total_scores; // the total score for each region, i.e. log P_v
+  map<string, double> regional_total_errors; // upper bound on how much we're missing from each region's total (if we pruned forward)
   map<string, double> per_gene_support_this_kset;
   if(args_->debug() == 2) {
     printf("         %3d%3d", (int)kset.v, (int)kset.d);
@@ -414,12 +656,18 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
       printf(" %6s %9s  %7s  %7s", "prob", "logprob", "total", "origin");
     printf(" %s\n", "---------------");
   }
+  map<string, Trellis*> best_gene_trellises;  // sweep trellis for the best gene in each region
   for(auto & region : gl_.regions_) {
     vector<string> query_strs(GetQueryStrs(seqs, kset, region));
+    size_t sweep_start, sweep_length;
+    GetSweepBounds(region, kset, seqs.GetSequenceLength(), &sweep_start, &sweep_length);
+    size_t sweep_id(SweepId(seqs, sweep_start, sweep_length));
+    size_t lookup_length(SweepLength(region, kset, seqs.GetSequenceLength()));
+    set<string> new_genes(FillSweepTrellises(region, only_genes[region], seqs, sweep_start, sweep_length, sweep_id));
 
     TermColors tc;
     if(args_->debug() == 2) {
-      if(algorithm_ == "viterbi") {
+      if(algorithm_ != "forward") {
         cout << "                " << region << " query " << tc.ColorChars(hmms_.track()->ambiguous_char()[0], "light_blue", query_strs[0]) << endl;
         for(size_t is = 1; is < query_strs.size(); ++is)
           cout << "                " << region << " query " << tc.ColorChars(hmms_.track()->ambiguous_char()[0], "light_blue", tc.ColorMutants("purple", query_strs[is], "", query_strs, hmms_.track()->ambiguous_char())) << endl;  // use the first query_str as reference sequence... could just as well use any other
@@ -430,25 +678,26 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
 
     regional_best_scores[region] = -INFINITY;
     regional_total_scores[region] = -INFINITY;
+    regional_total_errors[region] = -INFINITY;
     for(auto & gene : only_genes[region]) {
-      InitCache(gene);
-      string origin;
-      KSet partial_cache_match(FindPartialCacheMatch(region, gene, kset));  // "partial" in the sense that only this region's query sequence(s) need to be the same
-      if(!partial_cache_match.isnull()) {  // first see if we have a match for these exact strings
-	paths_[gene][kset] = paths_[gene][partial_cache_match];
-	scores_[gene][kset] = scores_[gene][partial_cache_match];
-	// NOTE that we don't put anything about this gene/kset combo into the trellis caches. Which is fine now, since later we'll only need the path and score info
-	origin = "cached";
-      } else {  // no exact cache match, so proceed to check for chunk caching (if that fails it'll actually calculate things)
-	FillTrellis(kset, subseqs[region], query_strs, gene, origin);
-      }
-
-      double gene_score(scores_[gene][kset]);  // convenience variable
-      if(args_->debug() == 2 && algorithm_ == "viterbi")
+      string origin(new_genes.count(gene) > 0 ? "scratch" : "chunk");
+      Trellis *trell(&scratch_cachefo_[gene][sweep_id]);
+      double uncorrected_score(algorithm_ == "forward" ? trell->ending_forward_log_prob(lookup_length) : trell->ending_viterbi_log_prob(lookup_length));
+      if(algorithm_ == "viterbi" && uncorrected_score < trell->viterbi_min_log_prob(lookup_length))  // we pruned this gene here, i.e. it's too far below the best one to matter (see RunPrunedTrellises())
+        continue;
+      double gene_score(AddWithMinusInfinities(uncorrected_score, log(GetHMM(gene)->overall_prob())));  // correct the score for gene choice probs
+      double gene_total_score(gene_score);  // what we add to the regional total (for "both", the forward score, so the total is the same as for "forward")
+      if(algorithm_ == "both")
+        gene_total_score = AddWithMinusInfinities(trell->ending_forward_log_prob(lookup_length), log(GetHMM(gene)->overall_prob()));
+      if(args_->debug() == 2 && algorithm_ != "forward") {
+        FillPath(gene, kset, subseqs[region], trell);
         PrintPath(kset, query_strs, gene, gene_score, origin);
+      }
 
       // add this score to the regional total score
-      regional_total_scores[region] = AddInLogSpace(gene_score, regional_total_scores[region]);  // (log a, log b) --> log a+b, i.e. here we are summing probabilities in log space, i.e. a *or* b
+      regional_total_scores[region] = AddInLogSpace(gene_total_score, regional_total_scores[region]);  // (log a, log b) --> log a+b, i.e. here we are summing probabilities in log space, i.e. a *or* b
+      if(algorithm_ == "forward")
+	regional_total_errors[region] = AddInLogSpace(AddWithMinusInfinities(trell->forward_error_log_prob(lookup_length), log(GetHMM(gene)->overall_prob())), regional_total_errors[region]);
       if(args_->debug() == 2 && algorithm_ == "forward")
         printf("                %6.0e %9.2f  %7.2f  %s  %s\n", exp(gene_score), gene_score, regional_total_scores[region], origin.c_str(), tc.ColorGene(gene).c_str());
 
@@ -456,6 +705,7 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
       if(gene_score > regional_best_scores[region]) {
         regional_best_scores[region] = gene_score;
         (*best_genes)[kset][region] = gene;
+        best_gene_trellises[region] = trell;
       }
 
       // watch this space for something pithy
@@ -470,13 +720,28 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
     }
   }
 
+  if(algorithm_ != "forward") {  // we only need the paths for the best genes (see FillRecoEvent())
+    for(auto &region : gl_.regions_)
+      FillPath((*best_genes)[kset][region], kset, subseqs[region], best_gene_trellises[region]);
+  }
+
   // store the results
   (*best_scores)[kset] = AddWithMinusInfinities(regional_best_scores["v"], AddWithMinusInfinities(regional_best_scores["d"], regional_best_scores["j"]));  // i.e. best_prob = v_prob * d_prob * j_prob (v *and* d *and* j)
   (*total_scores)[kset] = AddWithMinusInfinities(regional_total_scores["v"], AddWithMinusInfinities(regional_total_scores["d"], regional_total_scores["j"]));
+  bool pruned_forward(regional_total_errors["v"] != -INFINITY || regional_total_errors["d"] != -INFINITY || regional_total_errors["j"] != -INFINITY);  // NOTE if we didn't drop anything, the error is zero (but calculating it below would give us rounding noise)
+  if(algorithm_ == "forward" && pruned_forward) {  // each regional total could be too small by up to its error, so the kset's total could be too small by up to (P_v + E_v)(P_d + E_d)(P_j + E_j) - P_v P_d P_j
+    double upper_score(0.);
+    for(auto &region : gl_.regions_)
+      upper_score = AddWithMinusInfinities(upper_score, AddInLogSpace(regional_total_scores[region], regional_total_errors[region]));
+    if(upper_score > (*total_scores)[kset])
+      (*total_score_errors)[kset] = (*total_scores)[kset] == -INFINITY ? upper_score : upper_score + log(-expm1((*total_scores)[kset] - upper_score));
+  }
 
   // work out per-gene support
   for(auto &region : gl_.regions_) {  // we have to do this in a separate loop because we need to know what the regional_best_scores are for the other regions
     for(auto &gene : only_genes[region]) {
+      if(per_gene_support_this_kset.count(gene) == 0)  // pruned
+	continue;
       // first multiply the prob for this kset by the *total* for the other two regions
       double score_this_kset(0);  // not -INFINITY, since we're multiplying probabilities
       for(auto &tmpreg : gl_.regions_) {
@@ -14,11 +14,10 @@ Emission::~Emission() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Emission::Parse(YAML::Node config, Track *track) {
+void Emission::Init(vector<double> probs, Track *track) {
   track_ = track;
   scores_.Init(track_);
 
-  YAML::Node probs(config["probs"]);
   if(probs.size() != track_->alphabet_size())
     throw runtime_error("ERROR emission probabilities (" + to_string(probs.size()) + ") not the same length as the alphavet passed to lexical table constructor (" + to_string(track_->alphabet_size()) + "). Yes, a v! Hobgoblins and smallness, yo.");
   if(scores_.track()->alphabet_size() != track_->alphabet_size())
@@ -26,13 +25,14 @@ void Emission::Parse(YAML::Node config, Track *track) {
   vector<double> log_probs;
   total_ = 0.0; // make sure things add to 1.0
   for(size_t ip = 0; ip < track_->alphabet_size(); ++ip) {
-    double prob(probs[track_->symbol(ip)].as<double>());  // NOTE probs are stored as dicts in the file, so <probs> is unordered
-    log_probs.push_back(log(prob));
-    total_ += prob;
+    log_probs.push_back(log(probs[ip]));
+    total_ += probs[ip];
   }
   if(fabs(total_ - 1.0) >= EPS) { // make sure emissions probs sum to 1.0
-    cerr << "ERROR normalization failed for emissions:" << endl;
-    cerr << config << endl;
+    cerr << "ERROR normalization failed for emissions:";
+    for(auto &prob : probs)
+      cerr << " " << prob;
+    cerr << endl;
     throw runtime_error("configuration");
   }
   scores_.SetLogProbs(log_probs);  // NOTE <log_probs> must already be logged
@@ -3,11 +3,12 @@
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track) :
+Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track, GlomCache *warm_cache) :
   track_(track),
   args_(args),
   gl_(gl),
   hmms_(hmms),
+  warm_cache_(warm_cache),
   n_fwd_calculated_(0),
   n_vtb_calculated_(0),
   n_hfrac_calculated_(0),
@@ -15,27 +16,33 @@ Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> >
   n_lratio_merges_(0),
   asym_factor_(4.),
   force_merge_(false),
+  candidates_initialized_(false),
+  newest_cluster_(NO_CLUSTER),
+  hfrac_candidates_(CandidateOrder(&cluster_index_)),
+  unevaluated_candidates_(CandidateOrder(&cluster_index_)),
+  lratio_candidates_(CandidateOrder(&cluster_index_)),
   current_partition_(nullptr),
   progress_file_(fopen((args_->outfile() + ".progress").c_str(), "w"))
 {
   time(&last_status_write_time_);
   ReadCacheFile();
 
+  for(auto &seq_vec : qry_seq_list)
+    for(auto &seq : seq_vec)
+      single_seqs_[cluster_index_.UidIndex(seq.name())] = seq;
+
   for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
-    string key = SeqNameStr(qry_seq_list[iqry], ":");
+    ClusterId key = cluster_index_.Intern(SeqNameStr(qry_seq_list[iqry], ":"));  // NOTE this is the only place (besides reading the cache file) where we make clusters from name strings
     KSet kmin(args_->integers_["k_v_min"][iqry], args_->integers_["k_d_min"][iqry]);
     KSet kmax(args_->integers_["k_v_max"][iqry], args_->integers_["k_d_max"][iqry]);
 
     initial_partition_.insert(key);
 
-    for(auto &seq_vec : qry_seq_list)
-      for(auto &seq : seq_vec)
-	single_seqs_[seq.name()] = seq;
-
-    for(auto &uid : SplitString(key)) {
-      single_seq_cachefo_[uid] = Query(uid,  // NOTE these are not necessarily the same as they would be (well, were) for the single seqs -- e.g. only_genes is now the OR for all the sequences
+    for(auto &iuid : cluster_index_.members(key)) {
+      ClusterId uid(cluster_index_.Intern(cluster_index_.uid(iuid)));
+      single_seq_cachefo_[iuid] = Query(uid,  // NOTE these are not necessarily the same as they would be (well, were) for the single seqs -- e.g. only_genes is now the OR for all the sequences
 				       GetSeqs(uid),
-				       !InString(args_->seed_unique_id(), uid),
+				       !HasSeed(uid),
 				       args_->str_lists_["only_genes"][iqry],
 				       KBounds(kmin, kmax),
 				       args_->floats_["mut_freq"][iqry],
@@ -44,7 +51,7 @@ Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> >
 
     cachefo_[key] = Query(key,
 			  GetSeqs(key),
-			  !InString(args_->seed_unique_id(), key),
+			  !HasSeed(key),
 			  args_->str_lists_["only_genes"][iqry],
 			  KBounds(kmin, kmax),
 			  args_->floats_["mut_freq"][iqry],
@@ -60,6 +67,7 @@ Glomerator::~Glomerator() {
   WriteCacheFile();
   fclose(progress_file_);
   remove((args_->outfile() + ".progress").c_str());
+  // NOTE then <warm_cache_loan_> hands everything back to <warm_cache_> (it's got everything that was in there, plus whatever we read or calculated)
 
 // // ----------------------------------------------------------------------------------------
 //   runps();
@@ -112,8 +120,32 @@ void Glomerator::Cluster() {
 
 // ----------------------------------------------------------------------------------------
 void Glomerator::ReadCacheFile() {
+  if(warm_cache_) {  // NOTE these have full double precision, whereas the ones from the file only get float precision
+    string settings(WarmCacheSettings());
+    if(warm_cache_->settings_ != settings) {  // it was calculated with different options, so we can't use any of it
+      if(warm_cache_->log_probs_.size() > 0 || warm_cache_->naive_seqs_.size() > 0)
+	cout << "        clearing warm cache (calculated with different options)" << endl;
+      warm_cache_->Clear();
+      warm_cache_->settings_ = settings;
+    }
+    warm_cache_loan_.Start(warm_cache_, [this](GlomCache &cache) {  // NOTE the warm cache is empty until the loan swaps them back
+	swap(cluster_index_, cache.cluster_index_);
+	log_probs_.swap(cache.log_probs_);
+	naive_hfracs_.swap(cache.naive_hfracs_);
+	naive_seqs_.swap(cache.naive_seqs_);
+	errors_.swap(cache.errors_);
+	failed_queries_.swap(cache.failed_queries_);
+      });
+    for(auto &kv : log_probs_)
+      initial_log_probs_.insert(kv.first);
+    for(auto &kv : naive_hfracs_)
+      initial_naive_hfracs_.insert(kv.first);
+    for(auto &kv : naive_seqs_)
+      initial_naive_seqs_.insert(kv.first);
+  }
+
   if(args_->input_cachefname() == "") {
-    cout << "        read-cache:  logprobs 0   naive-seqs 0" << endl;
+    cout << "        read-cache:  logprobs " << log_probs_.size() << "   naive-seqs " << naive_seqs_.size() << endl;
     return;
   }
 
@@ -138,9 +170,14 @@ void Glomerator::ReadCacheFile() {
   // NOTE there can be two lines with the same key (say if in one run we calculated the naive seq, and in a later run calculated the log prob)
   while(getline(ifs, line)) {
     line.erase(remove(line.begin(), line.end(), '\r'), line.end());
+    if(warm_cache_) {  // skip the (relatively slow) parsing if we've already got everything this line could tell us
+      ClusterId query(cluster_index_.Intern(line.substr(0, line.find(','))));
+      if(failed_queries_.count(query) || (log_probs_.count(query) && naive_seqs_.count(query)))
+	continue;
+    }
     vector<string> column_list = SplitString(line, ",");
     assert(column_list.size() == 5);
-    string query(column_list[0]);
+    ClusterId query(cluster_index_.Intern(column_list[0]));
     string errors(column_list[4]);
     if(errors.find("no_path") != string::npos) {
       failed_queries_.insert(query);
@@ -170,8 +207,17 @@ void Glomerator::ReadCacheFile() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Glomerator::WriteCacheLine(ofstream &ofs, string query) {
-  ofs << query << ",";
+// the options that change the log probs and naive seqs that we calculate (so a job with different ones can't use what's in <warm_cache_>)
+// NOTE the ones that are set when the worker starts (hmms, germlines, emission rescaling...) are the same for every job
+string Glomerator::WarmCacheSettings() {
+  ostringstream oss;
+  oss << setprecision(20) << args_->dont_rescale_emissions() << " " << args_->scaled_forward() << " " << args_->forward_tolerance() << " " << args_->climb_kspace();
+  return oss.str();
+}
+
+// ----------------------------------------------------------------------------------------
+void Glomerator::WriteCacheLine(ofstream &ofs, ClusterId query) {
+  ofs << cluster_index_.name(query) << ",";
   if(log_probs_.count(query))
     ofs << log_probs_[query];
   ofs << ",";
@@ -198,7 +244,7 @@ void Glomerator::WriteCacheFile() {
   log_prob_ofs << "unique_ids,logprob,naive_seq,naive_hfrac,errors" << endl;
   log_prob_ofs << setprecision(20);
 
-  set<string> keys_to_cache;
+  set<ClusterId> keys_to_cache;
   for(auto &kv : log_probs_) {
     if(args_->only_cache_new_vals() && initial_log_probs_.count(kv.first))  // don't cache it if we had it in the initial cache file (this is just an optimization)
       continue;
@@ -217,7 +263,7 @@ void Glomerator::WriteCacheFile() {
     }
   }
 
-  for(auto &key : keys_to_cache)
+  for(auto &key : SortByName(keys_to_cache))
     WriteCacheLine(log_prob_ofs, key);
 
   log_prob_ofs.close();
@@ -238,10 +284,10 @@ void Glomerator::WritePartitions(ClusterPath &cp) {
     if(args_->write_logprob_for_each_partition())  // only want to calculate this the last time through, i.e. when we're only one process NOTE this calculation can change the clustering (if we did an hfrac merge that logprob thinks we shouldn't have merged, when the python reads the partitions it'll notice this and choose the unmerged partition)
       cp.set_logprob(ipart, LogProbOfPartition(cp.partitions()[ipart]));
     int ic(0);
-    for(auto &cluster : cp.partitions()[ipart]) {
+    for(auto &cluster : SortByName(cp.partitions()[ipart])) {
       if(ic > 0)
 	ofs_ << ";";
-      ofs_ << cluster;
+      ofs_ << cluster_index_.name(cluster);
       ++ic;
     }
     ofs_ << "," << cp.logprobs()[ipart] << endl;
@@ -261,7 +307,7 @@ void Glomerator::WriteAnnotations(ClusterPath &cp) {
   StreamHeader(annotation_ofs, "viterbi");
 
   // NOTE we're no longer calculating the logprob for *every* partition, but in Glomerator::WritePartitions() we *do* calculate them if we're told to (i.e. the last time through), and this can make it so the last partition isn't the most likely
-  for(auto &cluster : cp.partitions()[cp.i_best()]) {
+  for(auto &cluster : SortByName(cp.partitions()[cp.i_best()])) {
     if(args_->seed_unique_id() != "" && SeedMissing(cluster))
       continue;
 
@@ -269,7 +315,7 @@ void Glomerator::WriteAnnotations(ClusterPath &cp) {
     CalculateNaiveSeq(GetNaiveSeqNameToCalculate(cluster), &event);  // calculate the viterbi path from scratch to get the <event> set (should probably at some point start caching the events earlier)
 
     if(event.genes_["d"] == "") {  // shouldn't happen any more, but it is a check that could fail at some point
-      cout << "WTF " << cluster << " x" << event.naive_seq_ << "x" << endl;
+      cout << "WTF " << cluster_index_.name(cluster) << " x" << event.naive_seq_ << "x" << endl;
       assert(0);
     }
     StreamViterbiOutput(annotation_ofs, event, cachefo(cluster).seqs_, "");
@@ -284,10 +330,10 @@ double Glomerator::LogProbOfPartition(Partition &partition, bool debug) {
   double total_log_prob(0.0);
   if(debug)
     cout << "LogProbOfPartition: " << endl;
-  for(auto &key : partition) {
+  for(auto &key : SortByName(partition)) {  // (sorted just so the additions happen in the same order as they used to)
     double log_prob = GetLogProb(key);  // NOTE do *not* do any translation here -- we need the actual probability of the whole partition, to compare to the other partitions, so we need each and every sequence in each cluster (i.e. if you wanted to do translation, you'd have to coordinate the ignored sequences among the different partitions)
     if(debug)
-      cout << "  " << log_prob << "  " << key << endl;
+      cout << "  " << log_prob << "  " << cluster_index_.name(key) << endl;
     total_log_prob = AddWithMinusInfinities(total_log_prob, log_prob);
   }
   if(debug)
@@ -299,8 +345,8 @@ double Glomerator::LogProbOfPartition(Partition &partition, bool debug) {
 void Glomerator::PrintPartition(Partition &partition, string extrastr) {
   const char *extra_cstr(extrastr.c_str());  // dammit I shouldn't need this line
   printf("    %-8.2f %s partition\n", -INFINITY/*LogProbOfPartition(partition)*/, extra_cstr);
-  for(auto &key : partition)
-    cout << "          " << key << endl;
+  for(auto &key : SortByName(partition))
+    cout << "          " << cluster_index_.name(key) << endl;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -347,21 +393,14 @@ void Glomerator::WriteStatus() {
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::ParentalString(pair<string, string> *parents) {
+string Glomerator::ParentalString(pair<ClusterId, ClusterId> *parents) {
   if(CountMembers(parents->first) > 5 || CountMembers(parents->second) > 5) {
     return to_string(CountMembers(parents->first)) + " and " + to_string(CountMembers(parents->second));
   } else {
-    return parents->first + " and " + parents->second;
+    return cluster_index_.name(parents->first) + " and " + cluster_index_.name(parents->second);
   }
 }
 
-// ----------------------------------------------------------------------------------------
-// count the number of members in a cluster's colon-separated name string
-int Glomerator::CountMembers(string namestr) {
-  int n_colons = (int)count(namestr.begin(), namestr.end(), ':');
-  return n_colons + 1;
-}
-
 // ----------------------------------------------------------------------------------------
 // count the number of members in a cluster's colon-separated name string
 unsigned Glomerator::LargestClusterSize(Partition &partition) {
@@ -394,10 +433,10 @@ string Glomerator::ClusterSizeString(Partition *partition) {
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::JoinNames(string name1, string name2, string delimiter) {
-  vector<string> names{name1, name2};
-  sort(names.begin(), names.end());  // NOTE this doesn't sort *within* name1 or name2 when they're already comprised of several uids. In principle this will lead to unnecessary cache misses (if we later arrive at the same combination of sequences from a different starting point). In practice, this is very unlikely (unless we're dong smc) since we've already merged the constituents of name1 and name2 and we can't unmerge them.
-  return names[0] + delimiter + names[1];
+vector<ClusterId> Glomerator::SortByName(const set<ClusterId> &clusters) {
+  vector<ClusterId> sorted_clusters(clusters.begin(), clusters.end());
+  sort(sorted_clusters.begin(), sorted_clusters.end(), [this](ClusterId id_a, ClusterId id_b) { return cluster_index_.name(id_a) < cluster_index_.name(id_b); });
+  return sorted_clusters;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -423,15 +462,20 @@ string Glomerator::JoinSeqStrings(vector<Sequence*> &strlist, string delimiter)
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::PrintStr(string queries) {
+string Glomerator::PrintStr(ClusterId queries) {
   if(CountMembers(queries) < 10)
-    return queries;
+    return cluster_index_.name(queries);
   else
     return "len(" + to_string(CountMembers(queries)) + ")";
 }
 
 // ----------------------------------------------------------------------------------------
-bool Glomerator::SeedMissing(string queries) {
+bool Glomerator::HasSeed(ClusterId queries) {
+  return args_->seed_unique_id() != "" && cluster_index_.Contains(queries, cluster_index_.UidIndex(args_->seed_unique_id()));
+}
+
+// ----------------------------------------------------------------------------------------
+bool Glomerator::SeedMissing(ClusterId queries) {
   return cachefo(queries).seed_missing_;  // NOTE after refactoring the double loops, we probably don't really need to cache all these any more
   // set<string> queryset(SplitString(queries, delimiter));  // might be faster to look for :uid: and uid: and... hm, wait, that's kind of hard
   // return !InString(args_->seed_unique_id(), queries,  delimiter);
@@ -445,54 +489,55 @@ bool Glomerator::SeedMissing(string queries) {
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::CalculateHfrac(string &seq_a, string &seq_b) {
+double Glomerator::CalculateHfrac(ClusterId key_a, ClusterId key_b) {
   ++n_hfrac_calculated_;
+  string &seq_a = GetNaiveSeq(key_a);
+  string &seq_b = GetNaiveSeq(key_b);
   if(seq_a.size() != seq_b.size())
     throw runtime_error("sequences different length in Glomerator::NaiveHfrac\n    " + to_string(seq_a.size()) + ": " + seq_a + "\n    " + to_string(seq_b.size()) + ": " + seq_b + "\n");
-  int distance(0), len_excluding_ambigs(0);
-  for(size_t ic=0; ic<seq_a.size(); ++ic) {
-    uint8_t ch_a = track_->symbol_index(seq_a.substr(ic, 1));  // kind of hackey remnant left from when naive seqs were Sequence objects
-    uint8_t ch_b = track_->symbol_index(seq_b.substr(ic, 1));
-    if(ch_a == track_->ambiguous_index() || ch_b == track_->ambiguous_index())  // skip this position if either sequence has an ambiguous character (if not set, ambig-base should be the empty string)
-      continue;
-    ++len_excluding_ambigs;
-    if(ch_a != ch_b)
-      ++distance;
-  }
+  unsigned distance(0), len_excluding_ambigs(0);  // NOTE positions where either sequence has an ambiguous character are skipped (if not set, ambig-base should be the empty string)
+  GetPackedNaiveSeq(key_a).HammingDistance(GetPackedNaiveSeq(key_b), distance, len_excluding_ambigs);
 
   return distance / double(len_excluding_ambigs);
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::NaiveHfrac(string key_a, string key_b) {
-  string joint_key = JoinNames(key_a, key_b);  // NOTE since the cache is indexed by the joint key, this assumes we can arrive at this cluster via only one path. Which should be ok.
+PackedSeq &Glomerator::GetPackedNaiveSeq(ClusterId queries) {
+  if(packed_naive_seqs_.count(queries) == 0)
+    packed_naive_seqs_[queries] = PackedSeq(track_, GetNaiveSeq(queries));
+  return packed_naive_seqs_[queries];
+}
+
+// ----------------------------------------------------------------------------------------
+double Glomerator::NaiveHfrac(ClusterId key_a, ClusterId key_b) {
+  ClusterId joint_key = cluster_index_.Join(key_a, key_b);  // NOTE since the cache is indexed by the joint key, this assumes we can arrive at this cluster via only one path. Which should be ok.
   if(naive_hfracs_.count(joint_key))  // if we've already calculated this distance
     return naive_hfracs_[joint_key];
 
-  string &seq_a = GetNaiveSeq(key_a);
-  string &seq_b = GetNaiveSeq(key_b);
+  GetNaiveSeq(key_a);  // make sure we've tried to calculate them, so we know if they failed
+  GetNaiveSeq(key_b);
   double hfrac(INFINITY);
   if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
     return hfrac;
-  naive_hfracs_[joint_key] = CalculateHfrac(seq_a, seq_b);
+  naive_hfracs_[joint_key] = CalculateHfrac(key_a, key_b);
 
   return naive_hfracs_[joint_key];
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::ChooseSubsetOfNames(string queries, int n_max) {
+ClusterId Glomerator::ChooseSubsetOfNames(ClusterId queries, int n_max) {
   if(name_subsets_.count(queries))
     return name_subsets_[queries];
 
   // assert(seq_info_.count(queries) || tmp_cachefo_.count(queries));
-  vector<string> namevector(SplitString(queries, ":"));
+  const vector<unsigned> &namevector(cluster_index_.members(queries));
 
-  srand(hash<string>{}(queries));  // make sure we get the same subset each time we pass in the same queries (well, if there's different thresholds for naive_seqs annd logprobs they'll each get their own [very correlated] subset)
+  srand(hash<string>{}(cluster_index_.name(queries)));  // make sure we get the same subset each time we pass in the same queries (well, if there's different thresholds for naive_seqs annd logprobs they'll each get their own [very correlated] subset)
 
   // first decide which indices we'll choose
   set<int> ichosen;
   vector<int> ichosen_vec;  // don't really need both of these... but maybe it's faster
-  set<string> chosen_strs;  // make sure we don't choose seed unique id more than once
+  set<unsigned> chosen_strs;  // make sure we don't choose seed unique id more than once
   for(size_t iname=0; iname<unsigned(n_max); ++iname) {
     int ich(-1);
     int n_tries(0);
@@ -515,27 +560,27 @@ string Glomerator::ChooseSubsetOfNames(string queries, int n_max) {
   // and finally make the new vectors
   vector<string> subqueryvec;
   for(auto &ich : ichosen_vec)
-    subqueryvec.push_back(namevector[ich]);
+    subqueryvec.push_back(cluster_index_.uid(namevector[ich]));
 
-  string subqueries(JoinStrings(subqueryvec));
+  ClusterId subqueries(cluster_index_.Intern(JoinStrings(subqueryvec)));
 
   tmp_cachefo_[subqueries] = Query(subqueries,
 				   GetSeqs(subqueries),
-				   !InString(args_->seed_unique_id(), subqueries),
+				   !HasSeed(subqueries),
 				   cacheref.only_genes_,
 				   cacheref.kbounds_,
 				   cacheref.mute_freq_,
 				   cacheref.cdr3_length_);
 
   if(args_->debug())
-    cout << "                chose subset  " << queries << "  -->  " << subqueries << endl;
+    cout << "                chose subset  " << cluster_index_.name(queries) << "  -->  " << cluster_index_.name(subqueries) << endl;
 
   name_subsets_[queries] = subqueries;
   return subqueries;
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::GetNaiveSeqNameToCalculate(string actual_queries) {
+ClusterId Glomerator::GetNaiveSeqNameToCalculate(ClusterId actual_queries) {
   // NOTE we don't really need to cache the names like this, since we're setting the random seed when we choose a subset. But it just seems so messy to go through the whole subset calculation every time, even though I profiled it and it's not a significant contributor
   if(naive_seq_name_translations_.count(actual_queries))
     return naive_seq_name_translations_[actual_queries];
@@ -545,20 +590,20 @@ string Glomerator::GetNaiveSeqNameToCalculate(string actual_queries) {
     return actual_queries;
 
   // but if it's bigger than this, replace it with a subset of size N
-  string subqueries = ChooseSubsetOfNames(actual_queries, args_->biggest_naive_seq_cluster_to_calculate());
+  ClusterId subqueries = ChooseSubsetOfNames(actual_queries, args_->biggest_naive_seq_cluster_to_calculate());
   if(args_->debug() > 0)
-    cout << "                translate for naive seq  " << actual_queries << "  -->  " << subqueries << endl;
+    cout << "                translate for naive seq  " << cluster_index_.name(actual_queries) << "  -->  " << cluster_index_.name(subqueries) << endl;
 
   naive_seq_name_translations_[actual_queries] = subqueries;
   return subqueries;
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::GetLogProbNameToCalculate(string queries, int n_max) {
-  string queries_to_calc(queries);
+ClusterId Glomerator::GetLogProbNameToCalculate(ClusterId queries, int n_max) {
+  ClusterId queries_to_calc(queries);
   if(logprob_asymetric_translations_.count(queries)) {
     if(args_->debug())
-      cout << "             using asymetric translation  " << queries << "  -->  " << logprob_asymetric_translations_[queries] << endl;
+      cout << "             using asymetric translation  " << cluster_index_.name(queries) << "  -->  " << cluster_index_.name(logprob_asymetric_translations_[queries]) << endl;
     queries_to_calc = logprob_asymetric_translations_[queries];
   } 
 
@@ -570,7 +615,7 @@ string Glomerator::GetLogProbNameToCalculate(string queries, int n_max) {
 }
 
 // ----------------------------------------------------------------------------------------
-pair<string, string> Glomerator::GetLogProbPairOfNamesToCalculate(string actual_queries, pair<string, string> actual_parents) {
+pair<ClusterId, ClusterId> Glomerator::GetLogProbPairOfNamesToCalculate(ClusterId actual_queries, pair<ClusterId, ClusterId> actual_parents) {
   // NOTE we don't really need to cache the names like this, since we're setting the random seed when we choose a subset. But it just seems so messy to go through the whole subset calculation every time, even though I profiled it and it's not a significant contributor
   if(logprob_name_translations_.count(actual_queries))
     return logprob_name_translations_[actual_queries];
@@ -582,26 +627,26 @@ pair<string, string> Glomerator::GetLogProbPairOfNamesToCalculate(string actual_
     return actual_parents;
 
   // replace either/both parents as necessary
-  pair<string, string> queries_to_calc;
+  pair<ClusterId, ClusterId> queries_to_calc;
   queries_to_calc.first = GetLogProbNameToCalculate(actual_parents.first, n_max);  // note, no factor of 1.5, "since" this is more considering the lratio as a whole, and
   queries_to_calc.second = GetLogProbNameToCalculate(actual_parents.second, n_max);
 
   if(args_->debug())
-    printf("                translate for lratio (%s)   %s  %s  -->  %s  %s\n", actual_queries.c_str(), actual_parents.first.c_str(), actual_parents.second.c_str(), queries_to_calc.first.c_str(), queries_to_calc.second.c_str());
+    printf("                translate for lratio (%s)   %s  %s  -->  %s  %s\n", cluster_index_.name(actual_queries).c_str(), cluster_index_.name(actual_parents.first).c_str(), cluster_index_.name(actual_parents.second).c_str(), cluster_index_.name(queries_to_calc.first).c_str(), cluster_index_.name(queries_to_calc.second).c_str());
 
   logprob_name_translations_[actual_queries] = queries_to_calc;
   return queries_to_calc;
 }
 
 // ----------------------------------------------------------------------------------------
-bool Glomerator::FirstParentMuchBigger(string queries, string queries_other, int nmax) {
+bool Glomerator::FirstParentMuchBigger(ClusterId queries, ClusterId queries_other, int nmax) {
   int nseq(CountMembers(queries));
   int nseq_other(CountMembers(queries_other));
   if(nseq > nmax && float(nseq) / nseq_other > asym_factor_ ) {  // if <nseq> is large, and if <nseq> more than twice the size of <nseq_other>, use the existing name translation (for which we should already have a logprob and a naive seq)
     if(args_->debug()) {
-      cout << "                asymetric  " << nseq << " " << nseq_other << "  use " << queries << "  instead of " << JoinNames(queries, queries_other) << endl;
+      cout << "                asymetric  " << nseq << " " << nseq_other << "  use " << cluster_index_.name(queries) << "  instead of " << cluster_index_.name(cluster_index_.Join(queries, queries_other)) << endl;
       if(naive_seq_name_translations_.count(queries))
-	cout << "                    naive seq translates to " << naive_seq_name_translations_[queries] << endl;
+	cout << "                    naive seq translates to " << cluster_index_.name(naive_seq_name_translations_[queries]) << endl;
     }
     return true;
   }
@@ -609,7 +654,7 @@ bool Glomerator::FirstParentMuchBigger(string queries, string queries_other, int
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::FindNaiveSeqNameReplace(pair<string, string> *parents) {
+ClusterId Glomerator::FindNaiveSeqNameReplace(pair<ClusterId, ClusterId> *parents) {
   assert(parents != nullptr);
 
   // if both parents have the same naive sequence, just use the first one
@@ -623,25 +668,25 @@ string Glomerator::FindNaiveSeqNameReplace(pair<string, string> *parents) {
   if(FirstParentMuchBigger(parents->second, parents->first, nmax))
     return parents->second;
 
-  return string("");  // if we fall through, we don't want to replace the current query (but maybe we'll later decide to only use a subset of it)
+  return NO_CLUSTER;  // if we fall through, we don't want to replace the current query (but maybe we'll later decide to only use a subset of it)
 }
 
 // ----------------------------------------------------------------------------------------
-string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
+string &Glomerator::GetNaiveSeq(ClusterId queries, pair<ClusterId, ClusterId> *parents) {
   if(naive_seqs_.count(queries))
     return naive_seqs_[queries];
 
   // see if we want to just straight up use the naive sequence from one of the parents
   if(parents != nullptr) {
-    string name_with_which_to_replace = FindNaiveSeqNameReplace(parents);
-    if(name_with_which_to_replace != "") {
+    ClusterId name_with_which_to_replace = FindNaiveSeqNameReplace(parents);
+    if(name_with_which_to_replace != NO_CLUSTER) {
       naive_seqs_[queries] = GetNaiveSeq(name_with_which_to_replace);  // copy the whole sequence object  TODO this doesn't follow/do the turtle thing
       return naive_seqs_[queries];
     }
   }
 
   // see if we want to calculate with only a subset of the queries
-  string queries_to_calc = GetNaiveSeqNameToCalculate(queries);
+  ClusterId queries_to_calc = GetNaiveSeqNameToCalculate(queries);
 
   // actually calculate the viterbi path for whatever queries we've decided on
   if(naive_seqs_.count(queries_to_calc) == 0) {
@@ -663,7 +708,7 @@ string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
 // }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::GetLogProb(string queries) {  // NOTE this does *no* translation, so you better have done that already before you call it if you want it done
+double Glomerator::GetLogProb(ClusterId queries) {  // NOTE this does *no* translation, so you better have done that already before you call it if you want it done
   if(log_probs_.count(queries))  // already did it
     return log_probs_[queries];
 
@@ -674,33 +719,32 @@ double Glomerator::GetLogProb(string queries) {  // NOTE this does *no* translat
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::GetLogProbRatio(string key_a, string key_b) {
+double Glomerator::GetLogProbRatio(ClusterId key_a, ClusterId key_b) {
   // NOTE the error from using the single kbounds rather than the OR seems to be around a part in a thousand or less (it's only really important that the merged query has the OR)
   // NOTE also that the _a and _b results will be cached, but with their *individual* only_gene sets (rather than the OR)... but this seems to be ok.
   // NOTE if kbounds gets expanded in one of these three calls, we don't redo the others. Which is really ok, but could be checked again?
   // NOTE we could avoid recalculating a lot of the denominators if we didn't randomly choose a subset, and instead looked to see what we already have (but then it would be a lot harder to have a representive sample...)
 
-  string joint_name(JoinNames(key_a, key_b));
+  ClusterId joint_name(cluster_index_.Join(key_a, key_b));
 
   if(lratios_.count(joint_name))  // NOTE as in other places, this assumes there's only *one* way to get to a given joint name (or at least that we'll get about the same answer each different way)
     return lratios_[joint_name];
 
-  Query full_qmerged = GetMergedQuery(key_a, key_b);
-  pair<string, string> parents_to_calc = GetLogProbPairOfNamesToCalculate(joint_name, full_qmerged.parents_);
-  string key_a_to_calc = parents_to_calc.first;
-  string key_b_to_calc = parents_to_calc.second;
-  Query qmerged_to_calc = GetMergedQuery(key_a_to_calc, key_b_to_calc);
+  vector<ClusterId> names_to_calc(GetLogProbNamesForRatio(key_a, key_b));
+  ClusterId key_a_to_calc = names_to_calc[0];
+  ClusterId key_b_to_calc = names_to_calc[1];
+  ClusterId qmerged_to_calc = names_to_calc[2];
 
   double log_prob_a = GetLogProb(key_a_to_calc);
   double log_prob_b = GetLogProb(key_b_to_calc);
-  double log_prob_ab = GetLogProb(qmerged_to_calc.name_);
+  double log_prob_ab = GetLogProb(qmerged_to_calc);
 
   double lratio(log_prob_ab - log_prob_a - log_prob_b);
   if(args_->debug()) {
     printf("             %8.3f =", lratio);
-    printf(" %s - %s - %s", joint_name.c_str(), key_a.c_str(), key_b.c_str());
-    if(qmerged_to_calc.name_ != joint_name || key_a_to_calc != key_a || key_b_to_calc != key_b)
-      printf(" (calcd  %s - %s - %s)", qmerged_to_calc.name_.c_str(), key_a_to_calc.c_str(), key_b_to_calc.c_str());
+    printf(" %s - %s - %s", cluster_index_.name(joint_name).c_str(), cluster_index_.name(key_a).c_str(), cluster_index_.name(key_b).c_str());
+    if(qmerged_to_calc != joint_name || key_a_to_calc != key_a || key_b_to_calc != key_b)
+      printf(" (calcd  %s - %s - %s)", cluster_index_.name(qmerged_to_calc).c_str(), cluster_index_.name(key_a_to_calc).c_str(), cluster_index_.name(key_b_to_calc).c_str());
     printf("\n");
   }
 
@@ -709,7 +753,80 @@ double Glomerator::GetLogProbRatio(string key_a, string key_b) {
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::CalculateNaiveSeq(string queries, RecoEvent *event) {
+vector<ClusterId> Glomerator::GetLogProbNamesForRatio(ClusterId key_a, ClusterId key_b) {
+  Query full_qmerged = GetMergedQuery(key_a, key_b);
+  pair<ClusterId, ClusterId> parents_to_calc = GetLogProbPairOfNamesToCalculate(full_qmerged.id_, full_qmerged.parents_);
+  Query &qmerged_to_calc = GetMergedQuery(parents_to_calc.first, parents_to_calc.second);
+  return vector<ClusterId>{parents_to_calc.first, parents_to_calc.second, qmerged_to_calc.id_};
+}
+
+// ----------------------------------------------------------------------------------------
+// calculate, on --n-threads threads, all the log probs that we don't yet have but will need for the lratios of <candidates>.
+// Everything that touches the caches (i.e. deciding what to calculate, and then storing the results) happens in this thread, so the other threads only run DPHandlers.
+void Glomerator::CalculateLogProbsInParallel(vector<pair<ClusterId, ClusterId> > &candidates) {
+  if(args_->n_threads() <= 1)  // just let GetLogProb() calculate them as they come up
+    return;
+
+  vector<ClusterId> queries_to_calc;
+  set<ClusterId> queries_to_calc_set;  // just for fast lookup
+  for(auto &cpair : candidates) {
+    if(lratios_.count(cluster_index_.Join(cpair.first, cpair.second)))
+      continue;
+    for(auto &queries : GetLogProbNamesForRatio(cpair.first, cpair.second)) {
+      if(log_probs_.count(queries) || fused_log_probs_.count(queries) || queries_to_calc_set.count(queries))
+	continue;
+      queries_to_calc.push_back(queries);
+      queries_to_calc_set.insert(queries);
+    }
+  }
+
+  size_t n_threads(min((size_t)args_->n_threads(), queries_to_calc.size()));
+  if(n_threads <= 1)
+    return;
+
+  vector<Query*> qrys;  // look these up beforehand, since cachefo() can modify the caches
+  for(auto &queries : queries_to_calc)
+    qrys.push_back(&cachefo(queries));
+
+  // NOTE as in bcrham's run_algorithm(), exceptions are caught in the threads and rethrown here, so they go to whoever called us rather than terminating the program
+  vector<Result> results(queries_to_calc.size(), Result(KBounds(), args_->locus()));
+  atomic<size_t> inext(0);
+  vector<exception_ptr> exceptions(n_threads);
+  vector<thread> threads;
+  for(size_t ithread = 0; ithread < n_threads; ++ithread) {
+    threads.push_back(thread([&, ithread]() {
+      try {
+	for(size_t iqry = inext++; iqry < qrys.size(); iqry = inext++) {
+	  DPHandler dph("forward", args_, gl_, hmms_);
+	  results[iqry] = dph.Run(qrys[iqry]->seqs_, qrys[iqry]->kbounds_, qrys[iqry]->only_genes_, qrys[iqry]->mute_freq_);
+	}
+      } catch(...) {
+	exceptions[ithread] = current_exception();
+      }
+    }));
+  }
+  for(auto &thr : threads)
+    thr.join();
+  for(auto &exc : exceptions) {
+    if(exc)
+      rethrow_exception(exc);
+  }
+
+  // then put them in the cache just as GetLogProb() and CalculateLogProb() would've
+  for(size_t iqry = 0; iqry < queries_to_calc.size(); ++iqry) {
+    ++n_fwd_calculated_;
+    if(results[iqry].no_path_) {
+      AddFailedQuery(queries_to_calc[iqry], "no_path");
+      log_probs_[queries_to_calc[iqry]] = -INFINITY;
+    } else {
+      log_probs_[queries_to_calc[iqry]] = results[iqry].total_score();
+    }
+  }
+  WriteStatus();
+}
+
+// ----------------------------------------------------------------------------------------
+string Glomerator::CalculateNaiveSeq(ClusterId queries, RecoEvent *event) {
   if(event == nullptr)  // if we're calling it with <event> set, then we know we're recalculating some things
     assert(naive_seqs_.count(queries) == 0);
 
@@ -718,11 +835,18 @@ string Glomerator::CalculateNaiveSeq(string queries, RecoEvent *event) {
 
   ++n_vtb_calculated_;
 
-  DPHandler dph("viterbi", args_, gl_, hmms_);
+  // if we might want the log prob for these same queries (i.e. they're small enough that we won't translate them to a subset), get it from the same pass through the trellises
+  // NOTE it doesn't go in <log_probs_> until somebody asks for it, so we don't change what gets cached (or counted)
+  // NOTE the fused pass doesn't prune, so with --forward-tolerance we leave it to CalculateLogProb() (otherwise some log probs would be exact and some not)
+  bool also_forward(event == nullptr && log_probs_.count(queries) == 0 && CountMembers(queries) <= args_->biggest_logprob_cluster_to_calculate() && args_->forward_tolerance() == 0.);
+
+  DPHandler dph(also_forward ? "both" : "viterbi", args_, gl_, hmms_);
   Query &cacheref = cachefo(queries);
   Result result = dph.Run(cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
   // if(FishyMultiSeqAnnotation(SplitString(queries).size(), result.best_event()))
   //   dph.HandleFishyAnnotations(result, cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
+  if(also_forward)
+    fused_log_probs_[queries] = result.no_path_ ? -INFINITY : result.total_score();  // same as CalculateLogProb() would give
   if(result.no_path_) {
     AddFailedQuery(queries, "no_path");
     return "";
@@ -736,7 +860,7 @@ string Glomerator::CalculateNaiveSeq(string queries, RecoEvent *event) {
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::CalculateLogProb(string queries) {  // NOTE can modify kbinfo_
+double Glomerator::CalculateLogProb(ClusterId queries) {  // NOTE can modify kbinfo_
   // NOTE do *not* call this from anywhere except GetLogProb()
   assert(log_probs_.count(queries) == 0);
 
@@ -745,6 +869,15 @@ double Glomerator::CalculateLogProb(string queries) {  // NOTE can modify kbinfo
   
   ++n_fwd_calculated_;
 
+  auto it = fused_log_probs_.find(queries);
+  if(it != fused_log_probs_.end()) {  // already got it along with the naive seq
+    double logprob(it->second);
+    fused_log_probs_.erase(it);
+    if(logprob == -INFINITY)
+      AddFailedQuery(queries, "no_path");
+    return logprob;
+  }
+
   DPHandler dph("forward", args_, gl_, hmms_);
   Query &cacheref = cachefo(queries);
   Result result = dph.Run(cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
@@ -758,13 +891,13 @@ double Glomerator::CalculateLogProb(string queries) {  // NOTE can modify kbinfo
 }
 
 // ----------------------------------------------------------------------------------------
-void Glomerator::AddFailedQuery(string queries, string error_str) {
+void Glomerator::AddFailedQuery(ClusterId queries, string error_str) {
     errors_[queries] = errors_[queries] + ":" + error_str;
     failed_queries_.insert(queries);
 }
 
 // ----------------------------------------------------------------------------------------
-Query &Glomerator::cachefo(string queries) {
+Query &Glomerator::cachefo(ClusterId queries) {
   if(cachefo_.find(queries) != cachefo_.end())
     return cachefo_[queries];
   else if(tmp_cachefo_.find(queries) != tmp_cachefo_.end())
@@ -776,7 +909,7 @@ Query &Glomerator::cachefo(string queries) {
     KBounds kbounds;
     double mute_freq_total(0.);
     size_t cdr3_length(0);
-    vector<string> tmpvec(SplitString(queries));
+    const vector<unsigned> &tmpvec(cluster_index_.members(queries));
     for(size_t is=0; is<tmpvec.size(); ++is) {
       Query &scache(single_seq_cachefo_[tmpvec[is]]);
       only_gene_set.insert(scache.only_genes_.begin(), scache.only_genes_.end());
@@ -788,7 +921,7 @@ Query &Glomerator::cachefo(string queries) {
       if(is==0)
 	cdr3_length = scache.cdr3_length_;
       if(cdr3_length != scache.cdr3_length_)
-	throw runtime_error("cdr3 length mismatch " + to_string(cdr3_length) + " " + to_string(scache.cdr3_length_) + " for single query " + tmpvec[is] + " within " + queries);
+	throw runtime_error("cdr3 length mismatch " + to_string(cdr3_length) + " " + to_string(scache.cdr3_length_) + " for single query " + cluster_index_.uid(tmpvec[is]) + " within " + cluster_index_.name(queries));
 
       // cout << "    " << tmpvec[is] << "    " << kbounds.stringify() << "   " << scache.mute_freq_ << "   " << cdr3_length << "   ";
       // for(auto &g : only_gene_set)
@@ -799,7 +932,7 @@ Query &Glomerator::cachefo(string queries) {
 
     tmp_cachefo_[queries] = Query(queries,
 				  GetSeqs(queries),
-				  !InString(args_->seed_unique_id(), queries),
+				  !HasSeed(queries),
 				  vector<string>(only_gene_set.begin(), only_gene_set.end()),
 				  kbounds,
 				  mute_freq_total / tmpvec.size(),
@@ -832,37 +965,37 @@ bool Glomerator::SameLength(vector<Sequence*> &seqs, bool debug) {
 }  
 
 // ----------------------------------------------------------------------------------------
-vector<Sequence*> Glomerator::GetSeqs(string query) {
-  vector<string> queryvec(SplitString(query));
+vector<Sequence*> Glomerator::GetSeqs(ClusterId query) {
+  const vector<unsigned> &queryvec(cluster_index_.members(query));
   vector<Sequence*> seqs(queryvec.size());
   for(size_t is=0; is<queryvec.size(); ++is) {
     if(single_seqs_.find(queryvec[is]) == single_seqs_.end())
-      throw runtime_error("couldn't find query " + query + " in single seq vector");
+      throw runtime_error("couldn't find query " + cluster_index_.name(query) + " in single seq vector");
     seqs[is] = &single_seqs_[queryvec[is]];
     if(seqs[is] == nullptr)
-      throw runtime_error("null ptr to sequence for query " + query);
+      throw runtime_error("null ptr to sequence for query " + cluster_index_.name(query));
   }
   return seqs;
 }
 
 // ----------------------------------------------------------------------------------------
 // when we're adding <query> to the permament cache in <cachefo_>, if it's been translated we also need it's subsets in <cachefo_>
-void Glomerator::MoveSubsetsFromTmpCache(string query) {
+void Glomerator::MoveSubsetsFromTmpCache(ClusterId query) {
   if(naive_seq_name_translations_.find(query) != naive_seq_name_translations_.end()) {
-    string tquery(naive_seq_name_translations_[query]);
+    ClusterId tquery(naive_seq_name_translations_[query]);
     // cout << "naive seq nt " << tquery << endl;
     CopyToPermanentCache(tquery, query);
   }
 
   if(logprob_name_translations_.find(query) != logprob_name_translations_.end()) {
-    pair<string, string> tpair(logprob_name_translations_[query]);
+    pair<ClusterId, ClusterId> tpair(logprob_name_translations_[query]);
     // cout << "logprob nt for: " << query << "    " << tpair.first << " " << tpair.second << endl;
     CopyToPermanentCache(tpair.first, query);
     CopyToPermanentCache(tpair.second, query);
   }
 
   if(logprob_asymetric_translations_.find(query) != logprob_asymetric_translations_.end()) {
-    string tquery(logprob_asymetric_translations_[query]);
+    ClusterId tquery(logprob_asymetric_translations_[query]);
     // cout << "logprob asym t " << tquery << endl;
     CopyToPermanentCache(tquery, query);
   }
@@ -871,7 +1004,7 @@ void Glomerator::MoveSubsetsFromTmpCache(string query) {
 // ----------------------------------------------------------------------------------------
 // Copy the entry for <translated_query> from <tmp_cachefo_> to <cachefo_>, unless it isn't there, in which case we reconstruct roughly what it should have been using <superquery> (the query for which <translated_query> is a translation).
 // e.g. if <translated_query> is "is:hm" then <superquery> might be "az:fh:fi:is:fj:hm".
-void Glomerator::CopyToPermanentCache(string translated_query, string superquery) {
+void Glomerator::CopyToPermanentCache(ClusterId translated_query, ClusterId superquery) {
   if(tmp_cachefo_.find(translated_query) != tmp_cachefo_.end()) {
     cachefo_[translated_query] = tmp_cachefo_[translated_query];
   } else {  // I think that if we don't have it even in the tmp cache, that we won't ever need the query info (I think it means to we already calculated everything for it) but it makes things more consistent and safer to make sure it's in the permanenet cache
@@ -879,7 +1012,7 @@ void Glomerator::CopyToPermanentCache(string translated_query, string superquery
     // cout << "scratchy! " << superquery << " --> " << translated_query << endl;
     cachefo_[translated_query] = Query(translated_query,
 				       GetSeqs(translated_query),
-				       !InString(args_->seed_unique_id(), translated_query),
+				       !HasSeed(translated_query),
 				       supercache.only_genes_,
 				       supercache.kbounds_,
 				       supercache.mute_freq_,
@@ -890,9 +1023,9 @@ void Glomerator::CopyToPermanentCache(string translated_query, string superquery
 }
 
 // ----------------------------------------------------------------------------------------
-Query &Glomerator::GetMergedQuery(string name_a, string name_b) {
+Query &Glomerator::GetMergedQuery(ClusterId name_a, ClusterId name_b) {
 
-  string joint_name = JoinNames(name_a, name_b);  // sorts name_a and name_b, but *doesn't* sort within them
+  ClusterId joint_name = cluster_index_.Join(name_a, name_b);
   if(cachefo_.find(joint_name) != cachefo_.end())
     return cachefo_[joint_name];
   if(tmp_cachefo_.find(joint_name) != tmp_cachefo_.end())
@@ -908,12 +1041,12 @@ Query &Glomerator::GetMergedQuery(string name_a, string name_b) {
   }
 
   if(ref_a.cdr3_length_ != ref_b.cdr3_length_)
-    throw runtime_error("cdr3 lengths different for " + name_a + " and " + name_b + " (" + to_string(ref_a.cdr3_length_) + " " + to_string(ref_b.cdr3_length_) + ")");
+    throw runtime_error("cdr3 lengths different for " + cluster_index_.name(name_a) + " and " + cluster_index_.name(name_b) + " (" + to_string(ref_a.cdr3_length_) + " " + to_string(ref_b.cdr3_length_) + ")");
 
   // NOTE now that I'm adding the merged query to the cache info here, I can maybe get rid of the qmerged entirely UPDATE I have no idea if this is still relevant
   tmp_cachefo_[joint_name] = Query(joint_name,
 				   GetSeqs(joint_name),
-				   !InString(args_->seed_unique_id(), joint_name),
+				   !HasSeed(joint_name),
 				   joint_only_genes,
 				   ref_a.kbounds_.LogicalOr(ref_b.kbounds_),
 				   (ref_a.seqs_.size()*ref_a.mute_freq_ + ref_b.seqs_.size()*ref_b.mute_freq_) / double(ref_a.seqs_.size() + ref_b.seqs_.size()),  // simple weighted average (doesn't account for different sequence lengths)
@@ -982,49 +1115,149 @@ Partition Glomerator::GetSeededClusters(Partition &partition) {
 }
 
 // ----------------------------------------------------------------------------------------
-pair<double, Query> Glomerator::FindHfracMerge(ClusterPath *path) {
-  double min_hamming_fraction(INFINITY);
-  Query min_hamming_merge;
+void Glomerator::AddCandidate(ClusterId key_a, ClusterId key_b) {
+  // put them in the order in which the old loop over all pairs in the partition would've come across them, so we break ties the same way
+  // (i.e. sorted by name, except when the seed is set, in which case we only want pairs with at least one seeded cluster, and that one goes first)
+  ClusterId first(key_a), second(key_b);
+  if(cluster_index_.name(second) < cluster_index_.name(first))
+    swap(first, second);
+  if(args_->seed_unique_id() != "") {
+    if(SeedMissing(first) && SeedMissing(second))
+      return;
+    if(SeedMissing(first))
+      swap(first, second);
+  }
 
-  Partition outer_clusters(path->CurrentPartition());  // for plain partitioning, outer loop is over everything in the current partition
-  if(args_->seed_unique_id() != "")  // whereas if seed unique id is set, outer loop is only over those clusters that contain the seed
-    outer_clusters = GetSeededClusters(path->CurrentPartition());
-  for(Partition::iterator it_a = outer_clusters.begin(); it_a != outer_clusters.end(); ++it_a) {
-    Partition::iterator it_b(it_a);  // for plain partitioning, inner loop starts at the position of the outer iterator + 1
-    ++it_b;
-    if(args_->seed_unique_id() != "")  // but if the seed's set, inner loop is over the *entire* current partition (including the seeded clusters). So we also need to skip key_a == key_b below.
-      it_b = path->CurrentPartition().begin();
-
-    for( ; true; ++it_b) {
-      if(args_->seed_unique_id() == "") {
-	if(it_b == outer_clusters.end())  // NOTE you can't replace this with path->CurrentPartition().end() because in this case <it_b> is looping over the *copy* of path->CurrentPartition()
-	  break;
-      } else {
-	if(it_b == path->CurrentPartition().end())
-	  break;
-      }
+  if(failed_queries_.count(first) || failed_queries_.count(second))
+    return;
 
-      string key_a(*it_a), key_b(*it_b);
-      if(key_a == key_b)  // otherwise we'd loop over the seeded ones twice
-	continue;
-      if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
-	continue;
+  double hfrac = NaiveHfrac(first, second);
+  if(hfrac > args_->hamming_fraction_bound_hi())  // if naive hamming fraction too big, don't even consider merging the pair
+    return;
 
-      if(cachefo(key_a).cdr3_length_ != cachefo(key_b).cdr3_length_)
-      	continue;
+  if(args_->hamming_fraction_bound_lo() > 0.0 && hfrac < args_->hamming_fraction_bound_lo())  // close enough to merge without calculating the lratio
+    InsertCandidate(hfrac_candidates_, CandidateMerge(hfrac, first, second));
+  else
+    InsertCandidate(unevaluated_candidates_, CandidateMerge(0., first, second));  // we don't calculate lratios until we need them (i.e. once we run out of hfrac merges)
+}
 
-      double hfrac = NaiveHfrac(key_a, key_b);
-      if(hfrac > args_->hamming_fraction_bound_hi())  // if naive hamming fraction too big, don't even consider merging the pair
-	continue;
+// ----------------------------------------------------------------------------------------
+void Glomerator::InsertCandidate(set<CandidateMerge, CandidateOrder> &candidates, CandidateMerge cmerge) {
+  candidates.insert(cmerge);
+  candidates_by_cluster_[cmerge.first_].insert(cmerge);
+  candidates_by_cluster_[cmerge.second_].insert(cmerge);
+}
 
-      if(args_->hamming_fraction_bound_lo() <= 0.0 || hfrac >= args_->hamming_fraction_bound_lo())
-	continue;
+// ----------------------------------------------------------------------------------------
+void Glomerator::RemoveCandidate(set<CandidateMerge, CandidateOrder> &candidates, CandidateMerge cmerge) {  // NOTE <cmerge> is a copy, since the reference you'd want to pass in is usually in one of the sets we're erasing from
+  candidates.erase(cmerge);
+  candidates_by_cluster_[cmerge.first_].erase(cmerge);
+  candidates_by_cluster_[cmerge.second_].erase(cmerge);
+}
+
+// ----------------------------------------------------------------------------------------
+// remove every candidate merge involving <queries> (which has just been merged into something else)
+void Glomerator::RemoveCandidates(ClusterId queries) {
+  if(candidates_by_cluster_.count(queries) == 0)
+    return;
+  for(auto &cmerge : candidates_by_cluster_[queries]) {
+    hfrac_candidates_.erase(cmerge);  // it's only in one of these, but it's easier to just try all of them
+    lratio_candidates_.erase(cmerge);
+    unevaluated_candidates_.erase(cmerge);
+    ClusterId other(cmerge.first_ == queries ? cmerge.second_ : cmerge.first_);
+    candidates_by_cluster_[other].erase(cmerge);
+  }
+  candidates_by_cluster_.erase(queries);
+}
 
-      if(hfrac < min_hamming_fraction) {
-	  min_hamming_fraction = hfrac;
-	  min_hamming_merge = GetMergedQuery(key_a, key_b);
+// ----------------------------------------------------------------------------------------
+// bring the candidate merges up to date with <path>'s current partition (i.e. the first time through add all pairs, and after that only pairs with the newly-merged cluster)
+// NOTE clusters with different cdr3 lengths can't be merged, so we only look at pairs within each cdr3 length bucket
+// And if --hamming-fraction-bound-hi is set (and we're not caching naive hfracs), we use the naive seq trees to skip most of the pairs that are too far apart
+void Glomerator::UpdateCandidates(ClusterPath *path) {
+  Partition &partition(path->CurrentPartition());
+  bool use_trees(args_->hamming_fraction_bound_hi() < 1. && !args_->cache_naive_hfracs());  // NOTE with --cache-naive-hfracs, we want the hfrac for every pair (not just the close ones) in the cache file
+  if(!candidates_initialized_) {
+    for(auto &queries : partition)
+      clusters_by_cdr3_length_[cachefo(queries).cdr3_length_].insert(queries);
+    for(auto &kv : clusters_by_cdr3_length_) {
+      set<ClusterId> &bucket(kv.second);
+      if(use_trees) {
+	InitializeNaiveSeqTree(bucket);
+	continue;
       }
+      for(set<ClusterId>::iterator it_a = bucket.begin(); it_a != bucket.end(); ++it_a) {
+	set<ClusterId>::iterator it_b(it_a);
+	for(++it_b; it_b != bucket.end(); ++it_b)
+	  AddCandidate(*it_a, *it_b);
+      }
+    }
+    candidates_initialized_ = true;
+  } else if(newest_cluster_ != NO_CLUSTER) {
+    assert(partition.count(newest_cluster_));
+    if(use_trees) {
+      AddNaiveSeqNeighborCandidates(newest_cluster_);
+    } else {
+      for(auto &queries : clusters_by_cdr3_length_[cachefo(newest_cluster_).cdr3_length_]) {
+	if(queries != newest_cluster_)
+	  AddCandidate(newest_cluster_, queries);
+      }
+    }
+  }
+  newest_cluster_ = NO_CLUSTER;
+}
+
+// ----------------------------------------------------------------------------------------
+// add the candidates for the clusters in <bucket> (all of which have the same cdr3 length), and put them in the bucket's naive seq tree
+void Glomerator::InitializeNaiveSeqTree(set<ClusterId> &bucket) {
+  // only calculate naive seqs for the clusters that the loop over all pairs would've compared to something, i.e. not if they're alone in the bucket, or if they're unseeded and there's no seeded cluster
+  vector<ClusterId> unfailed_clusters;
+  size_t n_seeded(0);
+  for(auto &queries : bucket) {
+    if(failed_queries_.count(queries))
+      continue;
+    unfailed_clusters.push_back(queries);
+    if(!SeedMissing(queries))
+      ++n_seeded;
+  }
+  for(auto &queries : unfailed_clusters) {
+    size_t n_partners(args_->seed_unique_id() == "" || !SeedMissing(queries) ? unfailed_clusters.size() - 1 : n_seeded);
+    if(n_partners > 0)
+      AddNaiveSeqNeighborCandidates(queries);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// add candidates for <queries> paired with each cluster in its cdr3 length's naive seq tree that could be within --hamming-fraction-bound-hi of it, then add <queries> to the tree
+void Glomerator::AddNaiveSeqNeighborCandidates(ClusterId queries) {
+  GetNaiveSeq(queries);
+  if(failed_queries_.count(queries))  // (AddCandidate() would skip all its pairs anyway)
+    return;
+  PackedSeq &packed_seq(GetPackedNaiveSeq(queries));
+  BKTree &tree(naive_seq_trees_[cachefo(queries).cdr3_length_]);
+
+  // the hfrac skips positions that are ambiguous in either sequence, whereas the tree's distance counts them, so we have to look further by the most ambiguous positions there could be
+  unsigned max_distance(ceil(double(args_->hamming_fraction_bound_hi()) * packed_seq.size()) + packed_seq.n_ambiguous() + tree.max_n_ambiguous());
+  for(auto &other : tree.Within(packed_seq, max_distance))
+    AddCandidate(queries, other);  // NOTE this still calculates the actual hfrac, and skips the ones that are too far apart
+  tree.Insert(queries, packed_seq);
+}
+
+// ----------------------------------------------------------------------------------------
+pair<double, Query> Glomerator::FindHfracMerge() {
+  double min_hamming_fraction(INFINITY);
+  Query min_hamming_merge;
+
+  // they're sorted by hfrac, so we want the first one that's still ok
+  while(hfrac_candidates_.size() > 0) {
+    const CandidateMerge &cmerge(*hfrac_candidates_.begin());
+    if(failed_queries_.count(cmerge.first_) || failed_queries_.count(cmerge.second_)) {
+      RemoveCandidate(hfrac_candidates_, cmerge);
+      continue;
     }
+    min_hamming_fraction = cmerge.val_;
+    min_hamming_merge = GetMergedQuery(cmerge.first_, cmerge.second_);
+    break;
   }
 
   if(min_hamming_fraction != INFINITY) {  // (note that this is *plus* infinity, but in the lratio fcn it's -INFINITY)
@@ -1037,52 +1270,47 @@ pair<double, Query> Glomerator::FindHfracMerge(ClusterPath *path) {
 }
 
 // ----------------------------------------------------------------------------------------
-pair<double, Query> Glomerator::FindLRatioMerge(ClusterPath *path) {
+pair<double, Query> Glomerator::FindLRatioMerge() {
   double max_lratio(-INFINITY);
   Query chosen_qmerge;
 
-  Partition outer_clusters(path->CurrentPartition());
-  if(args_->seed_unique_id() != "")  // see comments in FindHfracMerge
-    outer_clusters = GetSeededClusters(path->CurrentPartition());
-  for(Partition::iterator it_a = outer_clusters.begin(); it_a != outer_clusters.end(); ++it_a) {
-    Partition::iterator it_b(it_a);
-    ++it_b;
-    if(args_->seed_unique_id() != "")
-      it_b = path->CurrentPartition().begin();
-
-    for( ; true; ++it_b) {
-      if(args_->seed_unique_id() == "") {
-	if(it_b == outer_clusters.end())  // NOTE you can't replace this with path->CurrentPartition().end() because in this case <it_b> is looping over the *copy* of path->CurrentPartition()
-	  break;
-      } else {
-	if(it_b == path->CurrentPartition().end())
-	  break;
-      }
-
-      string key_a(*it_a), key_b(*it_b);
-      if(key_a == key_b)  // otherwise we'd loop over the seeded ones twice
-	continue;
-      if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
-	continue;
-
-      if(cachefo(key_a).cdr3_length_ != cachefo(key_b).cdr3_length_)
-      	continue;
-
-      double hfrac = NaiveHfrac(key_a, key_b);
-      if(hfrac > args_->hamming_fraction_bound_hi())  // if naive hamming fraction too big, don't even consider merging the pair
-	continue;
-
-      double lratio = GetLogProbRatio(key_a, key_b);
-
-      // don't merge if lratio is small (less than zero, more or less)
-      if(!force_merge_ && LikelihoodRatioTooSmall(lratio, CountMembers(key_a) + CountMembers(key_b)))
-	continue;
+  // first calculate lratios for any candidates that don't have them yet (all at once, so we can use more than one thread)
+  vector<pair<ClusterId, ClusterId> > candidates;
+  for(auto &cmerge : unevaluated_candidates_) {
+    if(failed_queries_.count(cmerge.first_) == 0 && failed_queries_.count(cmerge.second_) == 0)
+      candidates.push_back(pair<ClusterId, ClusterId>(cmerge.first_, cmerge.second_));
+  }
+  CalculateLogProbsInParallel(candidates);  // (does nothing unless --n-threads is set)
+  while(unevaluated_candidates_.size() > 0) {
+    CandidateMerge cmerge(*unevaluated_candidates_.begin());
+    RemoveCandidate(unevaluated_candidates_, cmerge);
+    if(failed_queries_.count(cmerge.first_) || failed_queries_.count(cmerge.second_))
+      continue;
+    double lratio = GetLogProbRatio(cmerge.first_, cmerge.second_);
+    if(std::isnan(lratio) || lratio == -INFINITY)  // these can never be chosen (and nan would break the sorting)
+      continue;
+    InsertCandidate(lratio_candidates_, CandidateMerge(-lratio, cmerge.first_, cmerge.second_));  // minus sign so the biggest lratio comes first
+  }
 
-      if(lratio > max_lratio) {
-	max_lratio = lratio;
-	chosen_qmerge = GetMergedQuery(key_a, key_b);
-      }
+  // then take the biggest lratio that isn't too small for its cluster size
+  // NOTE ties go to the pair that comes first in the (seed-aware) partition order, which is what the old loop over all pairs did, so we choose the same merge no matter how many threads
+  set<CandidateMerge, CandidateOrder>::iterator it(lratio_candidates_.begin());
+  while(it != lratio_candidates_.end()) {
+    if(failed_queries_.count(it->first_) || failed_queries_.count(it->second_)) {
+      CandidateMerge cmerge(*it++);
+      RemoveCandidate(lratio_candidates_, cmerge);
+      continue;
+    }
+    double lratio(-it->val_);
+    if(!force_merge_ && lratio < args_->logprob_ratio_threshold() - 5.)  // too small for any cluster size (see LikelihoodRatioTooSmall()), and so is everything after it
+      break;
+    if(!force_merge_ && LikelihoodRatioTooSmall(lratio, CountMembers(it->first_) + CountMembers(it->second_))) {  // don't merge if lratio is small (less than zero, more or less)
+      ++it;
+      continue;
     }
+    max_lratio = lratio;
+    chosen_qmerge = GetMergedQuery(it->first_, it->second_);
+    break;
   }
 
   if(max_lratio != -INFINITY) {  // if we found a merge that we liked (note that this is *minus* infinity, but in the hfrac fcn it's +INFINITY)
@@ -1096,7 +1324,7 @@ pair<double, Query> Glomerator::FindLRatioMerge(ClusterPath *path) {
 
 // ----------------------------------------------------------------------------------------
 void Glomerator::UpdateLogProbTranslationsForAsymetrics(Query &qmerge) {
-  string queries("");
+  ClusterId queries(NO_CLUSTER);
 
   // see if one of the parents is much bigger than the other
   int nmax = 1.5 * args_->biggest_logprob_cluster_to_calculate();  // TODO don't hard code the factor
@@ -1105,21 +1333,21 @@ void Glomerator::UpdateLogProbTranslationsForAsymetrics(Query &qmerge) {
   else if(FirstParentMuchBigger(qmerge.parents_.second, qmerge.parents_.first, nmax))
     queries = qmerge.parents_.second;
 
-  if(queries != "") {
+  if(queries != NO_CLUSTER) {
 
     // if the large parent itself was formed by an asymetric merge, keep following the chain of translations (note that since we do this every time, the chain can't get longer than 1 [erm, I think])
-    string subqueries(queries);
+    ClusterId subqueries(queries);
     while(logprob_asymetric_translations_.count(subqueries)) {
       if(args_->debug())
-	cout << "                  turtles " << subqueries << "  -->  " << logprob_asymetric_translations_[subqueries] << endl;
+	cout << "                  turtles " << cluster_index_.name(subqueries) << "  -->  " << cluster_index_.name(logprob_asymetric_translations_[subqueries]) << endl;
       subqueries = logprob_asymetric_translations_[subqueries];
     }
 
     // if we haven't added too many new sequences since we last calculated something, we can just reuse things  TODO don't hard code this factor
     if(float(CountMembers(queries)) / CountMembers(subqueries) < 2.)  {
       if(args_->debug())
-	cout << "                logprob asymetric translation  " << qmerge.name_ << "  -->  " << subqueries << endl;
-      logprob_asymetric_translations_[qmerge.name_] = subqueries;  // note that this just says *if* we need this logprob in the future, we should instead calculate this other one -- but we may never actually need it
+	cout << "                logprob asymetric translation  " << cluster_index_.name(qmerge.id_) << "  -->  " << cluster_index_.name(subqueries) << endl;
+      logprob_asymetric_translations_[qmerge.id_] = subqueries;  // note that this just says *if* we need this logprob in the future, we should instead calculate this other one -- but we may never actually need it
     } else {
       if(args_->debug())
 	cout << "                  ratio too big for asymetric " << CountMembers(queries) << " " << CountMembers(subqueries) << endl;
@@ -1130,9 +1358,10 @@ void Glomerator::UpdateLogProbTranslationsForAsymetrics(Query &qmerge) {
 // ----------------------------------------------------------------------------------------
 // perform one merge step, i.e. find the two "nearest" clusters and merge 'em (unless we're doing doing smc, in which case we choose a random merge accordingy to their respective nearnesses)
 void Glomerator::Merge(ClusterPath *path) {
-  pair<double, Query> qpair = FindHfracMerge(path);
+  UpdateCandidates(path);
+  pair<double, Query> qpair = FindHfracMerge();
   if(qpair.first == INFINITY)  // if there wasn't a good enough hfrac merge
-    qpair = FindLRatioMerge(path);
+    qpair = FindLRatioMerge();
 
   if(args_->max_cluster_size() > 0) {  // if we were told to stop if any clusters get too big
     for(auto &cluster : path->CurrentPartition()) {
@@ -1173,20 +1402,29 @@ void Glomerator::Merge(ClusterPath *path) {
   WriteStatus();
   Query chosen_qmerge = qpair.second;
 
-  cachefo_[chosen_qmerge.name_] = chosen_qmerge;
-  GetNaiveSeq(chosen_qmerge.name_, &chosen_qmerge.parents_);  // this *needs* to happen here so it has the parental information
+  cachefo_[chosen_qmerge.id_] = chosen_qmerge;
+  GetNaiveSeq(chosen_qmerge.id_, &chosen_qmerge.parents_);  // this *needs* to happen here so it has the parental information
   UpdateLogProbTranslationsForAsymetrics(chosen_qmerge);
-  MoveSubsetsFromTmpCache(chosen_qmerge.name_);
+  MoveSubsetsFromTmpCache(chosen_qmerge.id_);
 
   Partition new_partition(path->CurrentPartition());
   new_partition.erase(chosen_qmerge.parents_.first);
   new_partition.erase(chosen_qmerge.parents_.second);
-  new_partition.insert(chosen_qmerge.name_);
+  new_partition.insert(chosen_qmerge.id_);
   path->AddPartition(new_partition, -INFINITY, args_->n_partitions_to_write());
   current_partition_ = &path->CurrentPartition();
+  RemoveCandidates(chosen_qmerge.parents_.first);
+  RemoveCandidates(chosen_qmerge.parents_.second);
+  set<ClusterId> &bucket(clusters_by_cdr3_length_[chosen_qmerge.cdr3_length_]);  // (GetMergedQuery() makes sure the parents have the same cdr3 length)
+  bucket.erase(chosen_qmerge.parents_.first);
+  bucket.erase(chosen_qmerge.parents_.second);
+  bucket.insert(chosen_qmerge.id_);
+  naive_seq_trees_[chosen_qmerge.cdr3_length_].Remove(chosen_qmerge.parents_.first);  // (the new cluster goes in the tree when we add its candidates)
+  naive_seq_trees_[chosen_qmerge.cdr3_length_].Remove(chosen_qmerge.parents_.second);
+  newest_cluster_ = chosen_qmerge.id_;  // we add its candidates at the start of the next step
 
   if(args_->debug()) {
-    printf("       merged   %s  %s\n", chosen_qmerge.parents_.first.c_str(), chosen_qmerge.parents_.second.c_str());
+    printf("       merged   %s  %s\n", cluster_index_.name(chosen_qmerge.parents_.first).c_str(), cluster_index_.name(chosen_qmerge.parents_.second).c_str());
     cout << "          removing " << tmp_cachefo_.size() << " entries from tmp cache" << endl;
   }
 
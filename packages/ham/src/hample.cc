@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <chrono>
 
 #include "model.h"
 #include "trellis.h"
@@ -12,6 +13,13 @@ using namespace std;
 
 // ----------------------------------------------------------------------------------------
 void CheckChunkCaching(Model &hmm, Trellis &trellis, Sequences seqs);  // for checking with scons test, ignore if you're not scons
+void CheckScaledForward(Model &hmm, Trellis &trellis, Sequences seqs);  // same
+void CheckChainTrellis(Model &hmm, Trellis &trellis, Sequences seqs);  // same
+void CheckReversedTrellis(Model &hmm, Sequences seqs);  // same
+void CheckViterbiAndForward(Model &hmm, Sequences seqs);  // same
+void CheckPrunedViterbi(Model &hmm, Sequences seqs);  // same
+void CheckPrunedForward(Model &hmm, Sequences seqs);  // same
+void Benchmark(Model &hmm, Sequences seqs, int n_repeats);
 
 // ----------------------------------------------------------------------------------------
 int main(int argc, const char *argv[]) {
@@ -20,11 +28,13 @@ int main(int argc, const char *argv[]) {
   ValueArg<string> hmmfname_arg("f", "hmmfname", "hmm (.yaml) model file", true, "", "string");
   ValueArg<string> seqs_arg("s", "seqs", "colon-separated list of sequences", true, "", "string");
   ValueArg<string> outfile_arg("o", "outfile", "output text file", false, "", "string");
+  ValueArg<int> benchmark_arg("b", "n-benchmark-repeats", "if set, also time this many viterbi and forward runs (e.g. on a partis V gene hmm)", false, 0, "int");
   try {
     CmdLine cmd("ham -- the fantabulous HMM compiler", ' ', "");
     cmd.add(hmmfname_arg);
     cmd.add(seqs_arg);
     cmd.add(outfile_arg);
+    cmd.add(benchmark_arg);
     cmd.parse(argc, argv);
   } catch(ArgException &e) {
     cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
@@ -67,6 +77,14 @@ int main(int argc, const char *argv[]) {
     ofs.close();
   }
   CheckChunkCaching(hmm, trell, seqs);
+  CheckScaledForward(hmm, trell, seqs);
+  CheckChainTrellis(hmm, trell, seqs);
+  CheckReversedTrellis(hmm, seqs);
+  CheckViterbiAndForward(hmm, seqs);
+  CheckPrunedViterbi(hmm, seqs);
+  CheckPrunedForward(hmm, seqs);
+  if(benchmark_arg.getValue() > 0)
+    Benchmark(hmm, seqs, benchmark_arg.getValue());
 }
 
 // ----------------------------------------------------------------------------------------
@@ -108,3 +126,202 @@ void CheckChunkCaching(Model &hmm, Trellis &trell, Sequences seqs) {
   }
   cout << "caching ok!" << endl;
 }
+
+// ----------------------------------------------------------------------------------------
+// check that the scaled (probability space) forward gives the same answer as the log space one (just for use by `scons test`)
+void CheckScaledForward(Model &hmm, Trellis &trell, Sequences seqs) {
+  Trellis scaledtrell(&hmm, seqs);
+  scaledtrell.ScaledForward();
+  double eps(1e-10);
+  for(size_t length = 1; length <= seqs.GetSequenceLength(); ++length) {
+    double logprob(trell.ending_forward_log_prob(length)), scaled_logprob(scaledtrell.ending_forward_log_prob(length));
+    if(logprob == -INFINITY && scaled_logprob == -INFINITY)
+      continue;
+    if(fabs(logprob - scaled_logprob) > eps * max(1., fabs(logprob)))
+      throw runtime_error("ERROR scaled forward failed -- didn't give the same log prob for length " + to_string(length) + ": " + to_string(logprob) + " " + to_string(scaled_logprob));
+  }
+  if(fabs(trell.ending_forward_log_prob() - scaledtrell.ending_forward_log_prob()) > eps * max(1., fabs(trell.ending_forward_log_prob())))
+    throw runtime_error("ERROR scaled forward failed -- didn't give the same ending log prob: " + to_string(trell.ending_forward_log_prob()) + " " + to_string(scaledtrell.ending_forward_log_prob()));
+  cout << "scaled forward ok!" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// if the model has a chain topology, check that ChainTrellis gives the same answers as the generic algorithms (just for use by `scons test`)
+void CheckChainTrellis(Model &hmm, Trellis &trell, Sequences seqs) {
+  if(!hmm.chain_topology())
+    return;
+  Trellis generictrell(&hmm, seqs);
+  generictrell.set_use_chain_trellis(false);
+  generictrell.Viterbi();
+  generictrell.Forward();
+  double eps(1e-10);
+  for(size_t length = 1; length <= seqs.GetSequenceLength(); ++length) {
+    double logprob(trell.ending_viterbi_log_prob(length)), generic_logprob(generictrell.ending_viterbi_log_prob(length));
+    if(logprob != generic_logprob && fabs(logprob - generic_logprob) > eps * max(1., fabs(logprob)))
+      throw runtime_error("ERROR chain trellis failed -- didn't give the same viterbi log prob for length " + to_string(length) + ": " + to_string(logprob) + " " + to_string(generic_logprob));
+    logprob = trell.ending_forward_log_prob(length);
+    generic_logprob = generictrell.ending_forward_log_prob(length);
+    if(logprob != generic_logprob && fabs(logprob - generic_logprob) > eps * max(1., fabs(logprob)))
+      throw runtime_error("ERROR chain trellis failed -- didn't give the same forward log prob for length " + to_string(length) + ": " + to_string(logprob) + " " + to_string(generic_logprob));
+  }
+  TracebackPath path(&hmm), generic_path(&hmm);
+  trell.Traceback(path);
+  generictrell.Traceback(generic_path);
+  if(path.size() != generic_path.size())
+    throw runtime_error("ERROR chain trellis failed -- viterbi path lengths differ");
+  for(size_t ipos = 0; ipos < path.size(); ++ipos) {
+    if(path[ipos] != generic_path[ipos])
+      throw runtime_error("ERROR chain trellis failed -- didn't give the same viterbi path");
+  }
+  cout << "chain trellis ok!" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that a trellis on the reversed model gives the same answers for each suffix as a normal trellis on that suffix (just for use by `scons test`)
+void CheckReversedTrellis(Model &hmm, Sequences seqs) {
+  Trellis revtrell(hmm.reversed(), seqs);
+  revtrell.Viterbi();
+  revtrell.Forward();
+  double eps(1e-10);
+  for(size_t length = 1; length <= seqs.GetSequenceLength(); ++length) {
+    Sequences subseqs(seqs, seqs.GetSequenceLength() - length, length);
+    Trellis checktrell(&hmm, subseqs);
+    checktrell.Viterbi();
+    checktrell.Forward();
+    double logprob(revtrell.ending_viterbi_log_prob(length)), check_logprob(checktrell.ending_viterbi_log_prob());
+    if(logprob != check_logprob && fabs(logprob - check_logprob) > eps * max(1., fabs(logprob)))
+      throw runtime_error("ERROR reversed trellis failed -- didn't give the same viterbi log prob for length " + to_string(length) + ": " + to_string(logprob) + " " + to_string(check_logprob));
+    logprob = revtrell.ending_forward_log_prob(length);
+    check_logprob = checktrell.ending_forward_log_prob();
+    if(logprob != check_logprob && fabs(logprob - check_logprob) > eps * max(1., fabs(logprob)))
+      throw runtime_error("ERROR reversed trellis failed -- didn't give the same forward log prob for length " + to_string(length) + ": " + to_string(logprob) + " " + to_string(check_logprob));
+    if(check_logprob == -INFINITY)
+      continue;
+
+    // and the viterbi path, using the reversed trellis as a cached trellis
+    Trellis subtrell(hmm.reversed(), subseqs, &revtrell);
+    subtrell.Viterbi();
+    TracebackPath path(&hmm), checkpath(&hmm);
+    subtrell.Traceback(path);
+    checktrell.Traceback(checkpath);
+    if(path.size() != length || path.model() != &hmm || !(path == checkpath))
+      throw runtime_error("ERROR reversed trellis failed -- didn't give the same viterbi path for length " + to_string(length));
+  }
+  cout << "reversed ok!" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that the fused viterbi and forward gives exactly the same answers as running them separately (just for use by `scons test`)
+void CheckViterbiAndForward(Model &hmm, Sequences seqs) {
+  Trellis fusedtrell(&hmm, seqs), checktrell(&hmm, seqs);
+  fusedtrell.set_use_chain_trellis(false);  // otherwise it just runs them separately
+  checktrell.set_use_chain_trellis(false);
+  fusedtrell.ViterbiAndForward();
+  checktrell.Viterbi();
+  checktrell.Forward();
+  for(size_t length = 1; length <= seqs.GetSequenceLength(); ++length) {
+    if(fusedtrell.ending_viterbi_log_prob(length) != checktrell.ending_viterbi_log_prob(length))
+      throw runtime_error("ERROR fused viterbi and forward failed -- didn't give the same viterbi log prob for length " + to_string(length) + ": " + to_string(fusedtrell.ending_viterbi_log_prob(length)) + " " + to_string(checktrell.ending_viterbi_log_prob(length)));
+    if(fusedtrell.ending_forward_log_prob(length) != checktrell.ending_forward_log_prob(length))
+      throw runtime_error("ERROR fused viterbi and forward failed -- didn't give the same forward log prob for length " + to_string(length) + ": " + to_string(fusedtrell.ending_forward_log_prob(length)) + " " + to_string(checktrell.ending_forward_log_prob(length)));
+  }
+  if(fusedtrell.ending_viterbi_log_prob() != checktrell.ending_viterbi_log_prob() || fusedtrell.ending_forward_log_prob() != checktrell.ending_forward_log_prob())
+    throw runtime_error("ERROR fused viterbi and forward failed -- didn't give the same ending log probs");
+  if(checktrell.ending_viterbi_log_prob() != -INFINITY) {
+    TracebackPath path(&hmm), checkpath(&hmm);
+    fusedtrell.Traceback(path);
+    checktrell.Traceback(checkpath);
+    if(!(path == checkpath))
+      throw runtime_error("ERROR fused viterbi and forward failed -- didn't give the same viterbi path");
+  }
+  cout << "viterbi and forward ok!" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that viterbi with minimum log probs gives the same answers as without wherever they're above the minimum (just for use by `scons test`)
+void CheckPrunedViterbi(Model &hmm, Sequences seqs) {
+  if(!hmm.chain_topology())
+    return;
+  Trellis checktrell(&hmm, seqs);
+  checktrell.Viterbi();
+  size_t seq_length(seqs.GetSequenceLength());
+  for(double margin : {0., 2., 10.}) {
+    vector<double> min_log_probs(seq_length, INFINITY);  // only care about every other length (including the full length)
+    for(size_t length = seq_length; length > 0; length -= min(length, (size_t)2))
+      min_log_probs[length - 1] = checktrell.ending_viterbi_log_prob(length) - margin;
+    Trellis prunedtrell(&hmm, seqs);
+    prunedtrell.Viterbi(&min_log_probs);
+    for(size_t length = 1; length <= seq_length; ++length) {
+      double logprob(prunedtrell.ending_viterbi_log_prob(length)), check_logprob(checktrell.ending_viterbi_log_prob(length));
+      if(logprob > check_logprob || (min_log_probs[length - 1] != INFINITY && logprob != check_logprob))
+	throw runtime_error("ERROR pruned viterbi failed -- didn't give the same viterbi log prob for length " + to_string(length) + " with margin " + to_string(margin) + ": " + to_string(logprob) + " " + to_string(check_logprob));
+    }
+    if(checktrell.ending_viterbi_log_prob() != -INFINITY) {
+      TracebackPath path(&hmm), checkpath(&hmm);
+      prunedtrell.Traceback(path);
+      checktrell.Traceback(checkpath);
+      if(!(path == checkpath))
+	throw runtime_error("ERROR pruned viterbi failed -- didn't give the same viterbi path with margin " + to_string(margin));
+    }
+  }
+  cout << "pruned viterbi ok!" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// check that pruned forward is never bigger than the real forward, and never smaller by more than its error bound (just for use by `scons test`)
+void CheckPrunedForward(Model &hmm, Sequences seqs) {
+  if(!hmm.chain_topology())
+    return;
+  Trellis checktrell(&hmm, seqs);
+  checktrell.Forward();
+  size_t seq_length(seqs.GetSequenceLength());
+  double eps(1e-10);
+  for(double tolerance : {1e-9, 1e-3, 0.5}) {
+    vector<double> min_log_probs(seq_length, INFINITY);  // only care about every other length (including the full length)
+    for(size_t length = seq_length; length > 0; length -= min(length, (size_t)2))
+      min_log_probs[length - 1] = checktrell.ending_forward_log_prob(length) + log(tolerance);
+    Trellis prunedtrell(&hmm, seqs);
+    prunedtrell.Forward(&min_log_probs);
+    for(size_t length = 1; length <= seq_length; ++length) {
+      double logprob(prunedtrell.ending_forward_log_prob(length)), check_logprob(checktrell.ending_forward_log_prob(length)), error(prunedtrell.forward_error_log_prob(length));
+      if(logprob > check_logprob + eps * max(1., fabs(check_logprob)))
+	throw runtime_error("ERROR pruned forward failed -- log prob for length " + to_string(length) + " bigger than without pruning: " + to_string(logprob) + " " + to_string(check_logprob));
+      if(check_logprob != -INFINITY && AddInLogSpace(logprob, error) < check_logprob - eps * max(1., fabs(check_logprob)))
+	throw runtime_error("ERROR pruned forward failed -- log prob for length " + to_string(length) + " more than the error bound " + to_string(error) + " below the real one: " + to_string(logprob) + " " + to_string(check_logprob));
+    }
+  }
+  cout << "pruned forward ok!" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+void Benchmark(Model &hmm, Sequences seqs, int n_repeats) {
+  vector<string> names{"viterbi", "forward", "scaled forward", "viterbi+forward"};
+  if(hmm.chain_topology()) {  // i.e. the first two used ChainTrellis
+    names.push_back("generic viterbi");
+    names.push_back("generic forward");
+  }
+  for(auto &name : names) {
+    auto start(chrono::steady_clock::now());
+    for(int irep = 0; irep < n_repeats; ++irep) {
+      Trellis trell(&hmm, seqs);
+      if(name.find("generic") == 0)
+        trell.set_use_chain_trellis(false);
+      if(name == "viterbi+forward") {
+        trell.set_use_chain_trellis(false);
+        trell.ViterbiAndForward();
+        TracebackPath path(&hmm);
+        trell.Traceback(path);
+      } else if(name.find("viterbi") != string::npos) {
+        trell.Viterbi();
+        TracebackPath path(&hmm);
+        trell.Traceback(path);
+      } else if(name.find("forward") != string::npos && name != "scaled forward") {
+        trell.Forward();
+      } else {
+        trell.ScaledForward();
+      }
+    }
+    double seconds(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    printf("  %-16s %8.4f ms per call (%d calls)\n", name.c_str(), 1e3 * seconds / n_repeats, n_repeats);
+  }
+}
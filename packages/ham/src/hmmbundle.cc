@@ -0,0 +1,50 @@
+#include <iostream>
+#include <string>
+#include <map>
+#include <dirent.h>
+
+#include "model.h"
+#include "modelbundle.h"
+#include "tclap/CmdLine.h"
+
+using namespace ham;
+using namespace TCLAP;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// compile all the hmm (.yaml) files in a directory into one ModelBundle (which you then pass to bcrham with --hmm-bundle)
+int main(int argc, const char *argv[]) {
+  ValueArg<string> hmmdir_arg("d", "hmmdir", "directory with the hmm (.yaml) model files", true, "", "string");
+  ValueArg<string> outfile_arg("o", "outfile", "output bundle file", true, "", "string");
+  try {
+    CmdLine cmd("hmmbundle -- compile a directory of hmm files into one binary bundle", ' ', "");
+    cmd.add(hmmdir_arg);
+    cmd.add(outfile_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+
+  string hmmdir(hmmdir_arg.getValue()), suffix(".yaml");
+  DIR *dir(opendir(hmmdir.c_str()));
+  if(!dir)
+    throw runtime_error("ERROR couldn't open --hmmdir " + hmmdir);
+  map<string, ModelSpec> specs;  // keyed by file name without the suffix
+  while(dirent *entry = readdir(dir)) {
+    string fname(entry->d_name);
+    if(fname.size() <= suffix.size() || fname.substr(fname.size() - suffix.size()) != suffix)
+      continue;
+    string key(fname.substr(0, fname.size() - suffix.size()));
+    specs[key] = Model::ReadSpec(hmmdir + "/" + fname);
+    Model hmm;  // make sure it's a valid model now, rather than when somebody reads the bundle
+    hmm.Init(specs[key]);
+  }
+  closedir(dir);
+  if(specs.size() == 0)
+    throw runtime_error("ERROR no hmm files in " + hmmdir);
+
+  ModelBundle::Write(outfile_arg.getValue(), specs);
+  cout << "    wrote " << specs.size() << " hmms to " << outfile_arg.getValue() << endl;
+  return 0;
+}
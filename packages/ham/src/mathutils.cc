@@ -9,4 +9,25 @@ double AddWithMinusInfinities(double first, double second) {
     return first + second;
 }
 
+// ----------------------------------------------------------------------------------------
+// NOTE these two are kept as plain loops with no branches so that -Ofast vectorizes the exp() calls (with libmvec's sse2 or avx2 versions, depending on -march)
+void ExpInPlace(double *vals, size_t n) {
+  for(size_t i = 0; i < n; ++i)
+    vals[i] = exp(vals[i]);
+}
+
+// ----------------------------------------------------------------------------------------
+// log(sum_i exp(vals[i])), shifting by the max so we only need one log (and don't underflow)
+double LogSumExp(const double *vals, size_t n) {
+  double max_val(-INFINITY);
+  for(size_t i = 0; i < n; ++i)
+    max_val = max(max_val, vals[i]);
+  if(max_val == -INFINITY)
+    return -INFINITY;
+  double total(0.);
+  for(size_t i = 0; i < n; ++i)
+    total += exp(vals[i] - max_val);
+  return max_val + log(total);
+}
+
 }
@@ -5,11 +5,17 @@ namespace ham {
 Model::Model() :
   overall_prob_(0.0),
   original_overall_mute_freq_(0.0),
-  rescale_ratio_(-INFINITY),
   ambiguous_char_(""),
   track_(nullptr),
   initial_(nullptr),
-  finalized_(false)
+  finalized_(false),
+  is_reversed_(false),
+  reversed_(nullptr),
+  n_symbols_(0),
+  max_from_states_(0),
+  chain_topology_(false),
+  n_chain_entries_(0),
+  n_chain_exits_(0)
 {
   ending_ = new State;
 }
@@ -18,6 +24,9 @@ Model::Model() :
 Model::~Model() {
   delete ending_;
   ending_ = nullptr;
+  if(is_reversed_)
+    return;
+  delete reversed_;
   for(auto &kv : states_by_name_)
     delete kv.second;
   delete track_;
@@ -25,69 +34,95 @@ Model::~Model() {
 
 // ----------------------------------------------------------------------------------------
 void Model::Parse(string infname) {
+  ModelSpec spec(ReadSpec(infname));
+  Init(spec);
+}
+
+// ----------------------------------------------------------------------------------------
+ModelSpec Model::ReadSpec(string infname) {
   if(!ifstream(infname))
     throw runtime_error("input file " + infname + " does not exist.");
 
   // load yaml
   YAML::Node config = YAML::LoadFile(infname);
+  ModelSpec spec;
   // first get model-wide information
   try {
-    name_ = config["name"].as<string>();
+    spec.name_ = config["name"].as<string>();
     if(config["extras"] && config["extras"]["gene_prob"])
-      overall_prob_ = config["extras"]["gene_prob"].as<double>();
+      spec.gene_prob_ = config["extras"]["gene_prob"].as<double>();
     if(config["extras"] && config["extras"]["overall_mute_freq"])
-      original_overall_mute_freq_ = config["extras"]["overall_mute_freq"].as<double>();
+      spec.overall_mute_freq_ = config["extras"]["overall_mute_freq"].as<double>();
     if(config["extras"]["ambiguous_char"])
-      ambiguous_char_ = config["extras"]["ambiguous_char"].as<string>();
+      spec.ambiguous_char_ = config["extras"]["ambiguous_char"].as<string>();
   } catch(...) {
     cerr << "ERROR invalid model header info in " << infname << endl;
     throw;
   }
 
+  Track track;  // only for looking up the emission symbols (the model makes its own from <spec>)
   try {
     // and the tracks
     YAML::Node tracks(config["tracks"]);
     assert(tracks.size() == 1);  // don't at the moment support multiple tracks
     for(YAML::const_iterator it = tracks.begin(); it != tracks.end(); ++it) {
-      assert(track_ == nullptr);  // shouldn't already be initialized
-      track_ = new Track;
-      track_->set_name(it->first.as<string>());
-      if(ambiguous_char_ != "")
-	track_->SetAmbiguous(ambiguous_char_);
-      for(size_t ic = 0; ic < it->second.size(); ++ic)
-        track_->AddSymbol(it->second[ic].as<string>());
+      spec.track_name_ = it->first.as<string>();
+      for(size_t ic = 0; ic < it->second.size(); ++ic) {
+        spec.symbols_.push_back(it->second[ic].as<string>());
+        track.AddSymbol(spec.symbols_.back());
+      }
     }
   } catch(...) {
     cerr << "ERROR invalid track specifications in " << infname << endl;
     throw;
   }
 
-  // then push back each state name
-  vector<string> state_names;
-  for(size_t is = 0; is < config["states"].size(); ++is) {
-    string name;
+  // then parse the info for each state
+  for(size_t ist = 0; ist < config["states"].size(); ++ist) {
     try {
-      name = config["states"][is]["name"].as<string>();
+      spec.states_.push_back(State::ReadSpec(config["states"][ist], &track));
     } catch(...) {
-      cerr << "ERROR invalid state name in " << infname << endl;
+      cerr << "ERROR invalid specification for state " << ist << " in " << infname << endl;
       throw;
     }
+  }
+
+  return spec;
+}
+
+// ----------------------------------------------------------------------------------------
+void Model::Init(ModelSpec &spec) {
+  name_ = spec.name_;
+  overall_prob_ = spec.gene_prob_;
+  original_overall_mute_freq_ = spec.overall_mute_freq_;
+  ambiguous_char_ = spec.ambiguous_char_;
+
+  assert(track_ == nullptr);  // shouldn't already be initialized
+  track_ = new Track;
+  track_->set_name(spec.track_name_);
+  if(ambiguous_char_ != "")
+    track_->SetAmbiguous(ambiguous_char_);
+  for(auto &symbol : spec.symbols_)
+    track_->AddSymbol(symbol);
+
+  // first push back each state name
+  vector<string> state_names;
+  for(auto &state_spec : spec.states_) {
     for(auto chkname : state_names) {
-      if(name == chkname) {
-        cerr << "ERROR added two states with name '" << name << "'" << endl;
-        throw;
-      }
+      if(state_spec.name_ == chkname)
+        throw runtime_error("ERROR added two states with name '" + chkname + "' in " + name_);
     }
-    state_names.push_back(name);
+    state_names.push_back(state_spec.name_);
   }
 
-  // then actually parse the info for each state
-  for(size_t ist = 0; ist < state_names.size(); ++ist) {
+  // then actually make each state
+  for(auto &state_spec : spec.states_) {
     State *state(new State);
     try {
-      state->Parse(config["states"][ist], state_names, track_);
+      state->Init(state_spec, state_names, track_);
     } catch(...) {
-      cerr << "ERROR invalid specification for state '" << state_names[ist] << "' in " << infname << endl;
+      cerr << "ERROR invalid specification for state '" << state_spec.name_ << "' in " << name_ << endl;
+      delete state;
       throw;
     }
 
@@ -113,27 +148,20 @@ void Model::AddState(State* state) {
 }
 
 // ----------------------------------------------------------------------------------------
-void Model::RescaleOverallMuteFreq(double overall_mute_freq) {
+EmissionTable Model::RescaledEmissions(double overall_mute_freq) {
   assert(overall_mute_freq != -INFINITY);
 
   if(original_overall_mute_freq_ == 0.0)
     throw runtime_error("model.cc: tried to rescale overall mut freqs with zero original_overall_mute_freq_");
 
   // cout << "rescaling " << name_ << " from " << original_overall_mute_freq_ << " to " << overall_mute_freq << endl;
-  for(auto &state : states_) {
-    // NOTE it is arguable that the denominator here should be the original mute freq only over the sequences that had
-    //  *this* germline gene (rather than over all sequence in the data set). However, it'd be a bunch more work to do
-    //  it that way, and even if it's more correcter, I don't think it'd make much difference
-    double factor = max(0.01, overall_mute_freq) / original_overall_mute_freq_;  // NOTE the 1% is kind of a hack (to protect against zero) -- but it's roughly equal to the uncertainty on our mute freq estimates, so it's reasonable
-    state->RescaleOverallMuteFreq(factor);  // REMINDER still not in log space
-  }
-}
-
-// ----------------------------------------------------------------------------------------
-void Model::UnRescaleOverallMuteFreq() {
-  // cout << "  unrescaling" << endl;
-  for(auto &state : states_)
-    state->UnRescaleOverallMuteFreq();
+  // NOTE it is arguable that the denominator here should be the original mute freq only over the sequences that had
+  //  *this* germline gene (rather than over all sequence in the data set). However, it'd be a bunch more work to do
+  //  it that way, and even if it's more correcter, I don't think it'd make much difference
+  double factor = max(0.01, overall_mute_freq) / original_overall_mute_freq_;  // NOTE the 1% is kind of a hack (to protect against zero) -- but it's roughly equal to the uncertainty on our mute freq estimates, so it's reasonable
+  EmissionTable emissions;
+  CompileEmissions(emissions, factor);
+  return emissions;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -160,9 +188,282 @@ void Model::Finalize() {
 
   AddMaybeFasterFromStateStuff();  // TODO should really somehow be integrated into FinalizeState() (?)
 
+  Compile();
+  DetectChainTopology();
+
+  finalized_ = true;
+
+  reversed_ = new Model;
+  reversed_->InitReversed(this);
+}
+
+// ----------------------------------------------------------------------------------------
+void Model::InitReversed(Model *forward) {
+  name_ = forward->name_;
+  overall_prob_ = forward->overall_prob_;
+  original_overall_mute_freq_ = forward->original_overall_mute_freq_;
+  ambiguous_char_ = forward->ambiguous_char_;
+  track_ = forward->track_;
+  states_ = forward->states_;
+  initial_ = forward->initial_;
+  is_reversed_ = true;
+  reversed_ = forward;
+
+  // our from-states are <forward>'s to-states, and vice versa
+  size_t n_st(states_.size());
+  from_offsets_.assign(1, 0);
+  from_indices_.clear();
+  from_logprobs_.clear();
+  to_offsets_.assign(1, 0);
+  to_indices_.clear();
+  initial_to_indices_.clear();
+  for(size_t ist = 0; ist < n_st; ++ist) {
+    for(size_t ito = forward->to_begin(ist); ito < forward->to_end(ist); ++ito) {
+      from_indices_.push_back(forward->to_index(ito));
+      from_logprobs_.push_back(forward->TransitionLogprob(ist, forward->to_index(ito)));
+    }
+    from_offsets_.push_back(from_indices_.size());
+    max_from_states_ = max(max_from_states_, from_offsets_[ist + 1] - from_offsets_[ist]);
+    for(size_t ifrom = forward->from_begin(ist); ifrom < forward->from_end(ist); ++ifrom)
+      to_indices_.push_back(forward->from_index(ifrom));
+    to_offsets_.push_back(to_indices_.size());
+    if(forward->end_logprob(ist) != -INFINITY)
+      initial_to_indices_.push_back(ist);
+  }
+  init_logprobs_ = forward->end_logprobs_;
+  end_logprobs_ = forward->init_logprobs_;
+  from_probs_ = get_exp_vector(from_logprobs_);
+  end_probs_ = get_exp_vector(end_logprobs_);
+  init_probs_ = get_exp_vector(init_logprobs_);
+
+  n_symbols_ = forward->n_symbols_;
+  emissions_ = forward->emissions_;
+  DetectChainTopology();
+
   finalized_ = true;
 }
 
+// ----------------------------------------------------------------------------------------
+// NOTE the trellis only uses these arrays (and the emission tables), never the State/Transition objects
+void Model::Compile() {
+  size_t n_st(states_.size());
+  from_offsets_.assign(1, 0);
+  from_indices_.clear();
+  from_logprobs_.clear();
+  to_offsets_.assign(1, 0);
+  to_indices_.clear();
+  initial_to_indices_.clear();
+  end_logprobs_.assign(n_st, -INFINITY);
+  init_logprobs_.assign(n_st, -INFINITY);
+  for(size_t ist = 0; ist < n_st; ++ist) {
+    for(auto &ifrom : *states_[ist]->from_state_indices()) {
+      from_indices_.push_back(ifrom);
+      from_logprobs_.push_back(states_[ifrom]->transition_logprob(ist));
+    }
+    from_offsets_.push_back(from_indices_.size());
+    max_from_states_ = max(max_from_states_, from_offsets_[ist + 1] - from_offsets_[ist]);
+    for(size_t ito = 0; ito < n_st; ++ito) {
+      if((*states_[ist]->to_states())[ito])
+        to_indices_.push_back(ito);
+    }
+    to_offsets_.push_back(to_indices_.size());
+    end_logprobs_[ist] = states_[ist]->end_transition_logprob();
+    if((*initial_->to_states())[ist]) {
+      init_logprobs_[ist] = initial_->transition_logprob(ist);
+      initial_to_indices_.push_back(ist);
+    }
+  }
+
+  from_probs_ = get_exp_vector(from_logprobs_);
+  end_probs_ = get_exp_vector(end_logprobs_);
+  init_probs_ = get_exp_vector(init_logprobs_);
+
+  n_symbols_ = track_->alphabet_size() + 1;
+  CompileEmissions(emissions_);
+}
+
+// ----------------------------------------------------------------------------------------
+void Model::CompileEmissions(EmissionTable &emissions, double factor) {
+  emissions = EmissionTable(states_.size(), n_symbols_);
+  for(size_t ist = 0; ist < states_.size(); ++ist) {
+    vector<double> log_probs(factor == -INFINITY ? states_[ist]->emission_log_probs() : states_[ist]->RescaledEmissionLogprobs(factor));
+    for(size_t isym = 0; isym < n_symbols_ - 1; ++isym)
+      emissions.log_probs_[ist*n_symbols_ + isym] = log_probs[isym];
+    if(states_[ist]->ambiguous_char() != "")
+      emissions.log_probs_[ist*n_symbols_ + n_symbols_ - 1] = states_[ist]->EmissionLogprob(track_->ambiguous_index());
+  }
+  emissions.probs_ = get_exp_vector(emissions.log_probs_);
+}
+
+// ----------------------------------------------------------------------------------------
+double Model::TransitionLogprob(size_t ist_from, size_t ist_to) {
+  for(size_t ifrom = from_begin(ist_to); ifrom < from_end(ist_to); ++ifrom) {
+    if(from_index(ifrom) == ist_from)
+      return from_logprob(ifrom);
+  }
+  return -INFINITY;
+}
+
+// ----------------------------------------------------------------------------------------
+// see if the model is left inserts + linear chain + right inserts (see model.h), and if so set up the info that ChainTrellis needs
+void Model::DetectChainTopology() {
+  chain_topology_ = false;
+  size_t n_st(states_.size());
+
+  // states with self transitions are inserts, and everybody else has to be in one linear chain
+  vector<bool> is_insert(n_st, false);
+  for(size_t ist = 0; ist < n_st; ++ist)
+    is_insert[ist] = (*states_[ist]->to_states())[ist];
+  vector<int> next(n_st, -1);
+  vector<size_t> n_previous(n_st, 0);
+  size_t n_chain(0);
+  for(size_t ist = 0; ist < n_st; ++ist) {
+    if(is_insert[ist])
+      continue;
+    ++n_chain;
+    for(size_t ito = to_begin(ist); ito < to_end(ist); ++ito) {
+      if(is_insert[to_index(ito)])
+        continue;
+      if(next[ist] != -1)  // more than one non-insert to-state
+        return;
+      next[ist] = to_index(ito);
+      ++n_previous[to_index(ito)];
+    }
+  }
+  if(n_chain == 0)
+    return;
+  int head(-1);
+  for(size_t ist = 0; ist < n_st; ++ist) {
+    if(is_insert[ist])
+      continue;
+    if(n_previous[ist] > 1)
+      return;
+    if(n_previous[ist] == 0) {
+      if(head != -1)  // more than one chain
+        return;
+      head = ist;
+    }
+  }
+  if(head == -1)  // it's a loop
+    return;
+  vector<uint16_t> chain;
+  for(int ist = head; ist != -1; ist = next[ist])
+    chain.push_back(ist);
+  if(chain.size() != n_chain)
+    return;
+
+  // left inserts are the ones we can get to from init without going through the chain, and right inserts are the ones we can get to from the chain
+  vector<int> insert_side(n_st, 0);  // -1 for left, +1 for right
+  vector<uint16_t> to_check;
+  for(auto &ist : initial_to_indices_) {
+    if(is_insert[ist])
+      to_check.push_back(ist);
+  }
+  while(to_check.size() > 0) {
+    size_t ist(to_check.back());
+    to_check.pop_back();
+    if(insert_side[ist] != 0)
+      continue;
+    insert_side[ist] = -1;
+    for(size_t ito = to_begin(ist); ito < to_end(ist); ++ito) {
+      if(is_insert[to_index(ito)])
+        to_check.push_back(to_index(ito));
+    }
+  }
+  for(auto &ist : chain) {
+    for(size_t ito = to_begin(ist); ito < to_end(ist); ++ito) {
+      if(is_insert[to_index(ito)])
+        to_check.push_back(to_index(ito));
+    }
+  }
+  while(to_check.size() > 0) {
+    size_t ist(to_check.back());
+    to_check.pop_back();
+    if(insert_side[ist] == -1)  // reachable from both sides
+      return;
+    if(insert_side[ist] == 1)
+      continue;
+    insert_side[ist] = 1;
+    for(size_t ito = to_begin(ist); ito < to_end(ist); ++ito) {
+      if(is_insert[to_index(ito)])
+        to_check.push_back(to_index(ito));
+    }
+  }
+
+  // make sure there's no other transitions (left inserts can only go to left inserts or the chain, right inserts only to right inserts or end, and the chain only to right inserts or end besides its next state)
+  vector<uint16_t> left_inserts, right_inserts;
+  for(size_t ist = 0; ist < n_st; ++ist) {
+    if(!is_insert[ist])
+      continue;
+    if(insert_side[ist] == 0)
+      return;
+    for(size_t ito = to_begin(ist); ito < to_end(ist); ++ito) {
+      if(insert_side[ist] == -1 && is_insert[to_index(ito)] && insert_side[to_index(ito)] != -1)
+        return;
+      if(insert_side[ist] == 1 && !is_insert[to_index(ito)])
+        return;
+    }
+    if(insert_side[ist] == -1) {
+      if(end_logprob(ist) != -INFINITY)
+        return;
+      left_inserts.push_back(ist);
+    } else {
+      right_inserts.push_back(ist);
+    }
+  }
+
+  // and the chain transitions have to be nonzero, since ChainTrellis uses differences of their cumulative sums
+  vector<double> cumulative(1, 0.);
+  for(size_t ic = 0; ic + 1 < chain.size(); ++ic) {
+    double logprob(TransitionLogprob(chain[ic], chain[ic + 1]));
+    if(logprob == -INFINITY)
+      return;
+    cumulative.push_back(cumulative.back() + logprob);
+  }
+
+  left_inserts_ = left_inserts;
+  chain_ = chain;
+  right_inserts_ = right_inserts;
+  chain_cumulative_logprobs_ = cumulative;
+  size_t nl(left_inserts_.size()), nc(chain_.size()), nr(right_inserts_.size());
+  left_to_left_.assign(nl * nl, -INFINITY);
+  left_to_chain_.assign(nl * nc, -INFINITY);
+  chain_to_right_.assign(nc * nr, -INFINITY);
+  right_to_right_.assign(nr * nr, -INFINITY);
+  chain_entry_indices_.assign(nc, -1);
+  chain_exit_indices_.assign(nc, -1);
+  n_chain_entries_ = 0;
+  n_chain_exits_ = 0;
+  for(size_t il = 0; il < nl; ++il) {
+    for(size_t il_to = 0; il_to < nl; ++il_to)
+      left_to_left_[il*nl + il_to] = TransitionLogprob(left_inserts_[il], left_inserts_[il_to]);
+  }
+  for(size_t ir = 0; ir < nr; ++ir) {
+    for(size_t ir_to = 0; ir_to < nr; ++ir_to)
+      right_to_right_[ir*nr + ir_to] = TransitionLogprob(right_inserts_[ir], right_inserts_[ir_to]);
+  }
+  for(size_t ic = 0; ic < nc; ++ic) {
+    bool is_entry(init_logprob(chain_[ic]) != -INFINITY), is_exit(end_logprob(chain_[ic]) != -INFINITY);
+    for(size_t il = 0; il < nl; ++il) {
+      left_to_chain_[il*nc + ic] = TransitionLogprob(left_inserts_[il], chain_[ic]);
+      is_entry = is_entry || left_to_chain_[il*nc + ic] != -INFINITY;
+    }
+    for(size_t ir = 0; ir < nr; ++ir) {
+      chain_to_right_[ic*nr + ir] = TransitionLogprob(chain_[ic], right_inserts_[ir]);
+      is_exit = is_exit || chain_to_right_[ic*nr + ir] != -INFINITY;
+    }
+    if(is_entry)
+      chain_entry_indices_[ic] = n_chain_entries_++;
+    if(is_exit)
+      chain_exit_indices_[ic] = n_chain_exits_++;
+  }
+  left_to_left_probs_ = get_exp_vector(left_to_left_);
+  left_to_chain_probs_ = get_exp_vector(left_to_chain_);
+  chain_to_right_probs_ = get_exp_vector(chain_to_right_);
+  right_to_right_probs_ = get_exp_vector(right_to_right_);
+
+  chain_topology_ = true;
+}
 
 // ----------------------------------------------------------------------------------------
 void Model::FinalizeState(State *st) {
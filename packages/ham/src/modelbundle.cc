@@ -0,0 +1,211 @@
+#include "modelbundle.h"
+
+namespace ham {
+
+static const char bundle_magic[8] = {'H', 'A', 'M', 'B', 'N', 'D', 'L', '\0'};
+static const uint32_t bundle_byte_order = 0x01020304;  // reads back differently if the bundle was written on a machine with the other endianness
+static const uint32_t bundle_version = 1;
+
+// ----------------------------------------------------------------------------------------
+// append things to a string buffer
+class BundleWriter {
+public:
+  template <typename T> void Write(T val) { buffer_.append(reinterpret_cast<const char*>(&val), sizeof(T)); }
+  void WriteString(const string &str) {
+    Write<uint32_t>(str.size());
+    buffer_.append(str);
+  }
+  string buffer_;
+};
+
+// ----------------------------------------------------------------------------------------
+// read things back from [<pos>, <end>)
+class BundleReader {
+public:
+  BundleReader(const char *pos, const char *end, string fname) : pos_(pos), end_(end), fname_(fname) {}
+  template <typename T> T Read() {
+    Check(sizeof(T));
+    T val;
+    memcpy(&val, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return val;
+  }
+  string ReadString() {
+    uint32_t length(Read<uint32_t>());
+    Check(length);
+    string str(pos_, length);
+    pos_ += length;
+    return str;
+  }
+private:
+  void Check(size_t n_bytes) {
+    if(n_bytes > (size_t)(end_ - pos_))
+      throw runtime_error("ERROR hmm bundle " + fname_ + " is truncated or corrupt");
+  }
+  const char *pos_, *end_;
+  string fname_;
+};
+
+// ----------------------------------------------------------------------------------------
+ModelBundle::ModelBundle(string fname) : fname_(fname), data_(nullptr), size_(0) {
+  int fd(open(fname_.c_str(), O_RDONLY));
+  if(fd < 0)
+    throw runtime_error("ERROR couldn't open hmm bundle " + fname_);
+  struct stat st;
+  void *mapped(MAP_FAILED);
+  if(fstat(fd, &st) == 0 && st.st_size > 0) {
+    size_ = st.st_size;
+    mapped = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);  // NOTE the mapping stays valid after we close it
+  if(mapped == MAP_FAILED)
+    throw runtime_error("ERROR couldn't mmap hmm bundle " + fname_);
+  data_ = static_cast<char*>(mapped);
+
+  try {
+    ReadIndex();
+  } catch(...) {  // the destructor won't run, so we have to unmap it ourselves
+    munmap(data_, size_);
+    throw;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void ModelBundle::ReadIndex() {
+  BundleReader reader(data_, data_ + size_, fname_);
+  char magic[sizeof(bundle_magic)];
+  for(size_t ic = 0; ic < sizeof(bundle_magic); ++ic)
+    magic[ic] = reader.Read<char>();
+  if(memcmp(magic, bundle_magic, sizeof(bundle_magic)) != 0)
+    throw runtime_error("ERROR " + fname_ + " isn't an hmm bundle");
+  if(reader.Read<uint32_t>() != bundle_byte_order)
+    throw runtime_error("ERROR hmm bundle " + fname_ + " was written on a machine with different byte order");
+  uint32_t version(reader.Read<uint32_t>());
+  if(version != bundle_version)
+    throw runtime_error("ERROR hmm bundle " + fname_ + " has version " + to_string(version) + ", but we can only read version " + to_string(bundle_version) + " (recompile it with hmmbundle)");
+  uint32_t n_models(reader.Read<uint32_t>());
+  for(size_t im = 0; im < n_models; ++im) {
+    string key(reader.ReadString());
+    uint64_t offset(reader.Read<uint64_t>());
+    uint64_t size(reader.Read<uint64_t>());
+    if(offset > size_ || size > size_ - offset)
+      throw runtime_error("ERROR hmm bundle " + fname_ + " has a bad index entry for " + key);
+    index_[key] = pair<size_t, size_t>(offset, size);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+ModelBundle::~ModelBundle() {
+  if(data_)
+    munmap(data_, size_);
+}
+
+// ----------------------------------------------------------------------------------------
+vector<string> ModelBundle::keys() {
+  vector<string> keys;
+  for(auto &kv : index_)
+    keys.push_back(kv.first);
+  return keys;
+}
+
+// ----------------------------------------------------------------------------------------
+ModelSpec ModelBundle::GetSpec(string key) {
+  if(index_.count(key) == 0)
+    throw runtime_error("ERROR hmm bundle " + fname_ + " doesn't have " + key);
+  size_t offset(index_[key].first), size(index_[key].second);
+  BundleReader reader(data_ + offset, data_ + offset + size, fname_);
+
+  ModelSpec spec;
+  spec.name_ = reader.ReadString();
+  spec.gene_prob_ = reader.Read<double>();
+  spec.overall_mute_freq_ = reader.Read<double>();
+  spec.ambiguous_char_ = reader.ReadString();
+  spec.track_name_ = reader.ReadString();
+  uint32_t n_symbols(reader.Read<uint32_t>());
+  for(size_t isym = 0; isym < n_symbols; ++isym)
+    spec.symbols_.push_back(reader.ReadString());
+
+  uint32_t n_states(reader.Read<uint32_t>());
+  spec.states_.resize(n_states);
+  for(auto &state_spec : spec.states_) {
+    state_spec.name_ = reader.ReadString();
+    state_spec.germline_nuc_ = reader.ReadString();
+    state_spec.ambiguous_char_ = reader.ReadString();
+    state_spec.ambiguous_emission_prob_ = reader.Read<double>();
+    uint32_t n_transitions(reader.Read<uint32_t>());
+    for(size_t it = 0; it < n_transitions; ++it) {
+      string to_state(reader.ReadString());
+      state_spec.transitions_.push_back(pair<string, double>(to_state, reader.Read<double>()));
+    }
+    uint32_t n_emissions(reader.Read<uint32_t>());
+    for(size_t ie = 0; ie < n_emissions; ++ie)
+      state_spec.emission_probs_.push_back(reader.Read<double>());
+  }
+
+  return spec;
+}
+
+// ----------------------------------------------------------------------------------------
+void ModelBundle::Write(string fname, map<string, ModelSpec> &specs) {
+  // first make the records, so we know where each of them goes
+  vector<string> records;
+  for(auto &kv : specs) {
+    ModelSpec &spec(kv.second);
+    BundleWriter writer;
+    writer.WriteString(spec.name_);
+    writer.Write<double>(spec.gene_prob_);
+    writer.Write<double>(spec.overall_mute_freq_);
+    writer.WriteString(spec.ambiguous_char_);
+    writer.WriteString(spec.track_name_);
+    writer.Write<uint32_t>(spec.symbols_.size());
+    for(auto &symbol : spec.symbols_)
+      writer.WriteString(symbol);
+
+    writer.Write<uint32_t>(spec.states_.size());
+    for(auto &state_spec : spec.states_) {
+      writer.WriteString(state_spec.name_);
+      writer.WriteString(state_spec.germline_nuc_);
+      writer.WriteString(state_spec.ambiguous_char_);
+      writer.Write<double>(state_spec.ambiguous_emission_prob_);
+      writer.Write<uint32_t>(state_spec.transitions_.size());
+      for(auto &trans_spec : state_spec.transitions_) {
+	writer.WriteString(trans_spec.first);
+	writer.Write<double>(trans_spec.second);
+      }
+      writer.Write<uint32_t>(state_spec.emission_probs_.size());
+      for(auto &prob : state_spec.emission_probs_)
+	writer.Write<double>(prob);
+    }
+    records.push_back(writer.buffer_);
+  }
+
+  // then the header and index
+  size_t header_size(sizeof(bundle_magic) + 3 * sizeof(uint32_t));
+  for(auto &kv : specs)
+    header_size += sizeof(uint32_t) + kv.first.size() + 2 * sizeof(uint64_t);
+  BundleWriter header;
+  header.buffer_.append(bundle_magic, sizeof(bundle_magic));
+  header.Write<uint32_t>(bundle_byte_order);
+  header.Write<uint32_t>(bundle_version);
+  header.Write<uint32_t>(specs.size());
+  size_t offset(header_size), irec(0);
+  for(auto &kv : specs) {
+    header.WriteString(kv.first);
+    header.Write<uint64_t>(offset);
+    header.Write<uint64_t>(records[irec].size());
+    offset += records[irec].size();
+    ++irec;
+  }
+  assert(header.buffer_.size() == header_size);
+
+  ofstream ofs(fname, ios::binary);
+  if(!ofs.is_open())
+    throw runtime_error("ERROR couldn't open " + fname + " for writing");
+  ofs.write(header.buffer_.data(), header.buffer_.size());
+  for(auto &record : records)
+    ofs.write(record.data(), record.size());
+  if(!ofs)
+    throw runtime_error("ERROR failed writing hmm bundle " + fname);
+}
+
+}
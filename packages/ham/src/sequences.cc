@@ -110,7 +110,7 @@ Sequences Sequences::Union(Sequences &otherseqs) {
   return union_seqs;
 }
 // ----------------------------------------------------------------------------------------
-Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) : sequence_length_(0) {
+Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) : sequence_length_(0), n_profile_symbols_(0) {
   for(auto & seq : seqs.seqs_)
     AddSeq(Sequence(seq, pos, len));
 }
@@ -134,11 +134,73 @@ void Sequences::Print() {
 void Sequences::AddSeq(Sequence sq) {
   if(n_seqs() == 0) {  // if this is the first sequence, set <sequence_length_>
     sequence_length_ = sq.size();
+    n_profile_symbols_ = sq.track()->alphabet_size() + 1;
+    profile_.assign(sequence_length_ * n_profile_symbols_, 0);
   } else {
     if(sq.size() != sequence_length_)  // all sequences must have the same length
       throw runtime_error("Sequences::AddSeq() sequences must all have the same length, but got " + to_string(sq.size()) + " and " + to_string(sequence_length_));
   }
   seqs_.push_back(sq);  // NOTE we now own this sequence, i.e. we will delete it when we die
+
+  uint8_t ambiguous_index(sq.track()->ambiguous_index());
+  for(size_t pos = 0; pos < sequence_length_; ++pos) {
+    uint8_t ch(sq.value(pos));
+    size_t isym = ch == ambiguous_index ? n_profile_symbols_ - 1 : ch;
+    assert(isym < n_profile_symbols_);
+    ++profile_[pos*n_profile_symbols_ + isym];
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+PackedSeq::PackedSeq(Track *trk, const string &undigitized) :
+  size_(undigitized.size()),
+  n_ambiguous_(0),
+  bits_((size_ + 31) / 32, 0),
+  ambig_mask_((size_ + 31) / 32, 0)
+{
+  for(size_t pos = 0; pos < 32 * bits_.size(); ++pos) {
+    size_t iword(pos / 32), shift(2 * (pos % 32));
+    uint8_t ch(pos < size_ ? trk->symbol_index(undigitized.substr(pos, 1)) : trk->ambiguous_index());
+    if(ch == trk->ambiguous_index()) {
+      ambig_mask_[iword] |= uint64_t(1) << shift;
+      if(pos < size_)
+	++n_ambiguous_;
+    } else {
+      if(ch > 3)
+	throw runtime_error("PackedSeq can only handle alphabets with four symbols, but got symbol index " + to_string(ch) + " in " + trk->Stringify());
+      bits_[iword] |= uint64_t(ch) << shift;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void PackedSeq::HammingDistance(const PackedSeq &rhs, unsigned &distance, unsigned &len_excluding_ambigs) const {
+  if(rhs.size_ != size_)
+    throw runtime_error("sequences different length in PackedSeq::HammingDistance(): " + to_string(size_) + " " + to_string(rhs.size_));
+  const uint64_t low_bits(0x5555555555555555ULL);  // low bit of each position
+  distance = 0;
+  len_excluding_ambigs = 0;
+  for(size_t iword = 0; iword < bits_.size(); ++iword) {
+    uint64_t xored(bits_[iword] ^ rhs.bits_[iword]);
+    uint64_t mismatches((xored | (xored >> 1)) & low_bits);  // low bit is set if either bit of the position differs
+    uint64_t unambiguous(~(ambig_mask_[iword] | rhs.ambig_mask_[iword]) & low_bits);
+    distance += __builtin_popcountll(mismatches & unambiguous);
+    len_excluding_ambigs += __builtin_popcountll(unambiguous);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+unsigned PackedSeq::FullHammingDistance(const PackedSeq &rhs) const {
+  if(rhs.size_ != size_)
+    throw runtime_error("sequences different length in PackedSeq::FullHammingDistance(): " + to_string(size_) + " " + to_string(rhs.size_));
+  const uint64_t low_bits(0x5555555555555555ULL);
+  unsigned distance(0);
+  for(size_t iword = 0; iword < bits_.size(); ++iword) {
+    uint64_t xored(bits_[iword] ^ rhs.bits_[iword]);  // NOTE ambiguous positions have zeroes in <bits_>
+    uint64_t mismatches((xored | (xored >> 1)) & low_bits);
+    distance += __builtin_popcountll(mismatches | (ambig_mask_[iword] ^ rhs.ambig_mask_[iword]));  // (both masks only have low bits set)
+  }
+  return distance;
 }
 
 }
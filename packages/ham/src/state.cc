@@ -25,24 +25,53 @@ State::~State() {
 }
 
 // ----------------------------------------------------------------------------------------
-void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
-  name_ = node["name"].as<string>();
-  assert(name_.size() > 0);
+StateSpec State::ReadSpec(YAML::Node node, Track *track) {
+  StateSpec spec;
+  spec.name_ = node["name"].as<string>();
   if(node["extras"]["germline"])
-    germline_nuc_ = node["extras"]["germline"].as<string>();
+    spec.germline_nuc_ = node["extras"]["germline"].as<string>();
   if(node["extras"]["ambiguous_emission_prob"])
-    ambiguous_emission_logprob_ = log(node["extras"]["ambiguous_emission_prob"].as<double>());
+    spec.ambiguous_emission_prob_ = node["extras"]["ambiguous_emission_prob"].as<double>();
   if(node["extras"]["ambiguous_char"])
-    ambiguous_char_ = node["extras"]["ambiguous_char"].as<string>();
+    spec.ambiguous_char_ = node["extras"]["ambiguous_char"].as<string>();
+
+  for(YAML::const_iterator it = node["transitions"].begin(); it != node["transitions"].end(); ++it)
+    spec.transitions_.push_back(pair<string, double>(it->first.as<string>(), it->second.as<double>()));
+
+  // emissions
+  if(spec.name_ == "init")
+    return spec;
+
+  // make sure at least one emission was specified
+  if(node["emissions"].IsNull()) {
+    stringstream node_ss;
+    node_ss << node;
+    throw runtime_error("no emissions found in " + node_ss.str());
+  }
+  YAML::Node probs(node["emissions"]["probs"]);
+  if(probs.size() != track->alphabet_size())
+    throw runtime_error("ERROR emission probabilities (" + to_string(probs.size()) + ") not the same length as the alphavet passed to lexical table constructor (" + to_string(track->alphabet_size()) + "). Yes, a v! Hobgoblins and smallness, yo.");
+  for(size_t ip = 0; ip < track->alphabet_size(); ++ip)
+    spec.emission_probs_.push_back(probs[track->symbol(ip)].as<double>());  // NOTE probs are stored as dicts in the file, so <probs> is unordered
+  return spec;
+}
+
+// ----------------------------------------------------------------------------------------
+void State::Init(StateSpec &spec, vector<string> &state_names, Track *track) {
+  name_ = spec.name_;
+  assert(name_.size() > 0);
+  germline_nuc_ = spec.germline_nuc_;
+  ambiguous_emission_logprob_ = log(spec.ambiguous_emission_prob_);  // NOTE -INFINITY if it wasn't specified
+  ambiguous_char_ = spec.ambiguous_char_;
 
   double total(0.0); // make sure things add to 1.0
-  for(YAML::const_iterator it = node["transitions"].begin(); it != node["transitions"].end(); ++it) {
-    string to_state(it->first.as<string>());
+  for(auto &trans_spec : spec.transitions_) {
+    string to_state(trans_spec.first);
     if(to_state != "end" && find(state_names.begin(), state_names.end(), to_state) == state_names.end()) {   // make sure transition is either to "end", or to a state that we know about
       cout << "ERROR attempted to add transition to unknown state \"" << to_state << "\"" << endl;
       throw runtime_error("configuration");
     }
-    double prob(it->second.as<double>());
+    double prob(trans_spec.second);
     total += prob;
     Transition *trans = new Transition(to_state, prob);
     if(trans->to_state_name() == "end")
@@ -53,30 +82,22 @@ void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
   // NOTE it would be better to use something cleverer than a hard coded EPS that I just pulled ooma
   if(fabs(total - 1.0) >= EPS) { // make sure transition probs sum to 1.0
     cerr << "ERROR normalization failed on transitions in state \"" << name_ << "\"" << endl;
-    cerr << node << endl;
     throw runtime_error("configuration");
   }
 
   // emissions
   if(name_ == "init")
     return;
-
-  // make sure at least one emission was specified
-  if(node["emissions"].IsNull()) {
-    stringstream node_ss;
-    node_ss << node;
-    throw runtime_error("no emissions found in " + node_ss.str());
-  }
-  emission_.Parse(node["emissions"], track);
+  emission_.Init(spec.emission_probs_, track);
 }
 
 // ----------------------------------------------------------------------------------------
-void State::RescaleOverallMuteFreq(double factor) {
+vector<double> State::RescaledEmissionLogprobs(double factor) {
   if(germline_nuc_ == ambiguous_char_ || germline_nuc_ == "")  // if the germline state is N, or if this state has no germline (most likely fv or jf insertion)
-    return;
+    return emission_.log_probs();
 
   if(factor <= 0.0 || factor > 15.)  // 15 is pretty much arbitrary, but back when I understood this code I thought it was important that the factor not be too big (which would, I think, indicate that the sequence at hand had a very, very different mutation rate to that used to build the hmm)
-    cout << "very large factor in State::RescaleOverallMuteFreq: " << to_string(factor) << endl;
+    cout << "very large factor in State::RescaledEmissionLogprobs: " << to_string(factor) << endl;
 
   assert(emission_.track()->symbol_index(germline_nuc_) < emission_.track()->alphabet_size());  // this'll throw an exception on the symbol_index call if the germline nuc is bad
 
@@ -95,7 +116,7 @@ void State::RescaleOverallMuteFreq(double factor) {
   assert(old_mute_freq > 0.);  // make sure we found the germline base
   double new_mute_freq = min(0.95, factor*old_mute_freq);  // .95 is kind of arbitrary, but from looking at lots of plots, the only cases where the extrapolation flies above 1.0 is where we have little information, so .95 is probably a good compromise
   if(new_mute_freq <= 0.0 || new_mute_freq >= 1.0)
-    throw runtime_error("new_mute_freq not in (0,1) (" + to_string(new_mute_freq) + ") in State::RescaleOverallMuteFreq old: " + to_string(old_mute_freq) + " factor: " + to_string(factor));
+    throw runtime_error("new_mute_freq not in (0,1) (" + to_string(new_mute_freq) + ") in State::RescaledEmissionLogprobs old: " + to_string(old_mute_freq) + " factor: " + to_string(factor));
 
   for(size_t ip=0; ip<new_log_probs.size(); ++ip) {
     bool is_germline(emission_.track()->symbol(ip) == germline_nuc_);
@@ -109,14 +130,13 @@ void State::RescaleOverallMuteFreq(double factor) {
       new_log_probs[ip] = log(exp(new_log_probs[ip]) * new_mute_freq / old_mute_freq);  // don't use <factor> because of min() call above
   }
 
-  emission_.ReplaceLogProbs(new_log_probs);
-}
+  double total(0.0); // make sure things add to 1.0
+  for(size_t ip=0; ip<new_log_probs.size(); ++ip)
+    total += exp(new_log_probs[ip]);
+  if(fabs(total - 1.0) >= EPS)
+    throw runtime_error("ERROR bad normalization after rescaling " + to_string(total) + " in State::RescaledEmissionLogprobs()\n");
 
-// ----------------------------------------------------------------------------------------
-void State::UnRescaleOverallMuteFreq() {
-  if(germline_nuc_ == ambiguous_char_ || germline_nuc_ == "")  // if the germline state is N, or if this state has no germline (most likely fv or jf insertion)
-    return;
-  emission_.UnReplaceLogProbs();
+  return new_log_probs;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -129,9 +149,18 @@ double State::EmissionLogprob(uint8_t ch) {
 
 // ----------------------------------------------------------------------------------------
 double State::EmissionLogprob(Sequences *seqs, size_t pos) {
+  // use the symbol counts at <pos>, so this is a dot product over the alphabet rather than a loop over sequences
   double logprob(0.);  // multiplying probabilities, so initial prob value should be 1.
-  for(size_t iseq=0; iseq<seqs->n_seqs(); ++iseq)
-    logprob = AddWithMinusInfinities(logprob, EmissionLogprob((*seqs->get_ptr(iseq))[pos]));
+  for(size_t isym=0; isym<seqs->n_profile_symbols(); ++isym) {
+    unsigned count(seqs->profile_count(pos, isym));
+    if(count == 0)
+      continue;
+    uint8_t ch = isym == seqs->n_profile_symbols() - 1 ? emission_.track()->ambiguous_index() : isym;
+    double symbol_logprob(EmissionLogprob(ch));
+    if(symbol_logprob == -INFINITY)
+      return -INFINITY;
+    logprob += count * symbol_logprob;
+  }
 
 // // ----------------------------------------------------------------------------------------
 //   // potential way of accounting for shared mutations (i.e. moving off the star-tree assumption). The main practical problem it attempts to fix is over-long insertions/deletions. Unfortunately in this form it fixes this problem but, in aggregate, casues other inaccuracies that overshadow it.
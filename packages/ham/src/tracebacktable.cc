@@ -0,0 +1,19 @@
+#include "tracebacktable.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+void TracebackTable::Init(size_t n_positions, size_t n_states, size_t max_from_states) {
+  bits_ = 1;
+  while(((size_t)1 << bits_) <= max_from_states)  // need to fit values from 0 (no pointer) to <max_from_states>
+    bits_ *= 2;
+  if(bits_ > 16)
+    throw runtime_error("ERROR too many from-states (" + to_string(max_from_states) + ") for traceback table");
+  n_states_ = n_states;
+  entries_per_word_ = 64 / bits_;
+  mask_ = ((uint64_t)1 << bits_) - 1;
+  size_t n_entries(n_positions * n_states);
+  words_.assign((n_entries + entries_per_word_ - 1) / entries_per_word_, 0);  // NOTE assign() keeps the old capacity, so this doesn't reallocate unless we need more space
+}
+
+}
@@ -5,7 +5,8 @@ namespace ham {
 // ----------------------------------------------------------------------------------------
 double Trellis::ApproxBytesUsed() {
   double bytes(0.);
-  // NOTE doesn't include traceback table!
+  bytes += traceback_table_.ApproxBytesUsed();
+  bytes += chain_trellis_.ApproxBytesUsed();
   bytes += sizeof(double) * viterbi_log_probs_pointer_->size();
   bytes += sizeof(double) * forward_log_probs_pointer_->size();
   bytes += sizeof(int) * viterbi_indices_.size();
@@ -24,8 +25,9 @@ string Trellis::SizeString() {
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequence seq, Trellis *cached_trellis) :
+Trellis::Trellis(Model* hmm, Sequence seq, Trellis *cached_trellis, EmissionTable *emissions) :
   hmm_(hmm),
+  emissions_(emissions),
   cached_trellis_(cached_trellis),
   scoring_current_(hmm_->n_states(), -INFINITY),
   scoring_previous_(hmm_->n_states(), -INFINITY)
@@ -35,8 +37,9 @@ Trellis::Trellis(Model* hmm, Sequence seq, Trellis *cached_trellis) :
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis) :
+Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis, EmissionTable *emissions) :
   hmm_(hmm),
+  emissions_(emissions),
   seqs_(seqs),
   cached_trellis_(cached_trellis),
   scoring_current_(hmm_->n_states(), -INFINITY),
@@ -46,7 +49,7 @@ Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis) :
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis() : hmm_(nullptr), cached_trellis_(nullptr)
+Trellis::Trellis() : hmm_(nullptr), emissions_(nullptr), cached_trellis_(nullptr)
 {
   Init();
 }
@@ -58,8 +61,16 @@ void Trellis::Init() {
       throw runtime_error("ERROR cached trellis sequence length " + to_string(cached_trellis_->seqs().GetSequenceLength()) + " smaller than mine " + to_string(seqs_.GetSequenceLength()));
     if(hmm_ != cached_trellis_->model())
       throw runtime_error("ERROR model in cached trellis " + cached_trellis_->model()->name() + " not the same as mine " + hmm_->name());
+    if(!emissions_)
+      emissions_ = cached_trellis_->emissions();
+    if(emissions_ != cached_trellis_->emissions())
+      throw runtime_error("ERROR emissions in cached trellis for " + hmm_->name() + " not the same as mine");
   }
+  if(!emissions_ && hmm_)
+    emissions_ = hmm_->emissions();
 
+  use_chain_trellis_ = hmm_ && hmm_->chain_topology();
+  chain_trellis_pointer_ = nullptr;
   traceback_table_pointer_ = nullptr;
   viterbi_log_probs_pointer_ = nullptr;
   forward_log_probs_pointer_ = nullptr;
@@ -69,6 +80,7 @@ void Trellis::Init() {
   ending_viterbi_log_prob_ = -INFINITY;
   ending_viterbi_pointer_ = -1;
   ending_forward_log_prob_ = -INFINITY;
+  n_forward_pruned_ = 0;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -86,68 +98,213 @@ void Trellis::Dump() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
-      continue;
+void Trellis::SetProfileColumns() {
+  // NOTE we only keep the symbols that actually occur at each position, so for a clonal family there's usually only one or two per position
+  // NOTE if the model is reversed, so is the order of the positions (see Model::reversed())
+  if(seqs_.n_profile_symbols() != hmm_->n_symbols())
+    throw runtime_error("ERROR sequence alphabet size " + to_string(seqs_.n_profile_symbols()) + " doesn't match model's " + to_string(hmm_->n_symbols()) + " (both including ambiguous char)");
+  profile_offsets_.assign(1, 0);
+  profile_columns_.clear();
+  profile_counts_.clear();
+  size_t seq_length(seqs_.GetSequenceLength());
+  for(size_t position = 0; position < seq_length; ++position) {
+    size_t seq_position(hmm_->is_reversed() ? seq_length - 1 - position : position);
+    for(size_t isym = 0; isym < seqs_.n_profile_symbols(); ++isym) {
+      unsigned count(seqs_.profile_count(seq_position, isym));
+      if(count == 0)
+	continue;
+      profile_columns_.push_back(isym);
+      profile_counts_.push_back(count);
+    }
+    profile_offsets_.push_back(profile_columns_.size());
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+double Trellis::EmissionLogprob(size_t i_st, size_t position) {
+  // dot product of the symbol counts at <position> with <i_st>'s emission log probs, so the cost doesn't depend on the number of sequences
+  double logprob(0.);  // multiplying probabilities, so initial prob value should be 1.
+  for(size_t ip = profile_offsets_[position]; ip < profile_offsets_[position + 1]; ++ip) {
+    double symbol_logprob(emissions_->logprob(i_st, profile_columns_[ip]));
+    if(symbol_logprob == -INFINITY)
+      return -INFINITY;
+    logprob += profile_counts_[ip] * symbol_logprob;
+  }
+  return logprob;
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, size_t position) {
+  for(auto &i_st_current : current_states_) {  // states to which we can transition from any state through which we passed at the previous position
 
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+    double emission_val = EmissionLogprob(i_st_current, position);
     if(emission_val == -INFINITY)
       continue;
 
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
+    bool reached(false);
+    for(size_t ifrom = hmm_->from_begin(i_st_current); ifrom < hmm_->from_end(i_st_current); ++ifrom) {  // list of states from which we could've arrived at <i_st_current>
+      size_t i_st_previous(hmm_->from_index(ifrom));
       if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
 	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
+      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->from_logprob(ifrom);
       if(dpval > (*scoring_current)[i_st_current]) {
 	(*scoring_current)[i_st_current] = dpval;  // save this value as the best value we've so far come across
-	(*traceback_table_pointer_)[position][i_st_current] = i_st_previous;  // and mark which state it came from for later traceback NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+	traceback_table_pointer_->set(position, i_st_current, ifrom - hmm_->from_begin(i_st_current));  // and mark which state it came from for later traceback NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
       }
-      CacheViterbiVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
+      reached = true;
+    }
+    if(reached) {  // NOTE only include states that we actually got to from a live previous state
+      CacheViterbiVals(position, (*scoring_current)[i_st_current], i_st_current);  // only the best <dpval> for each state can change the cached values
+      AddToNextStates(i_st_current);
     }
   }
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
-      continue;
-
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+// Instead of calling AddInLogSpace() for every edge, we do each column in three passes:
+//   - gather (previous score + transition) for every live edge into <edge_vals_>, shifted by the max for its to-state
+//   - exp() all of them in one branch-free loop (which the compiler vectorizes)
+//   - sum each state's block and take one log per state
+void Trellis::MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, size_t position) {
+  size_t n_edges(0), n_live(0);
+  for(auto &i_st_current : current_states_) {  // states to which we can transition from any state through which we passed at the previous position
+
+    double emission_val = EmissionLogprob(i_st_current, position);
     if(emission_val == -INFINITY)
       continue;
 
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
+    size_t ibegin(n_edges);
+    double max_val(-INFINITY);
+    for(size_t ifrom = hmm_->from_begin(i_st_current); ifrom < hmm_->from_end(i_st_current); ++ifrom) {  // list of states from which we could've arrived at <i_st_current>
+      size_t i_st_previous(hmm_->from_index(ifrom));
       if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
 	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
-      (*scoring_current)[i_st_current] = AddInLogSpace(dpval, (*scoring_current)[i_st_current]);
-      CacheForwardVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
+      double val = (*scoring_previous)[i_st_previous] + hmm_->from_logprob(ifrom);
+      edge_vals_[n_edges++] = val;
+      max_val = max(max_val, val);
     }
+    if(n_edges == ibegin)
+      continue;
+    for(size_t ie = ibegin; ie < n_edges; ++ie)
+      edge_vals_[ie] -= max_val;
+    live_states_[n_live] = i_st_current;
+    live_edge_begins_[n_live] = ibegin;
+    live_offsets_[n_live] = max_val + emission_val;
+    ++n_live;
+    AddToNextStates(i_st_current);  // NOTE only include states that we actually got to from a live previous state
+  }
+
+  ExpInPlace(edge_vals_.data(), n_edges);
+
+  size_t n_end(0);
+  for(size_t il = 0; il < n_live; ++il) {
+    size_t iend = il + 1 < n_live ? live_edge_begins_[il + 1] : n_edges;
+    double total(0.);
+    for(size_t ie = live_edge_begins_[il]; ie < iend; ++ie)
+      total += edge_vals_[ie];
+    size_t i_st_current(live_states_[il]);
+    (*scoring_current)[i_st_current] = live_offsets_[il] + log(total);
+    if(hmm_->end_logprob(i_st_current) != -INFINITY)
+      end_vals_[n_end++] = (*scoring_current)[i_st_current] + hmm_->end_logprob(i_st_current);
+  }
+  CacheForwardVals(position, n_end);
+}
+
+// ----------------------------------------------------------------------------------------
+// the loops from MiddleViterbiVals() and MiddleForwardVals() fused together, so we only look up each state's emission and transitions once
+// NOTE the viterbi and forward columns have the same live states, so they share the frontier
+void Trellis::MiddleViterbiAndForwardVals(vector<double> *vtb_previous, vector<double> *vtb_current, vector<double> *fwd_previous, vector<double> *fwd_current, size_t position) {
+  size_t n_edges(0), n_live(0);
+  for(auto &i_st_current : current_states_) {
+
+    double emission_val = EmissionLogprob(i_st_current, position);
+    if(emission_val == -INFINITY)
+      continue;
+
+    size_t ibegin(n_edges);
+    double max_val(-INFINITY);
+    bool reached(false);
+    for(size_t ifrom = hmm_->from_begin(i_st_current); ifrom < hmm_->from_end(i_st_current); ++ifrom) {
+      size_t i_st_previous(hmm_->from_index(ifrom));
+      if((*vtb_previous)[i_st_previous] != -INFINITY) {
+	double dpval = (*vtb_previous)[i_st_previous] + emission_val + hmm_->from_logprob(ifrom);
+	if(dpval > (*vtb_current)[i_st_current]) {
+	  (*vtb_current)[i_st_current] = dpval;
+	  traceback_table_pointer_->set(position, i_st_current, ifrom - hmm_->from_begin(i_st_current));
+	}
+	reached = true;
+      }
+      if((*fwd_previous)[i_st_previous] != -INFINITY) {
+	double val = (*fwd_previous)[i_st_previous] + hmm_->from_logprob(ifrom);
+	edge_vals_[n_edges++] = val;
+	max_val = max(max_val, val);
+      }
+    }
+    if(reached)
+      CacheViterbiVals(position, (*vtb_current)[i_st_current], i_st_current);
+    if(n_edges > ibegin) {
+      for(size_t ie = ibegin; ie < n_edges; ++ie)
+	edge_vals_[ie] -= max_val;
+      live_states_[n_live] = i_st_current;
+      live_edge_begins_[n_live] = ibegin;
+      live_offsets_[n_live] = max_val + emission_val;
+      ++n_live;
+    }
+    if(reached || n_edges > ibegin)
+      AddToNextStates(i_st_current);
+  }
+
+  ExpInPlace(edge_vals_.data(), n_edges);
+
+  size_t n_end(0);
+  for(size_t il = 0; il < n_live; ++il) {
+    size_t iend = il + 1 < n_live ? live_edge_begins_[il + 1] : n_edges;
+    double total(0.);
+    for(size_t ie = live_edge_begins_[il]; ie < iend; ++ie)
+      total += edge_vals_[ie];
+    size_t i_st_current(live_states_[il]);
+    (*fwd_current)[i_st_current] = live_offsets_[il] + log(total);
+    if(hmm_->end_logprob(i_st_current) != -INFINITY)
+      end_vals_[n_end++] = (*fwd_current)[i_st_current] + hmm_->end_logprob(i_st_current);
   }
+  CacheForwardVals(position, n_end);
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states) {
-  // swap <scoring_current> and <scoring_previous>, and set <scoring_current> values to -INFINITY
+void Trellis::InitFrontier(vector<double> *scoring_current, vector<double> *scoring_previous, double empty_val) {
+  scoring_current->assign(hmm_->n_states(), empty_val);  // NOTE this is the only time we touch every entry -- after this we only reset the ones we used
+  scoring_previous->assign(hmm_->n_states(), empty_val);
+  next_mask_.assign((hmm_->n_states() + 63) / 64, 0);
+  previous_states_.clear();
+  current_states_ = *hmm_->initial_to_state_indices();  // at the first position, we need to check the states to which init can transition
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, double empty_val) {
+  // swap <scoring_current> and <scoring_previous>, and reset to <empty_val> the entries in <scoring_current> that we filled two positions ago (which are the only ones that aren't already <empty_val>)
   swap_ptr_ = scoring_previous;
   scoring_previous = scoring_current;
   scoring_current = swap_ptr_;
-  scoring_current->assign(hmm_->n_states(), -INFINITY);
+  for(auto &ist : previous_states_)
+    (*scoring_current)[ist] = empty_val;
   swap_ptr_ = nullptr;
 
-  // swap the <current_states> and <next_states> bitsets (ie set current_states to the states to which we can transition from *any* of the previous states)
-  current_states.reset();
-  current_states |= next_states;
-  next_states.reset();
+  // then move the frontier along: the current states become the previous ones, and the (sorted) states in <next_mask_> become the current ones
+  previous_states_.swap(current_states_);
+  current_states_.clear();
+  for(size_t iw = 0; iw < next_mask_.size(); ++iw) {
+    uint64_t word(next_mask_[iw]);
+    while(word != 0) {
+      current_states_.push_back(iw*64 + __builtin_ctzll(word));
+      word &= word - 1;  // unset lowest bit
+    }
+    next_mask_[iw] = 0;
+  }
 }
 
 // ----------------------------------------------------------------------------------------
 void Trellis::CacheViterbiVals(size_t position, double dpval, size_t i_st_current) {
-  double end_trans_val = hmm_->state(i_st_current)->end_transition_logprob();
+  double end_trans_val = hmm_->end_logprob(i_st_current);
   double logprob = dpval + end_trans_val;
   if(logprob > viterbi_log_probs_[position]) {
     viterbi_log_probs_[position] = logprob;  // since this is the log prob of *ending* at this point, we have to add on the prob of going to the end state from this state
@@ -156,20 +313,19 @@ void Trellis::CacheViterbiVals(size_t position, double dpval, size_t i_st_curren
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::CacheForwardVals(size_t position, double dpval, size_t i_st_current) {
-  double end_trans_val = hmm_->state(i_st_current)->end_transition_logprob();
-  double logprob = dpval + end_trans_val;
-  forward_log_probs_[position] = AddInLogSpace(logprob, forward_log_probs_[position]);
+void Trellis::CacheForwardVals(size_t position, size_t n_end_vals) {
+  forward_log_probs_[position] = LogSumExp(end_vals_.data(), n_end_vals);  // <end_vals_> has (score + end transition) for each state at <position> that can go to end
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::Viterbi() {
+void Trellis::Viterbi(vector<double> *min_log_probs) {
   if(cached_trellis_) {   // ok, rad, we have another trellis with the dp table already filled in, so we can just poach the values we need from there
     traceback_table_pointer_ = cached_trellis_->traceback_table_pointer();  // note that the table from the cached trellis is larger than we need right now (that's the whole point, after all)
     ending_viterbi_pointer_ = cached_trellis_->viterbi_pointer(seqs_.GetSequenceLength());
     ending_viterbi_log_prob_ = cached_trellis_->ending_viterbi_log_prob(seqs_.GetSequenceLength());
     viterbi_log_probs_pointer_ = cached_trellis_->viterbi_log_probs_pointer();
     viterbi_indices_pointer_ = cached_trellis_->viterbi_indices_pointer();
+    chain_trellis_pointer_ = cached_trellis_->chain_trellis_pointer();
     return;
   }
 
@@ -178,47 +334,66 @@ void Trellis::Viterbi() {
   viterbi_indices_.resize(seqs_.GetSequenceLength(), -1);
   viterbi_log_probs_pointer_ = &viterbi_log_probs_;
   viterbi_indices_pointer_ = &viterbi_indices_;
+  viterbi_min_log_probs_.clear();
+
+  if(use_chain_trellis_) {
+    SetProfileColumns();
+    chain_trellis_pointer_ = &chain_trellis_;
+    if(min_log_probs) {
+      viterbi_min_log_probs_ = *min_log_probs;
+      if(!SetPruneThresholds(*min_log_probs)) {  // nothing can get to any of the minimums, so we don't need to run anything
+	viterbi_log_probs_.assign(seqs_.GetSequenceLength(), -INFINITY);
+	viterbi_indices_.assign(seqs_.GetSequenceLength(), -1);
+	ending_viterbi_log_prob_ = -INFINITY;
+	ending_viterbi_pointer_ = -1;
+	return;
+      }
+    }
+    chain_trellis_.Viterbi(hmm_, this, seqs_.GetSequenceLength(), viterbi_log_probs_, viterbi_indices_, min_log_probs ? &prune_thresholds_ : nullptr);
+    ending_viterbi_log_prob_ = viterbi_log_probs_.back();
+    ending_viterbi_pointer_ = viterbi_indices_.back();
+    return;
+  }
+  chain_trellis_pointer_ = nullptr;
 
-  traceback_table_ = int_2D(seqs_.GetSequenceLength(), vector<int16_t>(hmm_->n_states(), -1));
+  traceback_table_.Init(seqs_.GetSequenceLength(), hmm_->n_states(), hmm_->max_from_states());
   traceback_table_pointer_ = &traceback_table_;
 
+  SetProfileColumns();
+
   vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
   vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
-  scoring_current->assign(scoring_current->size(), -INFINITY);
-  scoring_previous->assign(scoring_previous->size(), -INFINITY);
-  bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
+  InitFrontier(scoring_current, scoring_previous, -INFINITY);
 
   // first calculate log probs for first position in sequence
   size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
-      continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
+  for(auto &i_st_current : current_states_) {  // i.e. states to which init can transition
+    double emission_val = EmissionLogprob(i_st_current, position);
+    double dpval = emission_val + hmm_->init_logprob(i_st_current);
     if(dpval == -INFINITY)
       continue;
     (*scoring_current)[i_st_current] = dpval;
     CacheViterbiVals(position, dpval, i_st_current);
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
+    AddToNextStates(i_st_current);  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
   }
 
 
   // then loop over the rest of the sequence
   for(size_t position = 1; position < seqs_.GetSequenceLength(); ++position) {
-    SwapColumns(scoring_previous, scoring_current, current_states, next_states);
-    MiddleViterbiVals(scoring_previous, scoring_current, current_states, next_states, position);
+    SwapColumns(scoring_previous, scoring_current, -INFINITY);
+    MiddleViterbiVals(scoring_previous, scoring_current, position);
   }
 
-  SwapColumns(scoring_previous, scoring_current, current_states, next_states);
+  SwapColumns(scoring_previous, scoring_current, -INFINITY);  // NOTE after this, <previous_states_> has the states we checked at the last position
 
   // NOTE now that I've got the chunk caching info, it may be possible to remove this
   // calculate ending probability and get final traceback pointer
   ending_viterbi_pointer_ = -1;
   ending_viterbi_log_prob_ = -INFINITY;
-  for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
+  for(auto &st_previous : previous_states_) {
     if((*scoring_previous)[st_previous] == -INFINITY)
       continue;
-    double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
+    double dpval = (*scoring_previous)[st_previous] + hmm_->end_logprob(st_previous);
     if(dpval > ending_viterbi_log_prob_) {
       ending_viterbi_log_prob_ = dpval;  // NOTE should *not* be replaced by last entry in viterbi_log_probs_, since that does not include the ending transition
       ending_viterbi_pointer_ = st_previous;
@@ -227,7 +402,55 @@ void Trellis::Viterbi() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::Forward() {
+double Trellis::BestCaseLogProb(size_t length) {
+  if(best_case_log_probs_.size() == 0) {
+    SetProfileColumns();
+    SetBestCaseLogProbs();
+  }
+  return best_case_log_probs_.at(length);
+}
+
+// ----------------------------------------------------------------------------------------
+// optimistic log prob for each length: the best emission (over all states) at each position, and no transitions (which can only make it smaller)
+// NOTE we take the best state for each symbol separately, so for multiple sequences it's looser than it could be, but it only costs one lookup per symbol
+void Trellis::SetBestCaseLogProbs() {
+  vector<double> best_symbol_logprobs(hmm_->n_symbols(), -INFINITY);
+  for(size_t ist = 0; ist < hmm_->n_states(); ++ist) {
+    for(size_t isym = 0; isym < hmm_->n_symbols(); ++isym)
+      best_symbol_logprobs[isym] = max(best_symbol_logprobs[isym], emissions_->logprob(ist, isym));
+  }
+  best_case_log_probs_.assign(1, 0.);
+  for(size_t position = 0; position < seqs_.GetSequenceLength(); ++position) {
+    double logprob(0.);
+    for(size_t ip = profile_offsets_[position]; ip < profile_offsets_[position + 1]; ++ip)
+      logprob += profile_counts_[ip] * best_symbol_logprobs[profile_columns_[ip]];
+    best_case_log_probs_.push_back(best_case_log_probs_.back() + logprob);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Convert the minimum log prob that we care about for each length into a minimum for partial paths at each position. Since every emission
+// and transition can only make a path less likely, a partial path at <position> can get at best its log prob plus the best case for the
+// positions in between. So if that's below the minimum for every length it could reach, we can drop it.
+// Returns false if not even the best case can get to any of the minimums.
+bool Trellis::SetPruneThresholds(vector<double> &min_log_probs) {
+  if(min_log_probs.size() != seqs_.GetSequenceLength())
+    throw runtime_error("ERROR min_log_probs size " + to_string(min_log_probs.size()) + " doesn't match sequence length " + to_string(seqs_.GetSequenceLength()));
+  if(best_case_log_probs_.size() == 0)
+    SetBestCaseLogProbs();
+  prune_thresholds_.assign(seqs_.GetSequenceLength(), INFINITY);
+  double min_diff(INFINITY);  // min over lengths longer than <position> of (min log prob - best case log prob)
+  for(size_t length = seqs_.GetSequenceLength(); length > 0; --length) {
+    if(best_case_log_probs_[length] == -INFINITY)  // nothing gets this far
+      continue;
+    min_diff = min(min_diff, min_log_probs[length - 1] - best_case_log_probs_[length]);
+    prune_thresholds_[length - 1] = min_diff + best_case_log_probs_[length];
+  }
+  return min_diff <= 0.;
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::Forward(vector<double> *min_log_probs) {
   if(cached_trellis_) {
     ending_forward_log_prob_ = cached_trellis_->ending_forward_log_prob(seqs_.GetSequenceLength());
     forward_log_probs_pointer_ = cached_trellis_->forward_log_probs_pointer();
@@ -237,44 +460,239 @@ void Trellis::Forward() {
   // initialize stored values for chunk caching
   forward_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
   forward_log_probs_pointer_ = &forward_log_probs_;
+  n_forward_pruned_ = 0;
+
+  SetProfileColumns();
+  if(use_chain_trellis_) {
+    if(min_log_probs) {
+      forward_min_log_probs_ = *min_log_probs;
+      if(!SetPruneThresholds(*min_log_probs)) {  // the whole thing is less than the minimum for every length, so count it as one big dropped sum
+	forward_log_probs_.assign(seqs_.GetSequenceLength(), -INFINITY);
+	ending_forward_log_prob_ = -INFINITY;
+	n_forward_pruned_ = 1;
+	return;
+      }
+    }
+    chain_trellis_.Forward(hmm_, this, seqs_.GetSequenceLength(), forward_log_probs_, min_log_probs ? &prune_thresholds_ : nullptr, &n_forward_pruned_);
+    ending_forward_log_prob_ = forward_log_probs_.back();
+    return;
+  }
+  edge_vals_.resize(hmm_->from_end(hmm_->n_states() - 1));  // i.e. the total number of edges
+  live_states_.resize(hmm_->n_states());
+  live_edge_begins_.resize(hmm_->n_states());
+  live_offsets_.resize(hmm_->n_states());
+  end_vals_.resize(hmm_->n_states());
 
   vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
   vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
-  scoring_current->assign(scoring_current->size(), -INFINITY);
-  scoring_previous->assign(scoring_previous->size(), -INFINITY);
-  bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
+  InitFrontier(scoring_current, scoring_previous, -INFINITY);
 
   // first calculate log probs for first position in sequence
-  size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
-      continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
+  size_t position(0), n_end(0);
+  for(auto &i_st_current : current_states_) {  // i.e. states to which init can transition
+    double emission_val = EmissionLogprob(i_st_current, position);
+    double dpval = emission_val + hmm_->init_logprob(i_st_current);
     if(dpval == -INFINITY)
       continue;
     (*scoring_current)[i_st_current] = dpval;
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next column. This leaves <next_states> set to the OR of all states to which we can transition from if start from a state to which we can transition from <init>
-    CacheForwardVals(position, dpval, i_st_current);
+    AddToNextStates(i_st_current);  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next column
+    if(hmm_->end_logprob(i_st_current) != -INFINITY)
+      end_vals_[n_end++] = dpval + hmm_->end_logprob(i_st_current);
   }
+  CacheForwardVals(position, n_end);
 
   // then loop over the rest of the sequence
   for(position = 1; position < seqs_.GetSequenceLength(); ++position) {
-    SwapColumns(scoring_previous, scoring_current, current_states, next_states);
-    MiddleForwardVals(scoring_previous, scoring_current, current_states, next_states, position);
+    SwapColumns(scoring_previous, scoring_current, -INFINITY);
+    MiddleForwardVals(scoring_previous, scoring_current, position);
   }
 
-  SwapColumns(scoring_previous, scoring_current, current_states, next_states);
+  SwapColumns(scoring_previous, scoring_current, -INFINITY);  // NOTE after this, <previous_states_> has the states we checked at the last position
 
-  ending_forward_log_prob_ = -INFINITY;
-  for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
-    if((*scoring_previous)[st_previous] == -INFINITY)
+  n_end = 0;
+  for(auto &st_previous : previous_states_) {
+    if((*scoring_previous)[st_previous] == -INFINITY || hmm_->end_logprob(st_previous) == -INFINITY)
       continue;
-    double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
+    end_vals_[n_end++] = (*scoring_previous)[st_previous] + hmm_->end_logprob(st_previous);
+  }
+  ending_forward_log_prob_ = LogSumExp(end_vals_.data(), n_end);
+}
+
+// ----------------------------------------------------------------------------------------
+// Same as Forward(), but in probability space, with each column rescaled to sum to one (Rabiner's scaled forward algorithm). The log prob is
+// then the sum of the logs of the scale factors, so we need one log per column, rather than an exp and a log per edge.
+// NOTE states whose probability is more than about e^-708 smaller than the column total underflow to zero, i.e. they're dropped
+void Trellis::ScaledForward() {
+  if(cached_trellis_) {  // NOTE the cached trellis's values are in log space regardless of which forward it ran
+    ending_forward_log_prob_ = cached_trellis_->ending_forward_log_prob(seqs_.GetSequenceLength());
+    forward_log_probs_pointer_ = cached_trellis_->forward_log_probs_pointer();
+    return;
+  }
+
+  forward_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
+  forward_log_probs_pointer_ = &forward_log_probs_;
+  ending_forward_log_prob_ = -INFINITY;
+
+  if(use_chain_trellis_) {  // ChainTrellis doesn't have the per-edge logs that scaling gets rid of, so just use its forward
+    Forward();
+    return;
+  }
+
+  SetProfileColumns();
+  live_states_.resize(hmm_->n_states());
+  live_offsets_.resize(hmm_->n_states());
+  bool single_seq(seqs_.n_seqs() == 1);  // if there's more than one sequence we do the emissions in log space, since their product can underflow
+
+  vector<double> *alpha_current = &scoring_current_;  // scaled forward probabilities in the current column
+  vector<double> *alpha_previous = &scoring_previous_;  // same, but for the previous position
+  InitFrontier(alpha_current, alpha_previous, 0.);
+
+  double log_scale(0.);  // sum of the logs of the scale factors up to and including the current column
+  for(size_t position = 0; position < seqs_.GetSequenceLength(); ++position) {
+    if(position > 0)
+      SwapColumns(alpha_previous, alpha_current, 0.);
+
+    // sum over incoming transitions (or from init, for the first position)
+    size_t n_live(0);
+    for(auto &i_st_current : current_states_) {
+      double val(0.);
+      if(position == 0) {
+	val = hmm_->init_prob(i_st_current);
+      } else {
+	for(size_t ifrom = hmm_->from_begin(i_st_current); ifrom < hmm_->from_end(i_st_current); ++ifrom)
+	  val += (*alpha_previous)[hmm_->from_index(ifrom)] * hmm_->from_prob(ifrom);
+      }
+      if(val == 0.)
+	continue;
+      (*alpha_current)[i_st_current] = val;
+      live_states_[n_live++] = i_st_current;
+    }
+
+    // multiply by the emissions
+    if(single_seq) {
+      size_t icol(profile_columns_[profile_offsets_[position]]);
+      for(size_t il = 0; il < n_live; ++il)
+	(*alpha_current)[live_states_[il]] *= emissions_->prob(live_states_[il], icol);
+    } else {  // pull the largest emission out into the scale factor, so the rest are in [0, 1]
+      double max_emission(-INFINITY);
+      for(size_t il = 0; il < n_live; ++il) {
+	live_offsets_[il] = EmissionLogprob(live_states_[il], position);
+	max_emission = max(max_emission, live_offsets_[il]);
+      }
+      if(max_emission != -INFINITY) {
+	for(size_t il = 0; il < n_live; ++il)
+	  live_offsets_[il] -= max_emission;
+	ExpInPlace(live_offsets_.data(), n_live);
+	for(size_t il = 0; il < n_live; ++il)
+	  (*alpha_current)[live_states_[il]] *= live_offsets_[il];
+	log_scale += max_emission;
+      } else {
+	for(size_t il = 0; il < n_live; ++il)
+	  (*alpha_current)[live_states_[il]] = 0.;
+      }
+    }
+
+    // rescale, and cache the ending prob for chunk caching
+    double column_total(0.);
+    for(size_t il = 0; il < n_live; ++il)
+      column_total += (*alpha_current)[live_states_[il]];
+    if(column_total == 0.)  // no valid path through this position, so there isn't one for any longer length, either (and <forward_log_probs_> is already -INFINITY)
+      return;
+    log_scale += log(column_total);
+    double end_total(0.);
+    for(size_t il = 0; il < n_live; ++il) {
+      size_t i_st_current(live_states_[il]);
+      if((*alpha_current)[i_st_current] == 0.)
+	continue;
+      (*alpha_current)[i_st_current] /= column_total;
+      end_total += (*alpha_current)[i_st_current] * hmm_->end_prob(i_st_current);
+      AddToNextStates(i_st_current);
+    }
+    if(end_total > 0.)
+      forward_log_probs_[position] = log_scale + log(end_total);
+  }
+
+  ending_forward_log_prob_ = forward_log_probs_.back();  // NOTE unlike the viterbi values, the last entry is the same as the ending prob
+}
+
+// ----------------------------------------------------------------------------------------
+// Viterbi() and Forward() in one pass over the sequence, for when we need both the naive sequence and the log prob of the same queries
+void Trellis::ViterbiAndForward() {
+  if(cached_trellis_ || use_chain_trellis_) {  // nothing to share in these cases
+    Viterbi();
+    Forward();
+    return;
+  }
+
+  viterbi_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
+  viterbi_indices_.resize(seqs_.GetSequenceLength(), -1);
+  forward_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
+  viterbi_log_probs_pointer_ = &viterbi_log_probs_;
+  viterbi_indices_pointer_ = &viterbi_indices_;
+  forward_log_probs_pointer_ = &forward_log_probs_;
+  chain_trellis_pointer_ = nullptr;
+
+  traceback_table_.Init(seqs_.GetSequenceLength(), hmm_->n_states(), hmm_->max_from_states());
+  traceback_table_pointer_ = &traceback_table_;
+
+  SetProfileColumns();
+  edge_vals_.resize(hmm_->from_end(hmm_->n_states() - 1));
+  live_states_.resize(hmm_->n_states());
+  live_edge_begins_.resize(hmm_->n_states());
+  live_offsets_.resize(hmm_->n_states());
+  end_vals_.resize(hmm_->n_states());
+
+  vector<double> *vtb_current = &scoring_current_;
+  vector<double> *vtb_previous = &scoring_previous_;
+  vector<double> *fwd_current = &forward_scoring_current_;
+  vector<double> *fwd_previous = &forward_scoring_previous_;
+  InitFrontier(vtb_current, vtb_previous, -INFINITY);
+  fwd_current->assign(hmm_->n_states(), -INFINITY);
+  fwd_previous->assign(hmm_->n_states(), -INFINITY);
+
+  // first position
+  size_t position(0), n_end(0);
+  for(auto &i_st_current : current_states_) {
+    double emission_val = EmissionLogprob(i_st_current, position);
+    double dpval = emission_val + hmm_->init_logprob(i_st_current);
     if(dpval == -INFINITY)
       continue;
-    ending_forward_log_prob_ = AddInLogSpace(ending_forward_log_prob_, dpval);
+    (*vtb_current)[i_st_current] = dpval;
+    (*fwd_current)[i_st_current] = dpval;
+    CacheViterbiVals(position, dpval, i_st_current);
+    AddToNextStates(i_st_current);
+    if(hmm_->end_logprob(i_st_current) != -INFINITY)
+      end_vals_[n_end++] = dpval + hmm_->end_logprob(i_st_current);
+  }
+  CacheForwardVals(position, n_end);
+
+  // then the rest of the sequence
+  for(position = 1; position < seqs_.GetSequenceLength(); ++position) {
+    swap(fwd_previous, fwd_current);  // do the forward columns by hand, since SwapColumns() also moves the frontier along (which we only want to do once)
+    for(auto &ist : previous_states_)
+      (*fwd_current)[ist] = -INFINITY;
+    SwapColumns(vtb_previous, vtb_current, -INFINITY);
+    MiddleViterbiAndForwardVals(vtb_previous, vtb_current, fwd_previous, fwd_current, position);
   }
+
+  swap(fwd_previous, fwd_current);  // (don't need to reset <fwd_current> this time)
+  SwapColumns(vtb_previous, vtb_current, -INFINITY);  // NOTE after this, <previous_states_> has the states we checked at the last position
+
+  ending_viterbi_pointer_ = -1;
+  ending_viterbi_log_prob_ = -INFINITY;
+  n_end = 0;
+  for(auto &st_previous : previous_states_) {
+    if((*vtb_previous)[st_previous] != -INFINITY) {
+      double dpval = (*vtb_previous)[st_previous] + hmm_->end_logprob(st_previous);
+      if(dpval > ending_viterbi_log_prob_) {
+	ending_viterbi_log_prob_ = dpval;
+	ending_viterbi_pointer_ = st_previous;
+      }
+    }
+    if((*fwd_previous)[st_previous] != -INFINITY && hmm_->end_logprob(st_previous) != -INFINITY)
+      end_vals_[n_end++] = (*fwd_previous)[st_previous] + hmm_->end_logprob(st_previous);
+  }
+  ending_forward_log_prob_ = LogSumExp(end_vals_.data(), n_end);
 }
 
 // ----------------------------------------------------------------------------------------
@@ -284,15 +702,28 @@ void Trellis::Traceback(TracebackPath& path) {
   path.set_model(hmm_);
   if(ending_viterbi_log_prob_ == -INFINITY) return;  // no valid path through this hmm
   path.set_score(ending_viterbi_log_prob_);
+  if(chain_trellis_pointer_)
+    chain_trellis_pointer_->Traceback(seqs_.GetSequenceLength(), ending_viterbi_pointer_, path);
+  else
+    GenericTraceback(path);
+  if(hmm_->is_reversed()) {  // we went through the sequence back to front, so the path is already in forward order, but TracebackPath expects it reversed
+    path.reverse();
+    path.set_model(hmm_->reversed());
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::GenericTraceback(TracebackPath &path) {
   path.push_back(ending_viterbi_pointer_);  // push back the state that led to END state
 
   int16_t pointer(ending_viterbi_pointer_);
   for(size_t position = seqs_.GetSequenceLength() - 1; position > 0; position--) {
-    pointer = (*traceback_table_pointer_)[position][pointer];  // NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
-    if(pointer == -1) {
+    int ifrom = traceback_table_pointer_->get(position, pointer);  // NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+    if(ifrom == -1) {
       cerr << "No valid path at Position: " << position << endl;
       return;
     }
+    pointer = hmm_->from_index(hmm_->from_begin(pointer) + ifrom);
     path.push_back(pointer);
   }
   assert(path.size() > 0);  // NOTE don't remove this! dphandler assumes paths are invalid/not set if path size is zero